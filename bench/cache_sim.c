@@ -0,0 +1,303 @@
+/*
+ * Replays a trace of keys through a map and prints the hit ratio of each
+ * eviction policy the map was built with, so a policy can be judged on a
+ * workload before a server runs it. Every request is a get(), and every
+ * request that misses puts its key with force, so the map's own eviction
+ * picks what goes. bin/cache_sim runs the base map once for each
+ * map_evict_t, bin/cache_sim_lru the EC map built with EC_LRU, and
+ * bin/cache_sim_tinylfu the EC map built with EC_TINYLFU.
+ *
+ * A trace has one key per line. Without a trace file one is read from
+ * stdin, unless -z generates a Zipf trace over KEYS keys with exponent
+ * ALPHA, with a scan of SCAN_LENGTH keys used once after every
+ * SCAN_EVERY requests if -S is given.
+ *
+ * Usage: ./bin/cache_sim [-c CAPACITY] [TRACE]
+ *        ./bin/cache_sim [-c CAPACITY] -z REQUESTS [-k KEYS] [-a ALPHA] [-S SCAN_LENGTH]
+ */
+#include "utils.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NONE UINT32_MAX
+#define SCAN_EVERY 100000
+
+/* The requests, as ids of the keys they name, and the hash of each key. */
+static uint32_t *trace;
+static uint64_t requests;
+static uint32_t *hashes;
+static uint32_t num_keys;
+/* ids[id] is id, so the key of a request can point at it for as long as the map holds it. */
+static uint32_t *ids;
+
+#ifdef EC
+#ifdef EC_TINYLFU
+#define EC_POLICY "w-tinylfu"
+#elif defined(EC_LRU)
+#define EC_POLICY "lru"
+#else
+#define EC_POLICY "hashed"
+#endif
+#endif
+
+/* The policies to replay the trace through, in the order they are printed. */
+static const struct {
+    const char *name;
+    map_evict_t eviction;
+} policies[] = {
+#ifdef EC
+    {EC_POLICY, MAP_EVICT_HASHED}
+#else
+    {"hashed", MAP_EVICT_HASHED},
+    {"clock", MAP_EVICT_CLOCK},
+    {"sample", MAP_EVICT_SAMPLE}
+#endif
+};
+
+/* Fails the run when out of memory. */
+static void *checked(void *ptr) {
+    if(ptr == NULL){
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void append(uint32_t id) {
+    static uint64_t room;
+    if(requests == room){
+        room = room == 0 ? 1024 : room * 2;
+        trace = checked(realloc(trace, room * sizeof(uint32_t)));
+    }
+    trace[requests++] = id;
+}
+
+/*
+ * @return A new id for a key, with its hash recorded.
+ */
+static uint32_t new_key(void *key, size_t size) {
+    static uint32_t room;
+    if(num_keys == room){
+        room = room == 0 ? 1024 : room * 2;
+        hashes = checked(realloc(hashes, room * sizeof(uint32_t)));
+    }
+    hashes[num_keys] = jenkins_one_at_a_time_hash(MAP_KEY(key, size));
+    return num_keys++;
+}
+
+/*
+ * Reads a trace, giving each distinct key an id in an open addressed table.
+ *
+ * @return false if the file can not be read.
+ */
+static bool read_trace(FILE *file) {
+    uint32_t capacity = 1024;
+    uint32_t *table = checked(malloc(capacity * sizeof(uint32_t)));
+    char **keys = NULL;
+    memset(table, 0xFF, capacity * sizeof(uint32_t));
+    char *line = NULL;
+    size_t room = 0;
+    ssize_t length;
+    while((length = getline(&line, &room, file)) != -1){
+        while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+            line[--length] = '\0';
+        }
+        if(length == 0){
+            continue;
+        }
+        uint32_t hash = jenkins_one_at_a_time_hash(MAP_KEY(line, length));
+        uint32_t index = hash & (capacity - 1);
+        while(table[index] != NONE && strcmp(keys[table[index]], line) != 0){
+            index = (index + 1) & (capacity - 1);
+        }
+        if(table[index] == NONE){
+            table[index] = new_key(line, length);
+            keys = checked(realloc(keys, num_keys * sizeof(char *)));
+            keys[table[index]] = checked(strdup(line));
+            //KEEP THE TABLE AT MOST HALF FULL. REBUILD IT TWICE AS BIG FROM THE KEYS SEEN.
+            if(num_keys * 2 > capacity){
+                capacity *= 2;
+                table = checked(realloc(table, capacity * sizeof(uint32_t)));
+                memset(table, 0xFF, capacity * sizeof(uint32_t));
+                for(uint32_t id = 0; id < num_keys; id++){
+                    uint32_t slot = hashes[id] & (capacity - 1);
+                    while(table[slot] != NONE){
+                        slot = (slot + 1) & (capacity - 1);
+                    }
+                    table[slot] = id;
+                }
+                index = hash & (capacity - 1);
+                while(table[index] != num_keys - 1){
+                    index = (index + 1) & (capacity - 1);
+                }
+            }
+        }
+        append(table[index]);
+    }
+    bool read = !ferror(file);
+    for(uint32_t id = 0; id < num_keys; id++){
+        free(keys[id]);
+    }
+    free(keys);
+    free(table);
+    free(line);
+    return read;
+}
+
+/* xorshift64* */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Generates a trace of Zipf distributed requests over keys 0 to keys - 1,
+ * by rank, with scans of keys never seen again mixed in.
+ */
+static void generate_trace(uint64_t count, uint32_t keys, double alpha, uint32_t scan_length) {
+    double *cdf = checked(malloc(keys * sizeof(double)));
+    double total = 0;
+    for(uint32_t rank = 0; rank < keys; rank++){
+        total += 1 / pow(rank + 1, alpha);
+        cdf[rank] = total;
+    }
+    for(uint32_t id = 0; id < keys; id++){
+        new_key(&id, sizeof(id));
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for(uint64_t i = 1; i <= count; i++){
+        double pick = (next_random(&state) >> 11) * (1.0 / (1ULL << 53)) * total;
+        uint32_t low = 0, high = keys - 1;
+        while(low < high){
+            uint32_t middle = low + (high - low) / 2;
+            if(cdf[middle] < pick){
+                low = middle + 1;
+            }
+            else{
+                high = middle;
+            }
+        }
+        append(low);
+        if(scan_length > 0 && i % SCAN_EVERY == 0){
+            for(uint32_t j = 0; j < scan_length; j++){
+                uint32_t id = num_keys;
+                append(new_key(&id, sizeof(id)));
+            }
+        }
+    }
+    free(cdf);
+}
+
+/* The map owns neither keys nor values. */
+static void keep(map_key_t key, map_val_t val) {
+}
+
+/*
+ * Replays the trace through a map of capacity entries that evicts as
+ * eviction says.
+ *
+ * @return The requests that hit, or UINT64_MAX if the map can not be
+ *         created or a put() fails.
+ */
+static uint64_t simulate(uint32_t capacity, map_evict_t eviction) {
+    static char present;
+    hashmap_t *map = create_map(capacity, jenkins_one_at_a_time_hash, keep);
+    if(map == NULL){
+        return UINT64_MAX;
+    }
+    if(!set_eviction(map, eviction)){
+        invalidate_map(map);
+        return UINT64_MAX;
+    }
+    uint64_t hits = 0;
+    for(uint64_t i = 0; i < requests; i++){
+        map_key_t key = MAP_KEY(&ids[trace[i]], sizeof(uint32_t));
+        if(get(map, key).val_base != NULL){
+            hits++;
+        }
+        else if(!put(map, key, MAP_VAL(&present, sizeof(present)), true)){
+            hits = UINT64_MAX;
+            break;
+        }
+    }
+    invalidate_map(map);
+    return hits;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    uint32_t capacity = 1000, keys = 100000, scan_length = 0;
+    uint64_t generate = 0;
+    double alpha = 0.9;
+    while((opt = getopt(argc, argv, "c:z:k:a:S:")) != -1){
+        switch(opt){
+            case 'c':
+                capacity = atoi(optarg);
+                break;
+            case 'z':
+                generate = strtoull(optarg, NULL, 10);
+                break;
+            case 'k':
+                keys = atoi(optarg);
+                break;
+            case 'a':
+                alpha = atof(optarg);
+                break;
+            case 'S':
+                scan_length = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c CAPACITY] [TRACE]\n"
+                                "       %s [-c CAPACITY] -z REQUESTS [-k KEYS] [-a ALPHA] [-S SCAN_LENGTH]\n", argv[0], argv[0]);
+                return 1;
+        }
+    }
+    if(capacity == 0 || (generate > 0 && (keys == 0 || alpha <= 0))){
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    if(generate > 0){
+        generate_trace(generate, keys, alpha, scan_length);
+    }
+    else{
+        FILE *file = optind < argc ? fopen(argv[optind], "r") : stdin;
+        if(file == NULL || !read_trace(file)){
+            perror("Could not read the trace");
+            return 1;
+        }
+        if(file != stdin){
+            fclose(file);
+        }
+    }
+    if(requests == 0){
+        fprintf(stderr, "The trace is empty\n");
+        return 1;
+    }
+
+    ids = checked(malloc(num_keys * sizeof(uint32_t)));
+    for(uint32_t id = 0; id < num_keys; id++){
+        ids[id] = id;
+    }
+    printf("%lu requests, %u distinct keys, %u entries\n", (unsigned long) requests, num_keys, capacity);
+    for(size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++){
+        uint64_t hits = simulate(capacity, policies[i].eviction);
+        if(hits == UINT64_MAX){
+            perror("Could not replay the trace");
+            return 1;
+        }
+        printf("%-12s %6.2f%% hits\n", policies[i].name, 100.0 * hits / requests);
+    }
+    free(ids);
+    free(trace);
+    free(hashes);
+    return 0;
+}
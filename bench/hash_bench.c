@@ -0,0 +1,87 @@
+/*
+ * Measures the throughput of every hash function in hash_functions[] over
+ * key sizes from 1 byte to MAX_KEY_SIZE. Each size is hashed repeatedly for
+ * a fixed time, from keys at shifting offsets of a random buffer so no two
+ * calls in a row hash the same bytes.
+ *
+ * Usage: ./bin/hash_bench [-t MILLISECONDS_PER_SIZE]
+ */
+#include "cream.h"
+#include "hash.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Distinct key offsets cycled through, so the buffer stays in cache. */
+#define BENCH_OFFSETS 64
+/* Calls between checks of the clock. */
+#define BENCH_BATCH 1024
+
+static const size_t sizes[] = {1, 3, 4, 8, 13, 16, 24, 32, 48, 64, 100, 128, 256, 512, 1024, 2048};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * @return Nanoseconds per call of hash on keys of size bytes.
+ */
+static double measure(hash_func_f hash, const uint8_t *buffer, size_t size, double seconds) {
+    volatile uint32_t sink = 0;
+    uint64_t calls = 0;
+    double start = now(), elapsed;
+    do{
+        for(int i = 0; i < BENCH_BATCH; i++){
+            sink ^= hash(MAP_KEY((void *) (buffer + i % BENCH_OFFSETS), size));
+        }
+        calls += BENCH_BATCH;
+    }while((elapsed = now() - start) < seconds);
+    (void) sink;
+    return elapsed / calls * 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int milliseconds = 200;
+    int opt;
+    while((opt = getopt(argc, argv, "t:")) != -1){
+        switch(opt){
+            case 't':
+                milliseconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t MILLISECONDS_PER_SIZE]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(milliseconds < 1){
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    uint8_t *buffer = malloc(MAX_KEY_SIZE + BENCH_OFFSETS);
+    srand(1);
+    for(size_t i = 0; i < MAX_KEY_SIZE + BENCH_OFFSETS; i++){
+        buffer[i] = rand();
+    }
+
+    printf("%-8s", "bytes");
+    for(const hash_entry_t *entry = hash_functions; entry->name != NULL; entry++){
+        printf(" %10s ns %8s GB/s", entry->name, "");
+    }
+    printf("\n");
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        printf("%-8zu", sizes[s]);
+        for(const hash_entry_t *entry = hash_functions; entry->name != NULL; entry++){
+            double ns = measure(entry->function, buffer, sizes[s], milliseconds / 1e3);
+            printf(" %13.1f %13.2f", ns, sizes[s] / ns);
+        }
+        printf("\n");
+    }
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Measures how long put() waits for the map's lock while other threads keep
+ * it busy with get(). Every thread runs the same mix of operations on a
+ * shared, preloaded map, and the latency of each put() is recorded.
+ *
+ * Usage: ./bin/lock_bench [-n THREADS] [-t SECONDS] [-w PUT_PERCENT] [-k KEYS] [-s SHARDS]
+ */
+#include "hashmap.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_VALUE_SIZE 64
+
+typedef struct worker_t {
+    pthread_t tid;
+    unsigned int seed;
+    uint64_t gets;
+    uint64_t puts;
+    double *latencies;
+    size_t nlatencies;
+    size_t cap;
+} worker_t;
+
+static int threads = 8;
+static int seconds = 2;
+static int put_percent = 5;
+static int keys = 10000;
+static int shards = 1;
+
+static hashmap_t *map;
+static volatile bool running;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t fnv_hash(map_key_t key) {
+    const uint8_t *bytes = key.key_base;
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < key.key_len; i++){
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void free_entry(map_key_t key, map_val_t val) {
+    free(key.key_base);
+    free(val.val_base);
+}
+
+/*
+ * Allocates an entry for key n. Kept out of the timed section, so only put() is measured.
+ */
+static void make_entry(int n, map_key_t *key, map_val_t *val) {
+    int *key_base = malloc(sizeof(int));
+    char *val_base = malloc(BENCH_VALUE_SIZE);
+    *key_base = n;
+    memset(val_base, 'v', BENCH_VALUE_SIZE);
+    *key = (map_key_t) {key_base, sizeof(int)};
+    *val = (map_val_t) {val_base, BENCH_VALUE_SIZE};
+}
+
+static void *run(void *vargp) {
+    worker_t *self = vargp;
+    while(running){
+        int n = rand_r(&self->seed) % keys;
+        if(rand_r(&self->seed) % 100 < put_percent){
+            map_key_t key;
+            map_val_t val;
+            make_entry(n, &key, &val);
+            double start = now();
+            put(map, key, val, true);
+            double elapsed = now() - start;
+            if(self->nlatencies == self->cap){
+                self->cap = self->cap ? self->cap * 2 : 4096;
+                self->latencies = realloc(self->latencies, self->cap * sizeof(double));
+            }
+            self->latencies[self->nlatencies++] = elapsed;
+            self->puts++;
+        }
+        else{
+            get(map, (map_key_t) {&n, sizeof(int)});
+            self->gets++;
+        }
+    }
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, size_t n, double p) {
+    if(n == 0){
+        return 0;
+    }
+    size_t i = (size_t) (p / 100 * (n - 1));
+    return sorted[i];
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "n:t:w:k:s:")) != -1){
+        switch(opt){
+            case 'n':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'w':
+                put_percent = atoi(optarg);
+                break;
+            case 'k':
+                keys = atoi(optarg);
+                break;
+            case 's':
+                shards = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n THREADS] [-t SECONDS] [-w PUT_PERCENT] [-k KEYS] [-s SHARDS]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(threads < 1 || seconds < 1 || put_percent < 0 || put_percent > 100 || keys < 1 || shards < 1){
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    //TWICE THE KEYS SO PROBE SEQUENCES STAY SHORT AND THE LOCK IS WHAT IS MEASURED.
+    map = create_sharded_map(keys * 2, shards, fnv_hash, free_entry);
+    for(int i = 0; i < keys; i++){
+        map_key_t key;
+        map_val_t val;
+        make_entry(i, &key, &val);
+        put(map, key, val, true);
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    running = true;
+    double start = now();
+    for(int i = 0; i < threads; i++){
+        workers[i].seed = i + 1;
+        pthread_create(&workers[i].tid, NULL, run, &workers[i]);
+    }
+    sleep(seconds);
+    running = false;
+    for(int i = 0; i < threads; i++){
+        pthread_join(workers[i].tid, NULL);
+    }
+    double elapsed = now() - start;
+
+    uint64_t gets = 0, puts = 0;
+    size_t n = 0;
+    for(int i = 0; i < threads; i++){
+        gets += workers[i].gets;
+        puts += workers[i].puts;
+        n += workers[i].nlatencies;
+    }
+    double *latencies = malloc((n ? n : 1) * sizeof(double));
+    size_t off = 0;
+    for(int i = 0; i < threads; i++){
+        memcpy(latencies + off, workers[i].latencies, workers[i].nlatencies * sizeof(double));
+        off += workers[i].nlatencies;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, n, sizeof(double), compare_doubles);
+
+    printf("%d threads, %d%% puts, %d keys, %d shards, %d s\n", threads, put_percent, keys, shards, seconds);
+    printf("%-12s %12.0f ops/s\n", "get", gets / elapsed);
+    printf("%-12s %12.0f ops/s\n", "put", puts / elapsed);
+    printf("%-12s %9.1f us p50 %9.1f us p99 %9.1f us p99.9 %9.1f us max\n", "put latency",
+        percentile(latencies, n, 50) * 1e6, percentile(latencies, n, 99) * 1e6,
+        percentile(latencies, n, 99.9) * 1e6, n ? latencies[n - 1] * 1e6 : 0);
+
+    free(latencies);
+    free(workers);
+    invalidate_map(map);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Measures allocation throughput and memory overhead under churn. Threads
+ * keep replacing random entries of a shared table of live allocations with
+ * new ones of random size, so memory allocated by one thread is often freed
+ * by another, as items are in the server. Sizes are those of items with
+ * keys of 1 to 64 bytes and values of MIN_VALUE_SIZE to MAX_VALUE_SIZE bytes.
+ * After the run the resident set size is compared with the bytes still live.
+ *
+ * Usage: ./bin/slab_bench [-n THREADS] [-t SECONDS] [-k LIVE_ENTRIES] [-m]
+ *        -m uses malloc() and free() instead of the slab allocator.
+ */
+#include "cream.h"
+#include "item.h"
+#include "slab.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct entry_t {
+    void *ptr;
+    size_t size;
+} entry_t;
+
+typedef struct worker_t {
+    pthread_t tid;
+    unsigned int seed;
+    uint64_t ops;
+} worker_t;
+
+static int threads = 4;
+static int seconds = 2;
+static int live = 200000;
+static bool use_malloc = false;
+
+static entry_t *table;
+static pthread_mutex_t *locks;
+static volatile bool running;
+
+/* Entries guarded by each lock. */
+#define BENCH_STRIPE 64
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t random_size(unsigned int *seed) {
+    size_t key = 1 + rand_r(seed) % 64;
+    size_t val = MIN_VALUE_SIZE + rand_r(seed) % (MAX_VALUE_SIZE - MIN_VALUE_SIZE + 1);
+    return sizeof(item_t) + key + val;
+}
+
+static void *bench_alloc(size_t size) {
+    void *ptr = use_malloc ? malloc(size) : slab_alloc(size);
+    //TOUCH EVERY PAGE OF IT, AS COPYING A KEY AND VALUE IN WOULD.
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+static void bench_free(void *ptr, size_t size) {
+    if(use_malloc){
+        free(ptr);
+    }
+    else{
+        slab_free(ptr, size);
+    }
+}
+
+static void *run(void *vargp) {
+    worker_t *self = vargp;
+    while(running){
+        int n = rand_r(&self->seed) % live;
+        size_t size = random_size(&self->seed);
+        void *ptr = bench_alloc(size);
+        pthread_mutex_lock(&locks[n / BENCH_STRIPE]);
+        entry_t old = table[n];
+        table[n] = (entry_t) {ptr, size};
+        pthread_mutex_unlock(&locks[n / BENCH_STRIPE]);
+        bench_free(old.ptr, old.size);
+        self->ops++;
+    }
+    return NULL;
+}
+
+/*
+ * @return The resident set size of the process in bytes.
+ */
+static size_t resident_bytes() {
+    long size = 0, pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm != NULL){
+        if(fscanf(statm, "%ld %ld", &size, &pages) != 2){
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return (size_t) pages * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "n:t:k:m")) != -1){
+        switch(opt){
+            case 'n':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'k':
+                live = atoi(optarg);
+                break;
+            case 'm':
+                use_malloc = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n THREADS] [-t SECONDS] [-k LIVE_ENTRIES] [-m]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(threads < 1 || seconds < 1 || live < 1){
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    size_t base = resident_bytes();
+    table = calloc(live, sizeof(entry_t));
+    locks = calloc(live / BENCH_STRIPE + 1, sizeof(pthread_mutex_t));
+    for(int i = 0; i <= live / BENCH_STRIPE; i++){
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    unsigned int seed = 0;
+    for(int i = 0; i < live; i++){
+        size_t size = random_size(&seed);
+        table[i] = (entry_t) {bench_alloc(size), size};
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    running = true;
+    double start = now();
+    for(int i = 0; i < threads; i++){
+        workers[i].seed = i + 1;
+        pthread_create(&workers[i].tid, NULL, run, &workers[i]);
+    }
+    sleep(seconds);
+    running = false;
+    for(int i = 0; i < threads; i++){
+        pthread_join(workers[i].tid, NULL);
+    }
+    double elapsed = now() - start;
+
+    uint64_t ops = 0;
+    for(int i = 0; i < threads; i++){
+        ops += workers[i].ops;
+    }
+    size_t live_bytes = 0;
+    for(int i = 0; i < live; i++){
+        live_bytes += table[i].size;
+    }
+    size_t resident = resident_bytes() - base;
+
+    printf("%s, %d threads, %d live entries, %d s\n", use_malloc ? "malloc" : "slab", threads, live, seconds);
+    printf("%-12s %12.0f ops/s\n", "churn", ops / elapsed);
+    printf("%-12s %9.1f MB live %9.1f MB resident %6.2fx\n", "memory",
+        live_bytes / 1e6, resident / 1e6, (double) resident / live_bytes);
+
+    for(int i = 0; i < live; i++){
+        bench_free(table[i].ptr, table[i].size);
+    }
+    free(workers);
+    free(locks);
+    free(table);
+    return 0;
+}
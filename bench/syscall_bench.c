@@ -0,0 +1,341 @@
+/*
+ * Compares the serving backends of cream by throughput and by system calls
+ * per request. Each backend is started twice: once untraced to measure
+ * requests per second, and once under a ptrace tracer that counts every system
+ * call made by any of the server's threads.
+ *
+ * Usage: ./bin/syscall_bench [-c CONNECTIONS] [-d PIPELINE_DEPTH] [-t SECONDS] [PATH_TO_CREAM]
+ */
+#include "cream.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT 19311
+#define BENCH_WORKERS "4"
+#define BENCH_KEY "bench-key"
+#define BENCH_VALUE_SIZE 64
+
+typedef struct backend_t {
+    const char *name;
+    const char *flags[4];
+} backend_t;
+
+static const backend_t backends[] = {
+    {"blocking", {"-k", NULL}},
+    {"epoll", {"-e", "-k", NULL}},
+    {"epoll-inline", {"-e", "-i", "-k", NULL}},
+    {"epoll-reuseport", {"-e", "-r", "-k", NULL}},
+    {"io_uring", {"-u", "-k", NULL}},
+};
+
+static const char *cream_path = "bin/cream";
+static int connections = 4;
+static int depth = 16;
+static int seconds = 2;
+
+static volatile bool running;
+static uint64_t completed;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while(len > 0){
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while(len > 0){
+        ssize_t n = recv(fd, p, len, 0);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int connect_server(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //THE SERVER MAY STILL BE STARTING UP.
+    for(int tries = 0; tries < 200; tries++){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0){
+            return -1;
+        }
+        if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0){
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static size_t put_frame(char *buf, uint8_t code, const char *value, uint32_t value_size) {
+    request_header_t header = {code, sizeof(BENCH_KEY) - 1, value_size};
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), BENCH_KEY, sizeof(BENCH_KEY) - 1);
+    if(value_size > 0){
+        memcpy(buf + sizeof(header) + sizeof(BENCH_KEY) - 1, value, value_size);
+    }
+    return sizeof(header) + sizeof(BENCH_KEY) - 1 + value_size;
+}
+
+/*
+ * Keeps depth GET requests in flight on one connection until running is cleared.
+ */
+static void *client(void *vargp) {
+    int fd = connect_server(*(int *) vargp);
+    if(fd < 0){
+        return NULL;
+    }
+
+    size_t frame_size = sizeof(request_header_t) + sizeof(BENCH_KEY) - 1;
+    size_t response_size = sizeof(response_header_t) + BENCH_VALUE_SIZE;
+    char *requests = malloc(frame_size * depth);
+    char *responses = malloc(response_size * depth);
+    for(int i = 0; i < depth; i++){
+        put_frame(requests + i * frame_size, GET, NULL, 0);
+    }
+
+    while(running){
+        if(!send_all(fd, requests, frame_size * depth) || !recv_all(fd, responses, response_size * depth)){
+            break;
+        }
+        __atomic_add_fetch(&completed, depth, __ATOMIC_RELAXED);
+    }
+    free(requests);
+    free(responses);
+    close(fd);
+    return NULL;
+}
+
+static pid_t spawn_server(const backend_t *backend, int port, bool traced) {
+    pid_t pid = fork();
+    if(pid != 0){
+        return pid;
+    }
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = (char *) cream_path;
+    for(int i = 0; backend->flags[i] != NULL; i++){
+        argv[argc++] = (char *) backend->flags[i];
+    }
+    argv[argc++] = BENCH_WORKERS;
+    argv[argc++] = port_str;
+    argv[argc++] = "1024";
+    argv[argc] = NULL;
+
+    if(traced){
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    }
+    execv(cream_path, argv);
+    perror("execv");
+    _exit(1);
+}
+
+/*
+ * Starts the server as a tracee and adds every system call any of its threads
+ * makes to *count until the server exits. Runs in its own process because
+ * ptrace only lets the tracer's threads wait on the tracee.
+ */
+static pid_t spawn_tracer(const backend_t *backend, int port, uint64_t *count) {
+    pid_t tracer = fork();
+    if(tracer != 0){
+        return tracer;
+    }
+
+    pid_t server = spawn_server(backend, port, true);
+    int status;
+    //THE FIRST STOP IS THE SIGTRAP FROM execv().
+    if(waitpid(server, &status, 0) < 0 || !WIFSTOPPED(status)){
+        _exit(1);
+    }
+    ptrace(PTRACE_SETOPTIONS, server, NULL,
+        PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, server, NULL, NULL);
+
+    uint64_t stops = 0;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, __WALL)) > 0){
+        if(!WIFSTOPPED(status)){
+            if(pid == server){
+                break;
+            }
+            continue;
+        }
+        int sig = WSTOPSIG(status);
+        if(sig == (SIGTRAP | 0x80)){
+            //SYSTEM CALL ENTRY AND EXIT EACH STOP ONCE.
+            if(++stops % 2 == 0){
+                __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+            }
+            sig = 0;
+        }
+        else if(status >> 16 != 0 || sig == SIGSTOP || sig == SIGTRAP){
+            //PTRACE EVENTS AND THE INITIAL STOP OF EVERY NEW THREAD ARE NOT REAL SIGNALS.
+            sig = 0;
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) sig);
+    }
+    _exit(0);
+}
+
+/*
+ * Runs the clients against a server on port for the configured duration.
+ *
+ * @param count The counter the server's tracer updates, or NULL if it is untraced.
+ * @param per_request Set to the number of system calls made per request if count is given.
+ * @return The number of requests completed per second, or -1 if the server could not be reached.
+ */
+static double measure(int port, uint64_t *count, double *per_request) {
+    //STORE THE KEY EVERY GET ASKS FOR.
+    int fd = connect_server(port);
+    if(fd < 0){
+        return -1;
+    }
+    char value[BENCH_VALUE_SIZE];
+    memset(value, 'v', sizeof(value));
+    char frame[sizeof(request_header_t) + sizeof(BENCH_KEY) + BENCH_VALUE_SIZE];
+    response_header_t response;
+    bool stored = send_all(fd, frame, put_frame(frame, PUT, value, sizeof(value)))
+        && recv_all(fd, &response, sizeof(response)) && response.response_code == OK;
+    close(fd);
+    if(!stored){
+        return -1;
+    }
+
+    pthread_t threads[connections];
+    completed = 0;
+    running = true;
+    for(int i = 0; i < connections; i++){
+        pthread_create(&threads[i], NULL, client, &port);
+    }
+    //LET THE CONNECTIONS GET ESTABLISHED BEFORE MEASURING.
+    usleep(200000);
+    uint64_t start_requests = __atomic_load_n(&completed, __ATOMIC_RELAXED);
+    uint64_t start_syscalls = count != NULL ? __atomic_load_n(count, __ATOMIC_RELAXED) : 0;
+    double start = now();
+    sleep(seconds);
+    uint64_t requests = __atomic_load_n(&completed, __ATOMIC_RELAXED) - start_requests;
+    uint64_t syscalls = count != NULL ? __atomic_load_n(count, __ATOMIC_RELAXED) - start_syscalls : 0;
+    double elapsed = now() - start;
+    running = false;
+    for(int i = 0; i < connections; i++){
+        pthread_join(threads[i], NULL);
+    }
+    if(requests == 0){
+        return -1;
+    }
+    if(count != NULL){
+        *per_request = (double) syscalls / requests;
+    }
+    return requests / elapsed;
+}
+
+static void stop(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "c:d:t:")) != -1){
+        switch(opt){
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c CONNECTIONS] [-d PIPELINE_DEPTH] [-t SECONDS] [PATH_TO_CREAM]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if(optind < argc){
+        cream_path = argv[optind];
+    }
+    if(connections < 1 || depth < 1 || seconds < 1){
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t *count = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(count == MAP_FAILED){
+        exit(1);
+    }
+
+    printf("%d connections, %d requests in flight each, GET of a %d byte value\n\n",
+        connections, depth, BENCH_VALUE_SIZE);
+    printf("%-16s %14s %18s\n", "backend", "requests/s", "syscalls/request");
+    for(size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++){
+        //A FRESH PORT PER SERVER AVOIDS RACING THE PREVIOUS ONE'S LISTENER.
+        int port = BENCH_PORT + 2 * i;
+        double per_request = 0;
+
+        pid_t server = spawn_server(&backends[i], port, false);
+        double rate = measure(port, NULL, NULL);
+        stop(server);
+
+        *count = 0;
+        pid_t tracer = spawn_tracer(&backends[i], port + 1, count);
+        double traced_rate = measure(port + 1, count, &per_request);
+        //THE TRACEE IS KILLED ALONG WITH ITS TRACER.
+        stop(tracer);
+
+        if(rate < 0 || traced_rate < 0){
+            printf("%-16s %14s %18s\n", backends[i].name, "failed", "-");
+            continue;
+        }
+        printf("%-16s %14.0f %18.3f\n", backends[i].name, rate, per_request);
+    }
+    return 0;
+}
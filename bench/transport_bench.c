@@ -0,0 +1,350 @@
+/*
+ * Compares loopback TCP with the AF_UNIX listener and the shared-memory rings.
+ * One server serves all three transports. Each is measured with a single client doing one GET at a time,
+ * for latency, and with several clients keeping GETs pipelined, for throughput.
+ *
+ * Usage: ./bin/transport_bench [-c CONNECTIONS] [-d PIPELINE_DEPTH] [-t SECONDS] [PATH_TO_CREAM]
+ */
+#include "cream.h"
+#include "shm.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT 19411
+#define BENCH_WORKERS "4"
+#define BENCH_KEY "bench-key"
+#define BENCH_VALUE_SIZE 64
+#define MAX_SAMPLES (1 << 22)
+
+static const char *cream_path = "bin/cream";
+static char unix_path[64];
+static char shm_path[64];
+static int connections = 4;
+static int depth = 16;
+static int seconds = 2;
+
+typedef enum transport_t { TCP, UNIX, SHM } transport_t;
+
+static const char *transport_names[] = {"tcp", "unix", "shm"};
+
+/*
+ * A client connection over any of the transports.
+ */
+typedef struct client_t {
+    int fd;
+    shm_client_t *shm;
+} client_t;
+
+static volatile bool running;
+static uint64_t completed;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool send_all(client_t *client, const void *buf, size_t len) {
+    if(client->shm != NULL){
+        return shm_send(client->shm, buf, len) == len;
+    }
+    const char *p = buf;
+    while(len > 0){
+        ssize_t n = send(client->fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_all(client_t *client, void *buf, size_t len) {
+    char *p = buf;
+    while(len > 0){
+        ssize_t n = client->shm != NULL ? shm_recv(client->shm, p, len) : recv(client->fd, p, len, 0);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Connects a socket over TCP or the AF_UNIX socket.
+ */
+static int connect_socket(bool use_unix) {
+    struct sockaddr_in in_addr;
+    struct sockaddr_un un_addr;
+    struct sockaddr *addr;
+    socklen_t addr_len;
+    if(use_unix){
+        memset(&un_addr, 0, sizeof(un_addr));
+        un_addr.sun_family = AF_UNIX;
+        strcpy(un_addr.sun_path, unix_path);
+        addr = (struct sockaddr *) &un_addr;
+        addr_len = sizeof(un_addr);
+    }
+    else{
+        memset(&in_addr, 0, sizeof(in_addr));
+        in_addr.sin_family = AF_INET;
+        in_addr.sin_port = htons(BENCH_PORT);
+        in_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr = (struct sockaddr *) &in_addr;
+        addr_len = sizeof(in_addr);
+    }
+
+    //THE SERVER MAY STILL BE STARTING UP.
+    for(int tries = 0; tries < 200; tries++){
+        int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+        if(fd < 0){
+            return -1;
+        }
+        if(connect(fd, addr, addr_len) == 0){
+            if(!use_unix){
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+            }
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static bool connect_server(client_t *client, transport_t transport) {
+    client->fd = -1;
+    client->shm = NULL;
+    if(transport == SHM){
+        client->shm = shm_attach(shm_path);
+        return client->shm != NULL;
+    }
+    client->fd = connect_socket(transport == UNIX);
+    return client->fd >= 0;
+}
+
+static void disconnect_server(client_t *client) {
+    if(client->shm != NULL){
+        shm_detach(client->shm);
+    }
+    else{
+        close(client->fd);
+    }
+}
+
+static size_t put_frame(char *buf, uint8_t code, const char *value, uint32_t value_size) {
+    request_header_t header = {code, sizeof(BENCH_KEY) - 1, value_size};
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), BENCH_KEY, sizeof(BENCH_KEY) - 1);
+    if(value_size > 0){
+        memcpy(buf + sizeof(header) + sizeof(BENCH_KEY) - 1, value, value_size);
+    }
+    return sizeof(header) + sizeof(BENCH_KEY) - 1 + value_size;
+}
+
+/*
+ * Keeps depth GET requests in flight on one connection until running is cleared.
+ */
+static void *pipelined_client(void *vargp) {
+    client_t client;
+    if(!connect_server(&client, *(transport_t *) vargp)){
+        return NULL;
+    }
+
+    size_t frame_size = sizeof(request_header_t) + sizeof(BENCH_KEY) - 1;
+    size_t response_size = sizeof(response_header_t) + BENCH_VALUE_SIZE;
+    char *requests = malloc(frame_size * depth);
+    char *responses = malloc(response_size * depth);
+    for(int i = 0; i < depth; i++){
+        put_frame(requests + i * frame_size, GET, NULL, 0);
+    }
+
+    while(running){
+        if(!send_all(&client, requests, frame_size * depth) || !recv_all(&client, responses, response_size * depth)){
+            break;
+        }
+        __atomic_add_fetch(&completed, depth, __ATOMIC_RELAXED);
+    }
+    free(requests);
+    free(responses);
+    disconnect_server(&client);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sends one GET at a time on a single connection for the configured duration.
+ *
+ * @param p50 Set to the median round trip in microseconds.
+ * @param p99 Set to the 99th percentile round trip in microseconds.
+ * @return Requests per second, or -1 if the server could not be reached.
+ */
+static double measure_latency(transport_t transport, double *p50, double *p99) {
+    client_t client;
+    if(!connect_server(&client, transport)){
+        return -1;
+    }
+    uint64_t *samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    if(samples == NULL){
+        disconnect_server(&client);
+        return -1;
+    }
+
+    char request[sizeof(request_header_t) + sizeof(BENCH_KEY)];
+    size_t request_size = put_frame(request, GET, NULL, 0);
+    char response[sizeof(response_header_t) + BENCH_VALUE_SIZE];
+    size_t count = 0;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t) seconds * 1000000000;
+    uint64_t sent = start;
+    while(sent < end && count < MAX_SAMPLES){
+        if(!send_all(&client, request, request_size) || !recv_all(&client, response, sizeof(response))){
+            break;
+        }
+        uint64_t received = now_ns();
+        samples[count++] = received - sent;
+        sent = received;
+    }
+    disconnect_server(&client);
+
+    double rate = -1;
+    if(count > 0){
+        qsort(samples, count, sizeof(uint64_t), compare_u64);
+        *p50 = samples[count / 2] / 1000.0;
+        *p99 = samples[count * 99 / 100] / 1000.0;
+        rate = count / ((sent - start) / 1e9);
+    }
+    free(samples);
+    return rate;
+}
+
+/*
+ * Runs the pipelined clients for the configured duration.
+ *
+ * @return Requests per second, or -1 if nothing completed.
+ */
+static double measure_throughput(transport_t transport) {
+    pthread_t threads[connections];
+    completed = 0;
+    running = true;
+    for(int i = 0; i < connections; i++){
+        pthread_create(&threads[i], NULL, pipelined_client, &transport);
+    }
+    //LET THE CONNECTIONS GET ESTABLISHED BEFORE MEASURING.
+    usleep(200000);
+    uint64_t start_requests = __atomic_load_n(&completed, __ATOMIC_RELAXED);
+    uint64_t start = now_ns();
+    sleep(seconds);
+    uint64_t requests = __atomic_load_n(&completed, __ATOMIC_RELAXED) - start_requests;
+    uint64_t elapsed = now_ns() - start;
+    running = false;
+    for(int i = 0; i < connections; i++){
+        pthread_join(threads[i], NULL);
+    }
+    return requests > 0 ? requests / (elapsed / 1e9) : -1;
+}
+
+/*
+ * Stores the key every GET asks for.
+ */
+static bool store_key() {
+    client_t client;
+    if(!connect_server(&client, TCP)){
+        return false;
+    }
+    char value[BENCH_VALUE_SIZE];
+    memset(value, 'v', sizeof(value));
+    char frame[sizeof(request_header_t) + sizeof(BENCH_KEY) + BENCH_VALUE_SIZE];
+    response_header_t response;
+    bool stored = send_all(&client, frame, put_frame(frame, PUT, value, sizeof(value)))
+        && recv_all(&client, &response, sizeof(response)) && response.response_code == OK;
+    disconnect_server(&client);
+    return stored;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "c:d:t:")) != -1){
+        switch(opt){
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c CONNECTIONS] [-d PIPELINE_DEPTH] [-t SECONDS] [PATH_TO_CREAM]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if(optind < argc){
+        cream_path = argv[optind];
+    }
+    if(connections < 1 || depth < 1 || seconds < 1){
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    snprintf(unix_path, sizeof(unix_path), "/tmp/cream-bench-%d.sock", (int) getpid());
+    snprintf(shm_path, sizeof(shm_path), "/dev/shm/cream-bench-%d", (int) getpid());
+
+    pid_t server = fork();
+    if(server == 0){
+        char port[16];
+        snprintf(port, sizeof(port), "%d", BENCH_PORT);
+        execl(cream_path, cream_path, "-e", "-k", "-s", unix_path, "-m", shm_path, BENCH_WORKERS, port, "1024", (char *) NULL);
+        perror("execl");
+        _exit(1);
+    }
+    if(!store_key()){
+        fprintf(stderr, "Could not reach %s\n", cream_path);
+        kill(server, SIGKILL);
+        exit(1);
+    }
+
+    printf("GET of a %d byte value. Pipelined: %d connections, %d requests in flight each\n\n",
+        BENCH_VALUE_SIZE, connections, depth);
+    printf("%-10s %14s %10s %10s %16s\n", "transport", "1-conn req/s", "p50 us", "p99 us", "pipelined req/s");
+    for(transport_t transport = TCP; transport <= SHM; transport++){
+        double p50 = 0, p99 = 0;
+        double rate = measure_latency(transport, &p50, &p99);
+        double throughput = measure_throughput(transport);
+        printf("%-10s %14.0f %10.1f %10.1f %16.0f\n", transport_names[transport], rate, p50, p99, throughput);
+    }
+
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    unlink(unix_path);
+    unlink(shm_path);
+    return 0;
+}
@@ -0,0 +1,159 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "cream.h"
+#include "item.h"
+#include "utils.h"
+
+/*
+ * The receive buffer always has room for one complete single-key frame.
+ * It grows to fit a larger batch frame and shrinks back once that is consumed.
+ */
+#define CONN_RBUF_SIZE 16384
+#define CONN_MAX_FRAME (sizeof(request_header_t) + MAX_KEY_SIZE + MAX_VALUE_SIZE)
+/* Pipelined requests stop being executed while this much output is unsent. */
+#define CONN_WBUF_HIGH_WATER 65536
+/* Values up to this size are copied into the send buffer. Larger ones are sent straight from the item. */
+#define CONN_COPY_MAX 512
+/* The most pieces of output handed to one sendmsg(). */
+#define CONN_IOV_MAX 64
+
+/*
+ * A piece of pending output: bytes in the send buffer at offset base, or
+ * bytes of a pinned item's value starting at base.
+ */
+typedef struct conn_seg_t {
+    item_t *item;
+    size_t base, len;
+} conn_seg_t;
+
+typedef struct conn_t {
+    int fd;
+    char *rbuf;
+    char *rbuf_home;
+    size_t rstart, rend, rcap;
+    char *wbuf;
+    size_t wend, wcap;
+    conn_seg_t *segs;
+    size_t shead, stail, scap;
+    size_t wpending;
+    bool keepalive;
+    bool eof;
+    bool closing;
+} conn_t;
+
+/*
+ * Creates the per-connection state for a connected socket.
+ *
+ * @param fd The connected socket, or -1 for a transport that moves the bytes
+ *           itself with conn_reserve()/conn_received() and conn_iov()/conn_sent().
+ * @param keepalive Whether the connection serves more than one request.
+ * @param rbuf CONN_RBUF_SIZE bytes the connection borrows as its receive buffer,
+ *             or NULL to allocate its own. A borrowed buffer is never freed and
+ *             is returned to once a larger batch frame has been consumed.
+ * @return A pointer to the new conn_t instance, or NULL if out of memory.
+ */
+conn_t *create_conn(int fd, bool keepalive, char *rbuf);
+
+/*
+ * Closes the socket, if there is one, and frees the connection state.
+ *
+ * @param self The connection to destroy.
+ */
+void destroy_conn(conn_t *self);
+
+/*
+ * Makes room in the receive buffer for the next read, which goes to
+ * self->rbuf + self->rend. For callers that read without conn_fill().
+ *
+ * @param self The connection about to read.
+ * @return The number of bytes that may be read, 0 if the buffered frames have
+ *         to be processed first, or -1 if out of memory.
+ */
+ssize_t conn_reserve(conn_t *self);
+
+/*
+ * Records the outcome of a read into the space conn_reserve() made.
+ *
+ * @param self The connection that read.
+ * @param received The number of bytes read, 0 if the peer closed its end.
+ */
+void conn_received(conn_t *self, size_t received);
+
+/*
+ * Reads what the socket has available into the receive buffer with a single recv().
+ *
+ * @param self The connection to read from.
+ * @return The number of bytes read, 0 if nothing new was read, or -1 on error.
+ *         self->eof is set once the peer has closed its end.
+ */
+ssize_t conn_fill(conn_t *self);
+
+/*
+ * Checks whether the receive buffer holds at least one complete frame.
+ *
+ * @param self The connection to check.
+ * @return true if conn_process() has a request to execute.
+ */
+bool conn_has_frame(conn_t *self);
+
+/*
+ * Executes the complete requests in the receive buffer against the map and
+ * appends the responses to the send buffer, in request order. Stops early once
+ * CONN_WBUF_HIGH_WATER bytes of output are pending. Without keepalive the
+ * connection is marked as closing after its first request.
+ * A malformed frame gets an error response and also marks the connection as closing.
+ *
+ * @param self The connection to serve.
+ * @param map The map requests are executed against.
+ * @return The number of requests executed.
+ */
+int conn_process(conn_t *self, hashmap_t *map);
+
+/*
+ * Describes the pending output for a send the caller makes itself.
+ *
+ * @param self The connection with output pending.
+ * @param iov Filled with up to max pieces of output, in order.
+ * @param items If not NULL, set to the item each piece is sent from, or NULL
+ *              for pieces in the send buffer.
+ * @param max The capacity of iov and items.
+ * @return The number of pieces filled in.
+ */
+int conn_iov(conn_t *self, struct iovec *iov, item_t **items, int max);
+
+/*
+ * Records that the first sent bytes of the pending output went out. Items
+ * that were sent in full are released.
+ *
+ * @param self The connection that sent.
+ * @param sent The number of bytes sent.
+ */
+void conn_sent(conn_t *self, size_t sent);
+
+/*
+ * Sends as much of the pending output as the socket accepts.
+ *
+ * @param self The connection to flush.
+ * @return 0 once all output is sent, 1 if the socket would block, -1 on error.
+ */
+int conn_flush(conn_t *self);
+
+/*
+ * @param self The connection to check.
+ * @return true if output is still waiting to be sent.
+ */
+bool conn_pending(conn_t *self);
+
+/*
+ * @param self The connection to check.
+ * @return true if the connection has nothing left to do and can be destroyed.
+ */
+bool conn_done(conn_t *self);
+
+#endif
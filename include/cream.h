@@ -19,7 +19,27 @@ typedef struct request_header_t {
     uint32_t value_size;
 } __attribute__((packed)) request_header_t;
 
-typedef enum request_codes { PUT = 0x01, GET = 0x02, EVICT = 0x04, CLEAR = 0x08 } request_codes;
+#define MAX_MULTI_KEYS 1024
+#define MAX_MULTI_SIZE (1 << 20)
+
+typedef enum request_codes {
+    PUT = 0x01, GET = 0x02, EVICT = 0x04, CLEAR = 0x08,
+    MULTI_PUT = 0x10, MULTI_GET = 0x20, MULTI_EVICT = 0x40
+} request_codes;
+
+/*
+ * A batch request carries its number of entries in key_size and the length of
+ * its body in value_size. The body is one multi_entry_t per entry, each
+ * followed by the key bytes and, for MULTI_PUT, the value bytes.
+ *
+ * The response carries the length of its body in value_size. The body is one
+ * response_header_t per entry, in request order, each followed by the value
+ * bytes of a MULTI_GET hit.
+ */
+typedef struct multi_entry_t {
+    uint32_t key_size;
+    uint32_t value_size;
+} __attribute__((packed)) multi_entry_t;
 
 typedef struct response_header_t {
     uint32_t response_code;
@@ -0,0 +1,61 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Epoch-based reclamation. Readers that access shared memory without a lock
+ * do so between epoch_enter() and epoch_exit(). Memory unlinked by a writer
+ * is freed only once every reader that could still see it has left, which
+ * is known to be the case once the global epoch has moved on twice.
+ */
+
+/*
+ * A thread's announcement of the epoch it is reading in, on its own cache
+ * line so entering and leaving does not touch memory other readers use.
+ * Records are reused once their thread exits.
+ */
+typedef struct epoch_record_t {
+    _Alignas(64) uint64_t state;
+    uint32_t depth;
+    bool in_use;
+    struct epoch_record_t *next;
+} epoch_record_t;
+
+/*
+ * Enters a read-side critical section. Calls can nest.
+ */
+void epoch_enter(void);
+
+/*
+ * Leaves the read-side critical section entered last.
+ */
+void epoch_exit(void);
+
+/*
+ * @return The current global epoch, to tag memory with as it is unlinked.
+ */
+uint64_t epoch_now(void);
+
+/*
+ * Moves the global epoch on if every reader has entered in the current one.
+ * Never waits.
+ *
+ * @return true if the epoch moved on.
+ */
+bool epoch_try_advance(void);
+
+/*
+ * @param retired The epoch_now() at the time the memory was unlinked.
+ * @return true if no reader can still see memory unlinked in that epoch.
+ */
+bool epoch_safe(uint64_t retired);
+
+/*
+ * Waits until no reader can still see memory unlinked before the call. Must
+ * not be called inside a read-side critical section.
+ */
+void epoch_synchronize(void);
+
+#endif
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "const.h"
+#include "sketch.h"
 
 typedef struct map_key_t {
     void *key_base;
@@ -25,23 +26,112 @@ typedef struct map_val_t {
 
 typedef uint32_t (*hash_func_f)(map_key_t);
 typedef void (*destructor_f)(map_key_t, map_val_t);
+typedef void (*pin_f)(map_val_t);
+typedef size_t (*cost_f)(map_key_t, map_val_t);
 
+/* The most segments a sharded map can be split into. */
+#define MAP_MAX_SHARDS 256
+/* A growable map doubles its buckets once it holds this many percent as many entries. */
+#define MAP_MAX_LOAD 80
+/* The most entries a map can hold, and the most buckets it can have. */
+#define MAP_MAX_CAPACITY (1u << 31)
+/*
+ * With EC_LRU, get() leaves an entry where it is in the recency list while it
+ * is among the newest 1 / MAP_LRU_FRESH of the map's entries.
+ */
+#define MAP_LRU_FRESH 4
+
+/*
+ * The segments of a map's entries, each a recency list. Built with EC_LRU
+ * alone, every entry is in the window. Built with EC_TINYLFU, new entries go
+ * into the window, which holds MAP_WINDOW_PERCENT of them, and move on
+ * probation once they are admitted past it. An entry used again while on
+ * probation is protected, and the protected segment holds at most
+ * MAP_PROTECTED_PERCENT of the entries outside the window.
+ */
+#define MAP_WINDOW 0
+#define MAP_PROBATION 1
+#define MAP_PROTECTED 2
+#define MAP_SEGMENTS 3
+#define MAP_WINDOW_PERCENT 1
+#define MAP_PROTECTED_PERCENT 80
+
+/*
+ * How a full map picks the entry a forced put() evicts. This map evicts as
+ * it was built to, as put() describes, and set_eviction() only accepts
+ * MAP_EVICT_HASHED, which leaves that as it is. The base map also offers
+ * MAP_EVICT_CLOCK and MAP_EVICT_SAMPLE.
+ */
+typedef enum map_evict_t {
+    MAP_EVICT_HASHED,
+    MAP_EVICT_CLOCK,
+    MAP_EVICT_SAMPLE
+} map_evict_t;
+
+/*
+ * An entry of the map. Nodes are allocated one at a time and never move, so
+ * each is linked into the chain of its bucket through next, and into the
+ * recency list of its segment, newest to oldest, through newer and older.
+ * stamp is the map's clock when the node last went to the newest end of a
+ * list, so the clock's distance from it bounds how far from that end the
+ * node is. tombstone is always false.
+ */
 typedef struct map_node_t {
     map_key_t key;
     map_val_t val;
     bool tombstone;
+    uint8_t segment;
+    uint32_t hash;
+    uint64_t stamp;
+    struct map_node_t *next;
+    struct map_node_t *newer;
+    struct map_node_t *older;
 } map_node_t;
 
+/*
+ * The entries of a segment, from the most to the least recently used.
+ */
+typedef struct map_list_t {
+    map_node_t *newest;
+    map_node_t *oldest;
+    uint32_t size;
+} map_list_t;
+
+/*
+ * capacity is the number of buckets, always a power of two, so the bucket a
+ * hash picks is its low bits. max_capacity is the number of entries the map
+ * was asked to hold: the map is full once size reaches it.
+ *
+ * bytes is the memory the map takes: its buckets, and each entry's node and
+ * the cost of its key and value. If max_bytes is not 0, put() evicts to keep
+ * bytes within it.
+ *
+ * Readers share lock and writers take it alone. Built with EC_LRU, the map
+ * evicts the entry at the oldest end of its recency list, and readers move
+ * what they find to the newest end under lru_lock, which writers never need
+ * since they keep readers out. Built with EC_TINYLFU, sketch counts how
+ * often each key is used, and readers count what they find in it without
+ * any lock.
+ */
 typedef struct hashmap_t {
     uint32_t capacity;
     uint32_t size;
-    map_node_t *nodes;
+    map_node_t **buckets;
+    uint32_t max_capacity;
+    uint64_t bytes;
+    uint64_t max_bytes;
+    cost_f cost_function;
     hash_func_f hash_function;
     destructor_f destroy_function;
-    int num_readers;
-    pthread_mutex_t write_lock;
-    pthread_mutex_t fields_lock;
+    pthread_rwlock_t lock;
+    pthread_mutex_t lru_lock;
+    map_list_t lists[MAP_SEGMENTS];
+    sketch_t sketch;
+    uint64_t clock;
     bool invalid;
+    struct hashmap_t *shards;
+    uint32_t num_shards;
+    uint32_t shard_shift;
 } hashmap_t;
 
 /* **DO NOT** modify the function prototypes below */
@@ -57,12 +147,89 @@ typedef struct hashmap_t {
  */
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function);
 
+/*
+ * Create a hash map split into independent segments, each with its own locks
+ * and buckets. A key lives in the segment picked by the high bits of its
+ * hash, so writers to different segments never wait for each other. Every
+ * other function works on a sharded map as on a plain one.
+ *
+ * @param capacity The number of elements the map can hold, spread evenly
+ *                 over the segments. Each segment holds at least one.
+ * @param num_shards The number of segments, rounded up to a power of two and
+ *                   capped at MAP_MAX_SHARDS, then halved while it is more
+ *                   than capacity. 1 creates a plain map.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_sharded_map(uint32_t capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function);
+
+/*
+ * Create a hash map, sharded or not, that starts small and grows as it fills.
+ * Once it holds MAP_MAX_LOAD percent as many entries as it has buckets, the
+ * put() that filled it doubles the buckets and relinks every entry into them.
+ * Entries never move, so this touches no key or value. Once max_capacity is
+ * reached the map stops growing, fills up and evicts on a forced put() like a
+ * fixed map.
+ *
+ * @param capacity The number of elements the map can hold to begin with.
+ * @param max_capacity The most elements the map grows to hold, or 0 for
+ *                     MAP_MAX_CAPACITY.
+ * @param num_shards The number of segments, as for create_sharded_map() but
+ *                   capped by max_capacity. Each grows on its own, up to its
+ *                   share of max_capacity. The shares add up to max_capacity.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_growable_map(uint32_t capacity, uint32_t max_capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function);
+
+/*
+ * Limits the memory a map takes: its buckets, the node of each entry, and the
+ * keys and values of its entries, counted by cost_function. A put() that
+ * would go over the limit evicts entries as a forced put() into a full map
+ * does, or fails if force is false. An entry that would not fit in the map
+ * even if it were empty is refused. A growable map stops growing once
+ * more buckets would not fit. Must be called before anything is put
+ * into the map.
+ *
+ * @param self The hash map to use
+ * @param max_bytes The most bytes the map may take, or 0 for no limit. A
+ *                  sharded map gives each segment an even share.
+ * @param cost_function Returns the bytes an entry's key and value take, or
+ *                      NULL to count key_len + val_len.
+ * @return true if the limit was set. false if the map has entries, or its
+ *         buckets alone take more than max_bytes.
+ */
+bool set_max_memory(hashmap_t *self, uint64_t max_bytes, cost_f cost_function);
+
+/*
+ * Sets how a full map picks the entry to evict.
+ *
+ * @param self The hash map to use
+ * @param eviction The map_evict_t to use.
+ * @return true if it was set. false if the map is invalid or does not
+ *         evict that way.
+ */
+bool set_eviction(hashmap_t *self, map_evict_t eviction);
+
 /*
  * Insert a new key/value pair into the map.
  * If the key already exists, the corresponding value is overwritten.
  * If the map is full and force is false, nothing is inserted.
- * If the map is full and force is true, the entry at the index computed by
- * get_index() is overwritten.
+ * If the map is full and force is true, an entry is evicted to make room.
+ * Built with EC_LRU, that is the least recently used entry. Built with
+ * EC_TINYLFU, the entry is W-TinyLFU's: once the window is at its share,
+ * its least recently used entry is admitted on probation only if the sketch
+ * estimates it to be used more often than the least recently used entry on
+ * probation, which is then evicted in its place. Otherwise it is evicted
+ * itself. A scan of keys used once never gets past the window. Built with
+ * neither, it is the first entry in the bucket the key's hash picks, or in
+ * the first bucket after it that is not empty. A map with a
+ * memory limit counts as full while the new entry would not fit in it, and
+ * evicts as many entries as it takes.
  *
  * @param self The hash map to use
  * @param key The key to insert
@@ -73,7 +240,14 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 
 /*
- * Retrieve the value associated with a key.
+ * Retrieve the value associated with a key under the read lock, which
+ * readers share and which stops admitting them while a writer waits. Built
+ * with EC_LRU, the entry found becomes the most recently used, unless it is
+ * among the newest 1 / MAP_LRU_FRESH of the entries already, or another
+ * reader holds lru_lock. Hot entries then cost readers no shared write.
+ * Built with EC_TINYLFU, the key is also counted in the sketch, which is not
+ * written once the key's counters are at their top, and an entry found on
+ * probation is protected whenever lru_lock is free.
  *
  * @param self The hash map to use
  * @param key The key to search for
@@ -83,7 +257,20 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 map_val_t get(hashmap_t *self, map_key_t key);
 
 /*
- * Remove the entry associated with a key.
+ * Retrieve the value associated with a key and call pin on it before the
+ * map is unlocked, so the caller can keep the value alive after a concurrent
+ * put() or delete() has destroyed the map's copy.
+ *
+ * @param self The hash map to use
+ * @param key The key to search for
+ * @param pin Called with the value if the key is found.
+ * @return The same value get() would return.
+ */
+map_val_t get_pinned(hashmap_t *self, map_key_t key, pin_f pin);
+
+/*
+ * Remove the entry associated with a key. No reader can still be looking at
+ * the entry once this returns, so the caller may free it.
  *
  * @param self The hash map to use
  * @param key The key to remove.
@@ -91,6 +278,83 @@ map_val_t get(hashmap_t *self, map_key_t key);
  */
 map_node_t delete(hashmap_t *self, map_key_t key);
 
+/*
+ * Remove the entry associated with a key and destroy it with the map's
+ * destroy_function, once no reader can still be looking at it. Unlike
+ * delete(), never waits for readers, so the caller does not own the entry.
+ *
+ * @param self The hash map to use
+ * @param key The key to remove. The map does not keep it.
+ * @return true if the key was found.
+ */
+bool discard(hashmap_t *self, map_key_t key);
+
+/*
+ * Insert several key/value pairs while taking the write lock once for the
+ * whole batch, or once per segment it touches in a sharded map. Each pair is
+ * inserted as if by put() with the same force flag.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to insert
+ * @param vals The values to insert, one per key
+ * @param count The number of pairs
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @param results If not NULL, set to the outcome of each insertion, which is
+ *                false for every pair if the map or the arguments are invalid.
+ * @return The number of pairs inserted.
+ */
+size_t put_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, bool force, bool *results);
+
+/*
+ * Retrieve the values associated with several keys while taking the read
+ * lock once for the whole batch, or once per segment it touches.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to search for
+ * @param vals Set to the value of each key, as get() would return it, which
+ *             is not found for every key if the map or keys is invalid.
+ * @param count The number of keys
+ * @return The number of keys found.
+ */
+size_t get_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count);
+
+/*
+ * get_multi() that calls pin on every value found, as get_pinned() does.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to search for
+ * @param vals Set to the value of each key, as get() would return it
+ * @param count The number of keys
+ * @param pin Called with each value found.
+ * @return The number of keys found.
+ */
+size_t get_multi_pinned(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, pin_f pin);
+
+/*
+ * Remove the entries associated with several keys while taking the write
+ * lock once for the whole batch, or once per segment it touches. Like
+ * delete(), the removed entries can be freed once this returns.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to remove
+ * @param nodes If not NULL, set to the node delete() would return for each
+ *              key, which is empty for every key if the map or keys is invalid.
+ * @param count The number of keys
+ * @return The number of entries removed.
+ */
+size_t delete_multi(hashmap_t *self, map_key_t *keys, map_node_t *nodes, size_t count);
+
+/*
+ * discard() for several keys, taking the write lock once for the whole
+ * batch, or once per segment it touches.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to remove
+ * @param count The number of keys
+ * @return The number of entries removed.
+ */
+size_t discard_multi(hashmap_t *self, map_key_t *keys, size_t count);
+
 /*
  * Clears and destroys all entries in the map.
  *
@@ -0,0 +1,43 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/*
+ * Hash functions for the map besides jenkins_one_at_a_time_hash(), which
+ * takes a byte per step and is slow for long keys. All of them can be passed
+ * to create_map() as its hash_function.
+ */
+
+/*
+ * A hash in the style of wyhash. It reads 8 bytes at a time and mixes them
+ * with 64x64->128 bit multiplies, and is good for keys of any length.
+ */
+uint32_t wy_hash(map_key_t map_key);
+
+/*
+ * FxHash: rotate, xor a word, multiply. Fewest instructions per word, but
+ * weaker mixing than wy_hash(). Best suited to short keys.
+ */
+uint32_t fx_hash(map_key_t map_key);
+
+/*
+ * A hash function and the name it is selected by.
+ */
+typedef struct hash_entry_t {
+    const char *name;
+    hash_func_f function;
+} hash_entry_t;
+
+/* Every hash function, jenkins_one_at_a_time_hash() first, ended by an entry with a NULL name. */
+extern const hash_entry_t hash_functions[];
+
+/*
+ * @param name "jenkins", "wy" or "fx".
+ * @return The hash function of that name, or NULL if there is none.
+ */
+hash_func_f find_hash(const char *name);
+
+#endif
@@ -24,23 +24,149 @@ typedef struct map_val_t {
 
 typedef uint32_t (*hash_func_f)(map_key_t);
 typedef void (*destructor_f)(map_key_t, map_val_t);
+typedef void (*pin_f)(map_val_t);
+typedef size_t (*cost_f)(map_key_t, map_val_t);
 
+/* The most segments a sharded map can be split into. */
+#define MAP_MAX_SHARDS 256
+
+/* Readers count themselves in one of this many slots, each on its own cache line. */
+#define MAP_READER_SLOTS 16
+
+typedef struct map_reader_slot_t {
+    _Alignas(64) int count;
+} map_reader_slot_t;
+
+/* Retired entries kept before writers start handing them to destroy_function, a few per write. */
+#define MAP_RETIRE_BATCH 64
+/* Lock-free lookups attempted while writers keep getting in the way, before get() takes the read lock. */
+#define MAP_OPTIMISTIC_TRIES 4
+/* A growable map doubles its probe array once it is this many percent full. */
+#define MAP_MAX_LOAD 80
+/* Slots of the old probe array each write moves into the new one while a growable map is resizing. */
+#define MAP_MIGRATE_SLOTS 8
+/* The most entries a map can hold, and the largest probe array it can have. */
+#define MAP_MAX_CAPACITY (1u << 31)
+
+/*
+ * A probe array of capacity nodes is followed, in the same allocation, by a
+ * control byte per node: 0 if the node is empty, otherwise 0x80 and 7 bits of
+ * the key's hash. Searches compare MAP_GROUP control bytes at a time and only
+ * look at the nodes whose byte matches. The first MAP_GROUP - 1 bytes are
+ * repeated after the last so a scan can run past the end of the array.
+ */
+#define MAP_GROUP 16
+
+/* Key bytes kept in the node itself. Longer keys are compared through their pointer past this. */
+#define MAP_INLINE_KEY 24
+
+/*
+ * A slot of the probe array, empty while key.key_base is NULL. hash is the
+ * key's hash, kept so searches compare it before the key bytes and resizing
+ * never hashes a key again. The first MAP_INLINE_KEY bytes of the key are
+ * copied into key_inline, so a search compares short keys without following
+ * key.key_base, and only reads the rest of longer ones through it. A node is
+ * one cache line, and probe arrays are allocated on a cache line boundary.
+ *
+ * An entry's distance is how far it sits past the index its hash picks.
+ * put() keeps entries in Robin Hood order, where an entry that has probed
+ * further never sits behind one that has probed less, which keeps the
+ * largest distance in the array, max_dist, short. A search stops at the
+ * first empty slot or after max_dist slots. delete() shifts the entries
+ * after a removed one back instead of leaving a tombstone, so tombstone is
+ * always false.
+ *
+ * referenced is set when get() finds the entry, unless the map evicts by
+ * MAP_EVICT_HASHED, and cleared as CLOCK or sampled eviction passes over it.
+ */
 typedef struct map_node_t {
     map_key_t key;
     map_val_t val;
     bool tombstone;
+    bool referenced;
+    uint32_t hash;
+    uint8_t key_inline[MAP_INLINE_KEY];
 } map_node_t;
 
+/*
+ * How a full map picks the entry a forced put() evicts.
+ *
+ * MAP_EVICT_HASHED: the entry at the index the new key hashes to, or the
+ * first one after it.
+ * MAP_EVICT_CLOCK: a hand sweeps the probe array, clearing the referenced
+ * bit of every entry it passes, and stops at the first entry whose bit is
+ * already clear: one not read since the hand last went by.
+ * MAP_EVICT_SAMPLE: up to MAP_EVICT_SAMPLES entries are picked at random,
+ * and the first whose referenced bit is clear is evicted. The bits of those
+ * passed over are cleared. If all of them were set, the last is evicted.
+ */
+typedef enum map_evict_t {
+    MAP_EVICT_HASHED,
+    MAP_EVICT_CLOCK,
+    MAP_EVICT_SAMPLE
+} map_evict_t;
+
+/* The most entries MAP_EVICT_SAMPLE looks at to find one to evict. */
+#define MAP_EVICT_SAMPLES 5
+
+/*
+ * An entry replaced or removed by a writer, kept until no lock-free reader
+ * can still be looking at it. A map keeps them in a ring of retired_cap, a
+ * power of two, with the oldest at retired_head.
+ */
+typedef struct map_retired_t {
+    map_key_t key;
+    map_val_t val;
+    uint64_t epoch;
+} map_retired_t;
+
+/*
+ * capacity is the number of nodes in the probe array, always a power of two,
+ * so the index a hash picks is its low bits and no probe divides.
+ * max_capacity is the number of entries the map was asked to hold: the map
+ * is full once size reaches it, whatever the size of the array. A fixed map
+ * allocates the smallest power of two that fits max_capacity entries. A
+ * growable map doubles capacity until it does.
+ *
+ * bytes is the memory the map takes: its probe arrays in full, and the cost
+ * of each entry's key and value. If max_bytes is not 0, put() evicts to keep
+ * bytes within it.
+ *
+ * eviction is the map's map_evict_t. hand is where MAP_EVICT_CLOCK resumes
+ * its sweep and rng the state MAP_EVICT_SAMPLE draws from.
+ */
 typedef struct hashmap_t {
     uint32_t capacity;
     uint32_t size;
     map_node_t *nodes;
+    map_node_t *old_nodes;
+    uint32_t old_capacity;
+    uint32_t migrated;
+    uint32_t max_capacity;
+    uint64_t bytes;
+    uint64_t max_bytes;
+    cost_f cost_function;
+    map_evict_t eviction;
+    uint32_t hand;
+    uint64_t rng;
+    uint32_t max_dist;
+    uint32_t old_max_dist;
+    map_node_t *freed_nodes;
+    uint64_t freed_epoch;
     hash_func_f hash_function;
     destructor_f destroy_function;
-    int num_readers;
+    map_reader_slot_t *readers;
+    uint32_t writer;
+    uint32_t seq;
     pthread_mutex_t write_lock;
-    pthread_mutex_t fields_lock;
+    map_retired_t *retired;
+    uint32_t retired_head;
+    uint32_t num_retired;
+    uint32_t retired_cap;
     bool invalid;
+    struct hashmap_t *shards;
+    uint32_t num_shards;
+    uint32_t shard_shift;
 } hashmap_t;
 
 /*
@@ -54,12 +180,87 @@ typedef struct hashmap_t {
  */
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function);
 
+/*
+ * Create a hash map split into independent segments, each with its own locks
+ * and probe array. A key lives in the segment picked by the high bits of its
+ * hash, so writers to different segments never wait for each other. Every
+ * other function works on a sharded map as on a plain one.
+ *
+ * @param capacity The number of elements the map can hold, spread evenly
+ *                 over the segments. Each segment holds at least one.
+ * @param num_shards The number of segments, rounded up to a power of two and
+ *                   capped at MAP_MAX_SHARDS, then halved while it is more
+ *                   than capacity. 1 creates a plain map.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_sharded_map(uint32_t capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function);
+
+/*
+ * Create a hash map, sharded or not, that starts small and grows as it fills.
+ * Growing is done a little at a time: the map allocates a probe array twice
+ * the size, and every write afterwards moves MAP_MIGRATE_SLOTS slots of the
+ * old array into it, so no single call rehashes the whole map. Lookups search
+ * both arrays until the move is done. Once max_capacity is reached the map
+ * stops growing, fills up and evicts on a forced put() like a fixed map.
+ *
+ * @param capacity The number of elements the map can hold to begin with.
+ * @param max_capacity The most elements the map grows to hold, or 0 for
+ *                     MAP_MAX_CAPACITY.
+ * @param num_shards The number of segments, as for create_sharded_map() but
+ *                   capped by max_capacity. Each grows on its own, up to its
+ *                   share of max_capacity. The shares add up to max_capacity.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_growable_map(uint32_t capacity, uint32_t max_capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function);
+
+/*
+ * Limits the memory a map takes: its probe arrays, counted in full, and the
+ * keys and values of its entries, counted by cost_function. A put() that
+ * would go over the limit evicts entries as a forced put() into a full map
+ * does, or fails if force is false. An entry that would not fit in the map
+ * even if it were empty is refused. A growable map stops growing once a
+ * larger probe array would not fit. Must be called before anything is put
+ * into the map.
+ *
+ * @param self The hash map to use
+ * @param max_bytes The most bytes the map may take, or 0 for no limit. A
+ *                  sharded map gives each segment an even share.
+ * @param cost_function Returns the bytes an entry's key and value take, or
+ *                      NULL to count key_len + val_len.
+ * @return true if the limit was set. false if the map has entries, or its
+ *         probe arrays alone take more than max_bytes.
+ */
+bool set_max_memory(hashmap_t *self, uint64_t max_bytes, cost_f cost_function);
+
+/*
+ * Sets how a full map picks the entry to evict. May be called at any time.
+ * Under MAP_EVICT_CLOCK and MAP_EVICT_SAMPLE, get() sets the referenced bit
+ * of the entry it finds, with a relaxed store and only if the bit is clear, so
+ * reads stay lock-free and a hot entry costs no write at all.
+ *
+ * @param self The hash map to use
+ * @param eviction The map_evict_t to use. A sharded map uses it in every segment.
+ * @return true if it was set. false if the map is invalid or eviction is unknown.
+ */
+bool set_eviction(hashmap_t *self, map_evict_t eviction);
+
 /*
  * Insert a new key/value pair into the map.
  * If the key already exists, the corresponding value is overwritten.
  * If the map is full and force is false, nothing is inserted.
- * If the map is full and force is true, the entry at the index computed by
- * get_index() is overwritten.
+ * If the map is full and force is true, an entry is evicted to make room,
+ * picked as the map's map_evict_t says. By default that is the entry at the
+ * index computed by get_index(), or the first one after it if that node is
+ * empty. While a growable map is resizing, the entry is taken from the old
+ * probe array, if any is left there. A map with a
+ * memory limit counts as full while the new entry would not fit in it, and
+ * evicts as many entries as it takes.
  *
  * @param self The hash map to use
  * @param key The key to insert
@@ -70,7 +271,12 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 
 /*
- * Retrieve the value associated with a key.
+ * Retrieve the value associated with a key. The map is searched without any
+ * lock, and the search repeated if a writer changed the map meanwhile. Only
+ * a reader that keeps running into writers takes the read lock, which
+ * readers share and which stops admitting them while a writer waits.
+ * Entries a writer replaces are destroyed only after every lock-free reader
+ * that could see them has finished.
  *
  * @param self The hash map to use
  * @param key The key to search for
@@ -80,7 +286,20 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 map_val_t get(hashmap_t *self, map_key_t key);
 
 /*
- * Remove the entry associated with a key.
+ * Retrieve the value associated with a key and call pin on it before the
+ * map is unlocked, so the caller can keep the value alive after a concurrent
+ * put() or delete() has destroyed the map's copy.
+ *
+ * @param self The hash map to use
+ * @param key The key to search for
+ * @param pin Called with the value if the key is found.
+ * @return The same value get() would return.
+ */
+map_val_t get_pinned(hashmap_t *self, map_key_t key, pin_f pin);
+
+/*
+ * Remove the entry associated with a key. Returns only once no lock-free
+ * reader can still be looking at the entry, so the caller may free it.
  *
  * @param self The hash map to use
  * @param key The key to remove.
@@ -88,6 +307,84 @@ map_val_t get(hashmap_t *self, map_key_t key);
  */
 map_node_t delete(hashmap_t *self, map_key_t key);
 
+/*
+ * Remove the entry associated with a key and destroy it with the map's
+ * destroy_function, once no reader can still be looking at it. Unlike
+ * delete(), never waits for readers, so the caller does not own the entry.
+ *
+ * @param self The hash map to use
+ * @param key The key to remove. The map does not keep it.
+ * @return true if the key was found.
+ */
+bool discard(hashmap_t *self, map_key_t key);
+
+/*
+ * Insert several key/value pairs while taking the write lock once for the
+ * whole batch, or once per segment it touches in a sharded map. Each pair is
+ * inserted as if by put() with the same force flag.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to insert
+ * @param vals The values to insert, one per key
+ * @param count The number of pairs
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @param results If not NULL, set to the outcome of each insertion, which is
+ *                false for every pair if the map or the arguments are invalid.
+ * @return The number of pairs inserted.
+ */
+size_t put_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, bool force, bool *results);
+
+/*
+ * Retrieve the values associated with several keys while entering and
+ * leaving the map (or each segment it touches) as a reader once for the
+ * whole batch.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to search for
+ * @param vals Set to the value of each key, as get() would return it, which
+ *             is not found for every key if the map or keys is invalid.
+ * @param count The number of keys
+ * @return The number of keys found.
+ */
+size_t get_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count);
+
+/*
+ * get_multi() that calls pin on every value found, as get_pinned() does.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to search for
+ * @param vals Set to the value of each key, as get() would return it
+ * @param count The number of keys
+ * @param pin Called with each value found.
+ * @return The number of keys found.
+ */
+size_t get_multi_pinned(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, pin_f pin);
+
+/*
+ * Remove the entries associated with several keys while taking the write
+ * lock once for the whole batch, or once per segment it touches. Like
+ * delete(), returns once the removed entries can be freed.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to remove
+ * @param nodes If not NULL, set to the node delete() would return for each
+ *              key, which is empty for every key if the map or keys is invalid.
+ * @param count The number of keys
+ * @return The number of entries removed.
+ */
+size_t delete_multi(hashmap_t *self, map_key_t *keys, map_node_t *nodes, size_t count);
+
+/*
+ * discard() for several keys, taking the write lock once for the whole
+ * batch, or once per segment it touches.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to remove
+ * @param count The number of keys
+ * @return The number of entries removed.
+ */
+size_t discard_multi(hashmap_t *self, map_key_t *keys, size_t count);
+
 /*
  * Clears and destroys all entries in the map.
  *
@@ -0,0 +1,84 @@
+#ifndef ITEM_H
+#define ITEM_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/*
+ * A stored key/value pair in a single allocation, value first and key after it,
+ * carved from the slab size class that fits both. Once in the map an item is
+ * never modified. Replacing or removing it only drops the map's reference, so
+ * a response that still holds a reference can keep sending from it.
+ */
+typedef struct item_t {
+    uint32_t refcount;
+    uint32_t key_len;
+    uint32_t val_len;
+    char data[];
+} item_t;
+
+/*
+ * Allocates an item with room for a key and a value. The caller fills both
+ * in through item_key() and item_val() before the item is shared.
+ *
+ * @param key_len The length of the key in bytes.
+ * @param val_len The length of the value in bytes.
+ * @return A pointer to the new item_t instance holding one reference, or NULL
+ *         if out of memory.
+ */
+item_t *create_item(uint32_t key_len, uint32_t val_len);
+
+/*
+ * @param self The item.
+ * @return The item's key, in the form the map stores it.
+ */
+map_key_t item_key(item_t *self);
+
+/*
+ * @param self The item.
+ * @return The item's value, in the form the map stores it.
+ */
+map_val_t item_val(item_t *self);
+
+/*
+ * Finds the item a value stored by the map belongs to.
+ *
+ * @param val A value returned by item_val().
+ * @return The item, or NULL if val is the map's empty value.
+ */
+item_t *item_of(map_val_t val);
+
+/*
+ * Takes another reference to an item.
+ *
+ * @param self The item.
+ */
+void item_retain(item_t *self);
+
+/*
+ * Drops a reference to an item and gives its memory back to its slab class
+ * once the last one is gone.
+ *
+ * @param self The item. NULL is ignored.
+ */
+void item_release(item_t *self);
+
+/*
+ * destructor_f for a map of items. Drops the map's reference.
+ */
+void item_destroy(map_key_t key, map_val_t val);
+
+/*
+ * pin_f for a map of items. Takes a reference for the caller of get_pinned().
+ */
+void item_pin(map_val_t val);
+
+/*
+ * cost_f for a map of items.
+ *
+ * @return The bytes of the slab chunk the item of a key and value takes.
+ */
+size_t item_cost(map_key_t key, map_val_t val);
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef LIBCREAM_H
+#define LIBCREAM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "cream.h"
+
+/* The default number of connections a client keeps open to the server. */
+#define CREAM_POOL_SIZE 8
+/* Submitted requests are sent once this many bytes of them are buffered, or when a response is awaited. */
+#define CREAM_FLUSH_BYTES 65536
+#define CREAM_RBUF_SIZE 16384
+
+/*
+ * The outcome of one entry of a batch request. value points into the body of
+ * the cream_result_t it belongs to.
+ */
+typedef struct cream_entry_t {
+    uint32_t code;
+    uint32_t value_size;
+    const char *value;
+} cream_entry_t;
+
+/*
+ * A response. value is only set for a GET hit, entries only for a batch
+ * request that was executed. Release it with cream_result_free().
+ */
+typedef struct cream_result_t {
+    uint32_t code;
+    uint32_t value_size;
+    char *value;
+    size_t count;
+    cream_entry_t *entries;
+    char *body;
+} cream_result_t;
+
+/*
+ * A persistent connection. The request codes of submitted requests are kept
+ * in order so each response is parsed according to the request it answers.
+ */
+typedef struct cream_conn_t {
+    int fd;
+    char *rbuf;
+    size_t rstart, rend, rcap;
+    char *wbuf;
+    size_t wstart, wend, wcap;
+    uint8_t *pending;
+    size_t phead, ptail, pcap;
+    size_t served;
+    bool broken;
+} cream_conn_t;
+
+/*
+ * A pool of connections to one server, shared by any number of threads.
+ * Connections are opened as they are first needed and reused afterwards.
+ */
+typedef struct cream_t {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int pool_size;
+    int open;
+    cream_conn_t **idle;
+    int nidle;
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+} cream_t;
+
+/*
+ * Creates a client for a server listening on TCP. No connection is opened yet.
+ *
+ * @param host The server's host name or address, or NULL for the local host.
+ * @param port The server's port.
+ * @param pool_size The most connections open at once. Threads that need one
+ *                  while all are in use wait for one to be released.
+ * @return A pointer to the new cream_t instance, or NULL if the address can
+ *         not be resolved or out of memory.
+ */
+cream_t *create_cream(const char *host, const char *port, int pool_size);
+
+/*
+ * Creates a client for a server listening on an AF_UNIX socket (cream -s).
+ *
+ * @param path The socket's path.
+ * @param pool_size The most connections open at once.
+ * @return A pointer to the new cream_t instance, or NULL on failure.
+ */
+cream_t *create_cream_unix(const char *path, int pool_size);
+
+/*
+ * Closes every idle connection and frees the client. Connections still
+ * checked out must have been released first.
+ *
+ * @param self The client to destroy.
+ */
+void destroy_cream(cream_t *self);
+
+/*
+ * Checks out a connection for pipelining requests on it. Waits while
+ * pool_size connections are checked out.
+ *
+ * @param self The client.
+ * @return A connection for the calling thread to use exclusively, or NULL
+ *         if a new connection could not be opened.
+ */
+cream_conn_t *cream_acquire(cream_t *self);
+
+/*
+ * Returns a connection to the pool. A connection that broke, or that still
+ * has requests in flight, is closed instead of being reused.
+ *
+ * @param self The client.
+ * @param conn The connection from cream_acquire().
+ */
+void cream_release(cream_t *self, cream_conn_t *conn);
+
+/*
+ * Queues a request on a connection without waiting for its response. Queued
+ * requests are sent in batches, and every response is collected, in
+ * submission order, with cream_next(). Having more than one request in
+ * flight needs a server run with -k.
+ *
+ * @return true if the request was queued, false if it is malformed or the
+ *         connection broke.
+ */
+bool cream_submit_put(cream_conn_t *conn, const void *key, uint32_t key_size, const void *value, uint32_t value_size);
+bool cream_submit_get(cream_conn_t *conn, const void *key, uint32_t key_size);
+bool cream_submit_evict(cream_conn_t *conn, const void *key, uint32_t key_size);
+bool cream_submit_clear(cream_conn_t *conn);
+
+/*
+ * Queues a MULTI_GET of up to MAX_MULTI_KEYS keys that fit in a MAX_MULTI_SIZE body.
+ *
+ * @param keys The keys to look up.
+ * @param key_sizes The size of each key.
+ * @param count The number of keys.
+ */
+bool cream_submit_get_multi(cream_conn_t *conn, const void *const *keys, const uint32_t *key_sizes, size_t count);
+
+/*
+ * Sends whatever is queued and waits for the response to the oldest request
+ * still in flight. Responses arriving in pieces are reassembled.
+ *
+ * @param conn The connection.
+ * @param result Filled in with the response.
+ * @return 0 on success, or -1 if nothing is in flight or the connection
+ *         broke, in which case it should be released.
+ */
+int cream_next(cream_conn_t *conn, cream_result_t *result);
+
+/*
+ * @param conn The connection.
+ * @return The number of submitted requests whose responses have not been collected.
+ */
+size_t cream_in_flight(cream_conn_t *conn);
+
+/*
+ * Frees what a response holds.
+ *
+ * @param result The response.
+ */
+void cream_result_free(cream_result_t *result);
+
+/*
+ * Convenience calls that check out a connection for a single round trip. A
+ * pooled connection the server has since closed is replaced transparently.
+ *
+ * @return The response code, or -1 if the server could not be reached.
+ */
+int cream_put(cream_t *self, const void *key, uint32_t key_size, const void *value, uint32_t value_size);
+int cream_evict(cream_t *self, const void *key, uint32_t key_size);
+int cream_clear(cream_t *self);
+
+/*
+ * Looks up one key.
+ *
+ * @param result Filled in with the response. On a hit, result->value holds the value.
+ * @return The response code, or -1 if the server could not be reached.
+ */
+int cream_get(cream_t *self, const void *key, uint32_t key_size, cream_result_t *result);
+
+/*
+ * Looks up any number of keys. They are split into as few MULTI_GET requests
+ * as the protocol limits allow, which are pipelined on one connection. More
+ * than one of them needs a server run with -k.
+ *
+ * @param keys The keys to look up.
+ * @param key_sizes The size of each key.
+ * @param count The number of keys.
+ * @param result Filled in with one entry per key, in order.
+ * @return The response code, or -1 if the server could not be reached.
+ */
+int cream_get_multi(cream_t *self, const void *const *keys, const uint32_t *key_sizes, size_t count, cream_result_t *result);
+
+#endif
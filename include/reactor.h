@@ -0,0 +1,65 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "conn.h"
+#include "queue.h"
+#include "utils.h"
+
+#define REACTOR_MAX_EVENTS 256
+#define REACTOR_MAX_LISTENERS 4
+
+typedef struct reactor_t {
+    int epfd;
+    int listenfds[REACTOR_MAX_LISTENERS];
+    int nlisteners;
+    hashmap_t *map;
+    queue_t *queue;
+    bool keepalive;
+} reactor_t;
+
+/*
+ * Creates an edge-triggered epoll event loop that accepts connections on
+ * listenfd and reads requests from them without blocking.
+ *
+ * @param listenfd The listening socket. It is switched to non-blocking mode.
+ * @param map The map requests are executed against.
+ * @param queue The queue parsed requests are handed to the worker pool through,
+ *              or NULL to execute them inline on the event loop thread.
+ * @param keepalive Whether connections stay open for further requests.
+ * @return A pointer to the new reactor_t instance, or NULL on failure.
+ */
+reactor_t *create_reactor(int listenfd, hashmap_t *map, queue_t *queue, bool keepalive);
+
+/*
+ * Accepts connections on another listening socket as well. Several reactors
+ * may share one; each new connection wakes only one of them.
+ *
+ * @param self The reactor.
+ * @param listenfd The listening socket. It is switched to non-blocking mode.
+ * @return true if the socket was added, false on failure or if the reactor
+ *         already has REACTOR_MAX_LISTENERS of them.
+ */
+bool reactor_listen(reactor_t *self, int listenfd);
+
+/*
+ * Runs the event loop on the calling thread. Only returns if epoll fails.
+ *
+ * @param self The reactor to run.
+ */
+void reactor_run(reactor_t *self);
+
+/*
+ * Thread routine that runs the reactor_t passed as vargp.
+ */
+void *reactor_thread(void *vargp);
+
+/*
+ * Worker thread routine for a reactor with a queue. Dequeues connections that
+ * have complete requests buffered, executes them and hands the connection
+ * back to the event loop.
+ *
+ * @param vargp The reactor_t the worker serves.
+ */
+void *reactor_worker(void *vargp);
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "conn.h"
+#include "utils.h"
+
+#define SHM_MAGIC 0x6d657263
+#define SHM_VERSION 1
+#define SHM_CHANNELS 16
+/* Bytes in each direction of a channel. Must be a power of two. */
+#define SHM_RING_SIZE (1 << 18)
+/* Polls of an empty ring before a side sleeps on its futex. Nothing spins on
+ * a single CPU, where the other side can not run in the meantime. */
+#define SHM_SPIN 4096
+
+/* A channel is FREE until a client claims it, OPEN while in use, SHUTDOWN
+ * once the server stopped serving it and CLOSING once the client let go. */
+#define SHM_FREE 0
+#define SHM_OPEN 1
+#define SHM_SHUTDOWN 2
+#define SHM_CLOSING 3
+
+/*
+ * A single-producer single-consumer byte stream. head and tail only grow and
+ * are reduced modulo SHM_RING_SIZE to index data. They sit on separate cache
+ * lines so the two sides do not invalidate each other's.
+ */
+typedef struct shm_ring_t {
+    _Alignas(64) uint64_t head;
+    _Alignas(64) uint64_t tail;
+    _Alignas(64) char data[SHM_RING_SIZE];
+} shm_ring_t;
+
+/*
+ * One client's connection: requests flow through one ring, responses through
+ * the other, framed exactly as on a socket.
+ */
+typedef struct shm_channel_t {
+    _Alignas(64) uint32_t state;
+    uint32_t owner;
+    uint32_t client_wake;
+    uint32_t client_waiting;
+    shm_ring_t requests;
+    shm_ring_t responses;
+} shm_channel_t;
+
+/*
+ * The layout of the shared file. magic is written last, so a client that sees
+ * it sees the rest initialized.
+ */
+typedef struct shm_region_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nchannels;
+    uint32_t ring_size;
+    uint32_t server_pid;
+    _Alignas(64) uint32_t server_wake;
+    uint32_t server_waiting;
+    shm_channel_t channels[];
+} shm_region_t;
+
+typedef struct shm_t {
+    shm_region_t *region;
+    size_t size;
+    hashmap_t *map;
+    conn_t **conns;
+    int spin;
+} shm_t;
+
+typedef struct shm_client_t {
+    shm_region_t *region;
+    size_t size;
+    shm_channel_t *channel;
+    int spin;
+} shm_client_t;
+
+/*
+ * Creates the shared file clients attach to, replacing any existing one.
+ * Nothing is served until shm_run() is called.
+ *
+ * @param path The file to create, usually under /dev/shm.
+ * @param channels The number of clients that can be attached at once.
+ * @param map The map requests are executed against.
+ * @return A pointer to the new shm_t instance, or NULL on failure.
+ */
+shm_t *create_shm(const char *path, int channels, hashmap_t *map);
+
+/*
+ * Serves every channel from the calling thread, executing requests inline.
+ * The thread polls while there is traffic and sleeps on a futex once every
+ * ring has been idle for SHM_SPIN polls. Clients that exit without
+ * detaching have their channel reclaimed. Never returns.
+ *
+ * @param self The shared region to serve.
+ */
+void shm_run(shm_t *self);
+
+/*
+ * Thread routine that runs the shm_t passed as vargp.
+ */
+void *shm_thread(void *vargp);
+
+/*
+ * Maps a server's shared file and claims a free channel.
+ *
+ * @param path The file the server created.
+ * @return A pointer to the new shm_client_t instance, or NULL on failure.
+ *         errno is EBUSY if every channel is taken.
+ */
+shm_client_t *shm_attach(const char *path);
+
+/*
+ * Releases the channel and unmaps the shared file. Responses not yet read are lost.
+ *
+ * @param self The client to detach.
+ */
+void shm_detach(shm_client_t *self);
+
+/*
+ * Writes request bytes, waiting for the server to make room as needed.
+ *
+ * @param self The client.
+ * @param buf The bytes to write.
+ * @param len The number of bytes to write.
+ * @return len, or -1 with errno set to ECONNRESET if the server shut the
+ *         channel down or exited.
+ */
+ssize_t shm_send(shm_client_t *self, const void *buf, size_t len);
+
+/*
+ * Waits until response bytes are available and returns where the next of
+ * them are. They can be read in place, so a value need not be copied out of
+ * the ring, and stay valid until shm_consume() releases them.
+ *
+ * @param self The client.
+ * @param bytes Set to the start of the available bytes.
+ * @return The number of contiguous bytes available, or 0 once the server
+ *         shut the channel down or exited and every response was read.
+ */
+size_t shm_peek(shm_client_t *self, const char **bytes);
+
+/*
+ * Releases response bytes returned by shm_peek() so the server can reuse their space.
+ *
+ * @param self The client.
+ * @param len The number of bytes read.
+ */
+void shm_consume(shm_client_t *self, size_t len);
+
+/*
+ * Copies up to len response bytes into buf, waiting until at least one is available.
+ *
+ * @param self The client.
+ * @param buf Where to copy the bytes to.
+ * @param len The most bytes to copy.
+ * @return The number of bytes copied, or 0 once the server shut the channel
+ *         down and every response was read.
+ */
+ssize_t shm_recv(shm_client_t *self, void *buf, size_t len);
+
+#endif
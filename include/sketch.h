@@ -0,0 +1,73 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A TinyLFU frequency sketch: a count-min sketch of SKETCH_DEPTH rows of
+ * 4 bit counters, packed 16 to a word. Each key hash counts in one counter
+ * per row and its estimate is the smallest of them, which overestimates
+ * only where other keys collide in every row. Counters stop at
+ * SKETCH_MAX_COUNT. Once as many increments as ten per key the sketch was
+ * sized for have been recorded, every counter is halved, so the sketch
+ * forgets what was hot long ago and tracks what is hot now.
+ *
+ * width is the number of counters in a row, a power of two.
+ */
+typedef struct sketch_t {
+    uint64_t *table;
+    uint32_t width;
+    uint32_t additions;
+    uint32_t sample_size;
+} sketch_t;
+
+/* The number of rows, and of counters each key has. */
+#define SKETCH_DEPTH 4
+/* The largest value a counter holds. */
+#define SKETCH_MAX_COUNT 15
+
+/*
+ * Sets up a sketch with every counter at 0.
+ *
+ * @param entries The number of keys the sketch should tell apart, about
+ *                the number a cache holds. Each row gets the smallest
+ *                power of two counters at least four times that many.
+ * @return false if out of memory.
+ */
+bool sketch_init(sketch_t *self, uint32_t entries);
+
+/*
+ * @return The bytes sketch_init() allocates for entries.
+ */
+size_t sketch_bytes(uint32_t entries);
+
+void sketch_free(sketch_t *self);
+
+/*
+ * Counts one more occurrence of a key. A counter already at
+ * SKETCH_MAX_COUNT is left as it is, so counting a key that is already hot
+ * writes nothing. May be called from several threads at once, and at the
+ * same time as sketch_estimate(), but not sketch_age().
+ *
+ * @param hash The key's hash.
+ */
+void sketch_increment(sketch_t *self, uint32_t hash);
+
+/*
+ * @param hash The key's hash.
+ * @return How many times the key was counted since it was last halved, at
+ *         most SKETCH_MAX_COUNT.
+ */
+uint32_t sketch_estimate(sketch_t *self, uint32_t hash);
+
+/*
+ * Halves every counter once sample_size increments were counted since the
+ * last time. Must not run at the same time as any other call on the sketch.
+ *
+ * @return true if the counters were halved.
+ */
+bool sketch_age(sketch_t *self);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/*
+ * A slab allocator for small objects that come and go in large numbers.
+ * Memory is taken from the system a page at a time and each page is cut into
+ * chunks of one size class. A freed chunk only ever goes back to its class,
+ * so churn between sizes cannot fragment the heap. Each thread keeps a
+ * magazine of free chunks per class and moves them to and from the class's
+ * shared free list in batches, so most calls take no lock.
+ */
+
+/* The memory taken from the system at once and cut into chunks of one class. */
+#define SLAB_PAGE_SIZE (1 << 20)
+/* The smallest chunk. */
+#define SLAB_MIN_CHUNK 64
+/* Each size class is this many percent larger than the one before. */
+#define SLAB_GROWTH_PERCENT 125
+/* The largest chunk. Larger allocations go to malloc(). */
+#define SLAB_MAX_CHUNK 8192
+/* The most chunks a thread's magazine holds for one class. */
+#define SLAB_MAGAZINE 64
+/* The most bytes of chunks a thread's magazine holds for one class. Large classes hold fewer chunks. */
+#define SLAB_MAGAZINE_BYTES (32 << 10)
+
+/*
+ * Allocates memory from the smallest size class that fits, aligned to 8 bytes.
+ *
+ * @param size The number of bytes needed.
+ * @return The memory, or NULL if out of memory.
+ */
+void *slab_alloc(size_t size);
+
+/*
+ * Gives memory from slab_alloc() back to its size class.
+ *
+ * @param ptr The memory. NULL is ignored.
+ * @param size The size it was allocated with.
+ */
+void slab_free(void *ptr, size_t size);
+
+/*
+ * @param size A size passed to slab_alloc().
+ * @return The number of bytes slab_alloc() sets aside for it.
+ */
+size_t slab_chunk_size(size_t size);
+
+/*
+ * @return The bytes of pages taken from the system so far, plus the
+ *         allocations too large for a size class that are still live.
+ */
+size_t slab_footprint(void);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+
+#include "conn.h"
+#include "utils.h"
+
+#define URING_ENTRIES 1024
+#define URING_MAX_LISTENERS 4
+/* Connections beyond this many per ring read into heap buffers instead of registered ones. */
+#define URING_SLOTS 256
+/* With zero-copy enabled, sends carrying at least this many bytes of item values use MSG_ZEROCOPY. */
+#define URING_ZEROCOPY_MIN 16384
+
+typedef struct uring_sq_t {
+    unsigned *head, *tail, *ring_mask, *ring_entries, *array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;
+    unsigned submitted;
+} uring_sq_t;
+
+typedef struct uring_cq_t {
+    unsigned *head, *tail, *ring_mask;
+    struct io_uring_cqe *cqes;
+} uring_cq_t;
+
+typedef struct uring_t {
+    int ringfd;
+    int listenfds[URING_MAX_LISTENERS];
+    int nlisteners;
+    hashmap_t *map;
+    bool keepalive;
+    bool zerocopy;
+    uring_sq_t sq;
+    uring_cq_t cq;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    char *slots;
+    int *free_slots;
+    int nfree;
+} uring_t;
+
+/*
+ * Creates an io_uring event loop that accepts connections on listenfd with
+ * multishot accept and batches every accept, read and send of a loop
+ * iteration into one io_uring_enter(). Each connection reads into one of
+ * URING_SLOTS registered buffers while any are free.
+ *
+ * @param listenfd The listening socket. Several rings may share it.
+ * @param map The map requests are executed against.
+ * @param keepalive Whether connections stay open for further requests.
+ * @param zerocopy Whether large responses are sent with MSG_ZEROCOPY. Ignored
+ *                 if the kernel does not support zero-copy sends on io_uring.
+ * @return A pointer to the new uring_t instance, or NULL if io_uring is
+ *         not available.
+ */
+uring_t *create_uring(int listenfd, hashmap_t *map, bool keepalive, bool zerocopy);
+
+/*
+ * Closes a ring that is not running and frees it, its mappings and its
+ * registered buffers. The listening sockets are left open.
+ *
+ * @param self The ring to destroy.
+ */
+void destroy_uring(uring_t *self);
+
+/*
+ * Accepts connections on another listening socket as well. Must be called
+ * before uring_run(). Several rings may share the socket.
+ *
+ * @param self The ring.
+ * @param listenfd The listening socket. It must be in blocking mode.
+ * @return true if the socket was added, false if the ring already has
+ *         URING_MAX_LISTENERS of them.
+ */
+bool uring_listen(uring_t *self, int listenfd);
+
+/*
+ * Runs the event loop on the calling thread, executing requests inline.
+ * Only returns if io_uring_enter() fails.
+ *
+ * @param self The ring to run.
+ */
+void uring_run(uring_t *self);
+
+/*
+ * Thread routine that runs the uring_t passed as vargp.
+ */
+void *uring_thread(void *vargp);
+
+#endif
@@ -0,0 +1,690 @@
+#include "libcream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* No single response can be longer than a MULTI_GET of MAX_MULTI_KEYS values. */
+#define CREAM_MAX_BODY (MAX_MULTI_KEYS * (sizeof(response_header_t) + MAX_VALUE_SIZE))
+
+static cream_t *create_client(int pool_size) {
+    cream_t *self = calloc(1, sizeof(cream_t));
+    if(self == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+    self->pool_size = pool_size > 0 ? pool_size : CREAM_POOL_SIZE;
+    self->idle = malloc(self->pool_size * sizeof(cream_conn_t *));
+    if(self->idle == NULL){
+        free(self);
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->available, NULL);
+    return self;
+}
+
+cream_t *create_cream(const char *host, const char *port, int pool_size) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs;
+    if(port == NULL || getaddrinfo(host, port, &hints, &addrs) != 0){
+        errno = EINVAL;
+        return NULL;
+    }
+    cream_t *self = create_client(pool_size);
+    if(self != NULL){
+        memcpy(&self->addr, addrs->ai_addr, addrs->ai_addrlen);
+        self->addr_len = addrs->ai_addrlen;
+    }
+    freeaddrinfo(addrs);
+    return self;
+}
+
+cream_t *create_cream_unix(const char *path, int pool_size) {
+    struct sockaddr_un *addr;
+    if(path == NULL || strlen(path) >= sizeof(addr->sun_path)){
+        errno = EINVAL;
+        return NULL;
+    }
+    cream_t *self = create_client(pool_size);
+    if(self != NULL){
+        addr = (struct sockaddr_un *) &self->addr;
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+        self->addr_len = sizeof(struct sockaddr_un);
+    }
+    return self;
+}
+
+static void close_conn(cream_conn_t *conn) {
+    close(conn->fd);
+    free(conn->rbuf);
+    free(conn->wbuf);
+    free(conn->pending);
+    free(conn);
+}
+
+static cream_conn_t *open_conn(cream_t *self) {
+    cream_conn_t *conn = calloc(1, sizeof(cream_conn_t));
+    if(conn == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+    conn->fd = socket(self->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    conn->rbuf = malloc(CREAM_RBUF_SIZE);
+    conn->rcap = CREAM_RBUF_SIZE;
+    if(conn->fd < 0 || conn->rbuf == NULL || connect(conn->fd, (struct sockaddr *) &self->addr, self->addr_len) < 0){
+        close_conn(conn);
+        return NULL;
+    }
+    if(self->addr.ss_family != AF_UNIX){
+        //REQUESTS ARE BATCHED HERE ALREADY. NAGLE WOULD ONLY HOLD BACK THE LAST PIECE OF A BATCH.
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    }
+    //SENDS AND RECEIVES ARE INTERLEAVED WITH poll(), SO NEITHER MAY BLOCK ON ITS OWN.
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) | O_NONBLOCK);
+    return conn;
+}
+
+void destroy_cream(cream_t *self) {
+    if(self == NULL){
+        return;
+    }
+    for(int i = 0; i < self->nidle; i++){
+        close_conn(self->idle[i]);
+    }
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->available);
+    free(self->idle);
+    free(self);
+}
+
+/*
+ * Checks out a connection. With fresh set an idle connection is never
+ * reused; one is closed instead if that is what makes room for a new one.
+ */
+static cream_conn_t *acquire(cream_t *self, bool fresh) {
+    pthread_mutex_lock(&self->lock);
+    while(self->nidle == 0 && self->open >= self->pool_size){
+        pthread_cond_wait(&self->available, &self->lock);
+    }
+    cream_conn_t *conn = NULL;
+    //THE MOST RECENTLY RELEASED CONNECTION IS THE LEAST LIKELY TO HAVE BEEN CLOSED BY THE SERVER.
+    if(self->nidle > 0 && (!fresh || self->open >= self->pool_size)){
+        conn = self->idle[--self->nidle];
+    }
+    else{
+        self->open++;
+    }
+    pthread_mutex_unlock(&self->lock);
+    if(conn != NULL && !fresh){
+        return conn;
+    }
+    //AN IDLE CONNECTION CLOSED HERE PASSES ITS PLACE IN THE POOL ON TO THE NEW ONE.
+    if(conn != NULL){
+        close_conn(conn);
+    }
+
+    conn = open_conn(self);
+    if(conn == NULL){
+        pthread_mutex_lock(&self->lock);
+        self->open--;
+        pthread_cond_signal(&self->available);
+        pthread_mutex_unlock(&self->lock);
+    }
+    return conn;
+}
+
+cream_conn_t *cream_acquire(cream_t *self) {
+    return acquire(self, false);
+}
+
+void cream_release(cream_t *self, cream_conn_t *conn) {
+    if(conn == NULL){
+        return;
+    }
+    //RESPONSES STILL ON THEIR WAY WOULD BE MISTAKEN FOR THE NEXT USER'S.
+    bool reusable = !conn->broken && conn->phead == conn->ptail && conn->wstart == conn->wend;
+    if(!reusable){
+        close_conn(conn);
+    }
+    pthread_mutex_lock(&self->lock);
+    if(reusable){
+        self->idle[self->nidle++] = conn;
+    }
+    else{
+        self->open--;
+    }
+    pthread_cond_signal(&self->available);
+    pthread_mutex_unlock(&self->lock);
+}
+
+size_t cream_in_flight(cream_conn_t *conn) {
+    return conn->ptail - conn->phead;
+}
+
+/*
+ * Reads what the socket has available with a single recv(), making room for
+ * at least need bytes from rstart first.
+ * Returns the number of bytes read, 0 if none were available, or -1 if the
+ * connection broke or the server closed it.
+ */
+static ssize_t fill(cream_conn_t *conn, size_t need) {
+    if(conn->rstart == conn->rend){
+        conn->rstart = conn->rend = 0;
+    }
+    else if(conn->rstart > 0 && (conn->rcap - conn->rstart < need || conn->rend == conn->rcap)){
+        memmove(conn->rbuf, conn->rbuf + conn->rstart, conn->rend - conn->rstart);
+        conn->rend -= conn->rstart;
+        conn->rstart = 0;
+    }
+    //RESPONSES TAKEN IN WHILE SENDING A LONG PIPELINE CAN FILL THE BUFFER BEFORE ANY OF THEM IS COLLECTED.
+    size_t capacity = conn->rcap;
+    while(capacity < need || capacity == conn->rend){
+        capacity *= 2;
+    }
+    if(capacity != conn->rcap){
+        char *rbuf = realloc(conn->rbuf, capacity);
+        if(rbuf == NULL){
+            return -1;
+        }
+        conn->rbuf = rbuf;
+        conn->rcap = capacity;
+    }
+
+    ssize_t received = recv(conn->fd, conn->rbuf + conn->rend, conn->rcap - conn->rend, 0);
+    if(received > 0){
+        conn->rend += received;
+        return received;
+    }
+    if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return 0;
+    }
+    if(received == 0){
+        errno = ECONNRESET;
+    }
+    return -1;
+}
+
+static bool wait_for(cream_conn_t *conn, short events, short *revents) {
+    struct pollfd pfd = {.fd = conn->fd, .events = events};
+    while(poll(&pfd, 1, -1) < 0){
+        if(errno != EINTR){
+            return false;
+        }
+    }
+    *revents = pfd.revents;
+    return true;
+}
+
+/*
+ * Sends every queued request.
+ * Returns 0 once everything is sent, or -1 if the connection broke.
+ */
+static int flush(cream_conn_t *conn) {
+    while(conn->wstart < conn->wend){
+        ssize_t sent = send(conn->fd, conn->wbuf + conn->wstart, conn->wend - conn->wstart, MSG_NOSIGNAL);
+        if(sent > 0){
+            conn->wstart += sent;
+            continue;
+        }
+        if(sent < 0 && errno == EINTR){
+            continue;
+        }
+        if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            //THE SERVER STOPS READING WHILE ITS RESPONSES BACK UP, SO THEY ARE TAKEN IN WHILE WAITING TO SEND.
+            //OTHERWISE A LONG PIPELINE WOULD LEAVE BOTH SIDES BLOCKED ON A FULL SOCKET BUFFER.
+            short revents;
+            if(!wait_for(conn, POLLIN | POLLOUT, &revents)){
+                return -1;
+            }
+            if((revents & POLLIN) && fill(conn, 0) < 0){
+                return -1;
+            }
+            if((revents & (POLLERR | POLLHUP)) && !(revents & (POLLIN | POLLOUT))){
+                return -1;
+            }
+            continue;
+        }
+        return -1;
+    }
+    conn->wstart = conn->wend = 0;
+    return 0;
+}
+
+static bool reserve_wbuf(cream_conn_t *conn, size_t len) {
+    if(conn->wstart > 0 && conn->wend + len > conn->wcap){
+        memmove(conn->wbuf, conn->wbuf + conn->wstart, conn->wend - conn->wstart);
+        conn->wend -= conn->wstart;
+        conn->wstart = 0;
+    }
+    if(conn->wend + len > conn->wcap){
+        size_t capacity = conn->wcap == 0 ? 4096 : conn->wcap;
+        while(capacity < conn->wend + len){
+            capacity *= 2;
+        }
+        char *wbuf = realloc(conn->wbuf, capacity);
+        if(wbuf == NULL){
+            return false;
+        }
+        conn->wbuf = wbuf;
+        conn->wcap = capacity;
+    }
+    return true;
+}
+
+static void append(cream_conn_t *conn, const void *buf, size_t len) {
+    if(len == 0){
+        return;
+    }
+    memcpy(conn->wbuf + conn->wend, buf, len);
+    conn->wend += len;
+}
+
+static bool push_pending(cream_conn_t *conn, uint8_t code) {
+    if(conn->ptail == conn->pcap && conn->phead > 0){
+        memmove(conn->pending, conn->pending + conn->phead, conn->ptail - conn->phead);
+        conn->ptail -= conn->phead;
+        conn->phead = 0;
+    }
+    if(conn->ptail == conn->pcap){
+        size_t capacity = conn->pcap == 0 ? 64 : conn->pcap * 2;
+        uint8_t *pending = realloc(conn->pending, capacity);
+        if(pending == NULL){
+            return false;
+        }
+        conn->pending = pending;
+        conn->pcap = capacity;
+    }
+    conn->pending[conn->ptail++] = code;
+    return true;
+}
+
+/*
+ * Queues the frame the caller just appended, sending the queue once it is large enough.
+ */
+static bool queued(cream_conn_t *conn, uint8_t code) {
+    if(!push_pending(conn, code)){
+        conn->broken = true;
+        return false;
+    }
+    if(conn->wend - conn->wstart >= CREAM_FLUSH_BYTES && flush(conn) < 0){
+        conn->broken = true;
+        return false;
+    }
+    return true;
+}
+
+static bool submit(cream_conn_t *conn, uint8_t code, const void *key, uint32_t key_size, const void *value, uint32_t value_size) {
+    if(conn->broken){
+        return false;
+    }
+    request_header_t header = {code, key_size, value_size};
+    if(!reserve_wbuf(conn, sizeof(header) + key_size + value_size)){
+        return false;
+    }
+    append(conn, &header, sizeof(header));
+    append(conn, key, key_size);
+    append(conn, value, value_size);
+    return queued(conn, code);
+}
+
+bool cream_submit_put(cream_conn_t *conn, const void *key, uint32_t key_size, const void *value, uint32_t value_size) {
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE || value_size < MIN_VALUE_SIZE || value_size > MAX_VALUE_SIZE){
+        return false;
+    }
+    return submit(conn, PUT, key, key_size, value, value_size);
+}
+
+bool cream_submit_get(cream_conn_t *conn, const void *key, uint32_t key_size) {
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE){
+        return false;
+    }
+    return submit(conn, GET, key, key_size, NULL, 0);
+}
+
+bool cream_submit_evict(cream_conn_t *conn, const void *key, uint32_t key_size) {
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE){
+        return false;
+    }
+    return submit(conn, EVICT, key, key_size, NULL, 0);
+}
+
+bool cream_submit_clear(cream_conn_t *conn) {
+    return submit(conn, CLEAR, NULL, 0, NULL, 0);
+}
+
+bool cream_submit_get_multi(cream_conn_t *conn, const void *const *keys, const uint32_t *key_sizes, size_t count) {
+    size_t body_size = count * sizeof(multi_entry_t);
+    for(size_t i = 0; i < count; i++){
+        if(key_sizes[i] < MIN_KEY_SIZE || key_sizes[i] > MAX_KEY_SIZE){
+            return false;
+        }
+        body_size += key_sizes[i];
+    }
+    if(conn->broken || count < 1 || count > MAX_MULTI_KEYS || body_size > MAX_MULTI_SIZE){
+        return false;
+    }
+    if(!reserve_wbuf(conn, sizeof(request_header_t) + body_size)){
+        return false;
+    }
+    request_header_t header = {MULTI_GET, count, body_size};
+    append(conn, &header, sizeof(header));
+    for(size_t i = 0; i < count; i++){
+        multi_entry_t entry = {key_sizes[i], 0};
+        append(conn, &entry, sizeof(entry));
+        append(conn, keys[i], key_sizes[i]);
+    }
+    return queued(conn, MULTI_GET);
+}
+
+/*
+ * Only a GET hit and an executed batch request have a body after the header.
+ */
+static size_t body_size(uint8_t code, response_header_t *header) {
+    if(header->response_code != OK){
+        return 0;
+    }
+    return code == GET || code == MULTI_PUT || code == MULTI_GET || code == MULTI_EVICT ? header->value_size : 0;
+}
+
+/*
+ * Splits a batch response body into its entries.
+ */
+static bool parse_entries(uint8_t code, cream_result_t *result) {
+    size_t count = 0;
+    for(size_t offset = 0; offset < result->value_size; count++){
+        response_header_t header;
+        if(result->value_size - offset < sizeof(header)){
+            return false;
+        }
+        memcpy(&header, result->body + offset, sizeof(header));
+        offset += sizeof(header);
+        if(code == MULTI_GET && header.response_code == OK){
+            if(result->value_size - offset < header.value_size){
+                return false;
+            }
+            offset += header.value_size;
+        }
+    }
+
+    result->entries = malloc((count > 0 ? count : 1) * sizeof(cream_entry_t));
+    if(result->entries == NULL){
+        return false;
+    }
+    result->count = count;
+    char *cursor = result->body;
+    for(size_t i = 0; i < count; i++){
+        response_header_t header;
+        memcpy(&header, cursor, sizeof(header));
+        cursor += sizeof(header);
+        result->entries[i].code = header.response_code;
+        result->entries[i].value_size = header.value_size;
+        result->entries[i].value = NULL;
+        if(code == MULTI_GET && header.response_code == OK){
+            result->entries[i].value = cursor;
+            cursor += header.value_size;
+        }
+    }
+    return true;
+}
+
+int cream_next(cream_conn_t *conn, cream_result_t *result) {
+    memset(result, 0, sizeof(cream_result_t));
+    if(conn->broken || conn->phead == conn->ptail){
+        return -1;
+    }
+    if(flush(conn) < 0){
+        conn->broken = true;
+        return -1;
+    }
+
+    //HEADER AND BODY MAY ARRIVE IN ANY NUMBER OF PIECES. KEEP READING UNTIL THE WHOLE RESPONSE IS BUFFERED.
+    uint8_t code = conn->pending[conn->phead];
+    response_header_t header;
+    size_t need = sizeof(header);
+    bool have_header = false;
+    while(conn->rend - conn->rstart < need || !have_header){
+        if(conn->rend - conn->rstart >= sizeof(header) && !have_header){
+            memcpy(&header, conn->rbuf + conn->rstart, sizeof(header));
+            size_t body = body_size(code, &header);
+            if(body > CREAM_MAX_BODY){
+                conn->broken = true;
+                return -1;
+            }
+            need += body;
+            have_header = true;
+            continue;
+        }
+        ssize_t received = fill(conn, need);
+        short revents;
+        if(received < 0 || (received == 0 && !wait_for(conn, POLLIN, &revents))){
+            conn->broken = true;
+            return -1;
+        }
+    }
+
+    result->code = header.response_code;
+    result->value_size = header.value_size;
+    size_t body = need - sizeof(header);
+    if(body > 0){
+        result->body = malloc(body);
+        if(result->body == NULL){
+            conn->broken = true;
+            return -1;
+        }
+        memcpy(result->body, conn->rbuf + conn->rstart + sizeof(header), body);
+    }
+    conn->rstart += need;
+    conn->phead++;
+    conn->served++;
+
+    if(code == GET){
+        result->value = result->body;
+    }
+    else if(body > 0 && !parse_entries(code, result)){
+        cream_result_free(result);
+        conn->broken = true;
+        return -1;
+    }
+    return 0;
+}
+
+void cream_result_free(cream_result_t *result) {
+    if(result == NULL){
+        return;
+    }
+    free(result->body);
+    free(result->entries);
+    memset(result, 0, sizeof(cream_result_t));
+}
+
+/*
+ * Runs one request on a pooled connection. A connection that has served
+ * requests before may have been closed by the server since (it does so after
+ * every request unless run with -k), so a failure on one is retried once on a
+ * new connection. Every request is idempotent, so the retry is safe.
+ */
+static int round_trip(cream_t *self, uint8_t code, const void *key, uint32_t key_size, const void *value, uint32_t value_size, cream_result_t *result) {
+    memset(result, 0, sizeof(cream_result_t));
+    for(int attempt = 0; attempt < 2; attempt++){
+        cream_conn_t *conn = acquire(self, attempt > 0);
+        if(conn == NULL){
+            return -1;
+        }
+        bool reused = conn->served > 0;
+        bool submitted = code == CLEAR ? cream_submit_clear(conn) : submit(conn, code, key, key_size, value, value_size);
+        if(submitted && cream_next(conn, result) == 0){
+            cream_release(self, conn);
+            return result->code;
+        }
+        conn->broken = true;
+        cream_release(self, conn);
+        if(!reused){
+            break;
+        }
+    }
+    return -1;
+}
+
+int cream_put(cream_t *self, const void *key, uint32_t key_size, const void *value, uint32_t value_size) {
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE || value_size < MIN_VALUE_SIZE || value_size > MAX_VALUE_SIZE){
+        return BAD_REQUEST;
+    }
+    cream_result_t result;
+    int code = round_trip(self, PUT, key, key_size, value, value_size, &result);
+    cream_result_free(&result);
+    return code;
+}
+
+int cream_get(cream_t *self, const void *key, uint32_t key_size, cream_result_t *result) {
+    memset(result, 0, sizeof(cream_result_t));
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE){
+        return result->code = BAD_REQUEST;
+    }
+    return round_trip(self, GET, key, key_size, NULL, 0, result);
+}
+
+int cream_evict(cream_t *self, const void *key, uint32_t key_size) {
+    if(key_size < MIN_KEY_SIZE || key_size > MAX_KEY_SIZE){
+        return BAD_REQUEST;
+    }
+    cream_result_t result;
+    int code = round_trip(self, EVICT, key, key_size, NULL, 0, &result);
+    cream_result_free(&result);
+    return code;
+}
+
+int cream_clear(cream_t *self) {
+    cream_result_t result;
+    int code = round_trip(self, CLEAR, NULL, 0, NULL, 0, &result);
+    cream_result_free(&result);
+    return code;
+}
+
+/*
+ * Counts how many keys from the start of keys fit into one MULTI_GET.
+ */
+static size_t chunk_size(const uint32_t *key_sizes, size_t count) {
+    size_t body = 0;
+    size_t i;
+    for(i = 0; i < count && i < MAX_MULTI_KEYS; i++){
+        if(body + sizeof(multi_entry_t) + key_sizes[i] > MAX_MULTI_SIZE){
+            break;
+        }
+        body += sizeof(multi_entry_t) + key_sizes[i];
+    }
+    return i;
+}
+
+/*
+ * Joins the responses to the chunks of one cream_get_multi() into a single result.
+ */
+static bool merge_chunks(cream_result_t *chunks, size_t nchunks, size_t count, cream_result_t *result) {
+    size_t values = 0;
+    for(size_t i = 0; i < nchunks; i++){
+        for(size_t j = 0; j < chunks[i].count; j++){
+            values += chunks[i].entries[j].value != NULL ? chunks[i].entries[j].value_size : 0;
+        }
+    }
+    result->code = OK;
+    result->count = count;
+    result->entries = malloc(count * sizeof(cream_entry_t));
+    result->body = malloc(values > 0 ? values : 1);
+    if(result->entries == NULL || result->body == NULL){
+        cream_result_free(result);
+        return false;
+    }
+    char *cursor = result->body;
+    size_t next = 0;
+    for(size_t i = 0; i < nchunks; i++){
+        for(size_t j = 0; j < chunks[i].count; j++){
+            cream_entry_t entry = chunks[i].entries[j];
+            if(entry.value != NULL){
+                memcpy(cursor, entry.value, entry.value_size);
+                entry.value = cursor;
+                cursor += entry.value_size;
+            }
+            result->entries[next++] = entry;
+        }
+    }
+    result->value_size = values;
+    return true;
+}
+
+int cream_get_multi(cream_t *self, const void *const *keys, const uint32_t *key_sizes, size_t count, cream_result_t *result) {
+    memset(result, 0, sizeof(cream_result_t));
+    if(count == 0){
+        return result->code = BAD_REQUEST;
+    }
+    for(size_t i = 0; i < count; i++){
+        if(key_sizes[i] < MIN_KEY_SIZE || key_sizes[i] > MAX_KEY_SIZE){
+            return result->code = BAD_REQUEST;
+        }
+    }
+
+    size_t nchunks = 0;
+    for(size_t done = 0; done < count; nchunks++){
+        done += chunk_size(key_sizes + done, count - done);
+    }
+    cream_result_t *chunks = calloc(nchunks, sizeof(cream_result_t));
+    if(chunks == NULL){
+        return -1;
+    }
+
+    int code = -1;
+    for(int attempt = 0; attempt < 2 && code < 0; attempt++){
+        cream_conn_t *conn = acquire(self, attempt > 0);
+        if(conn == NULL){
+            break;
+        }
+        bool reused = conn->served > 0;
+        //EVERY CHUNK IS QUEUED BEFORE THE FIRST RESPONSE IS AWAITED, SO THEY COST ONE ROUND TRIP BETWEEN THEM.
+        bool ok = true;
+        for(size_t done = 0; ok && done < count;){
+            size_t n = chunk_size(key_sizes + done, count - done);
+            ok = cream_submit_get_multi(conn, keys + done, key_sizes + done, n);
+            done += n;
+        }
+        size_t received = 0;
+        int rejected = 0;
+        while(ok && received < nchunks && cream_next(conn, &chunks[received]) == 0){
+            if(chunks[received].code != OK && rejected == 0){
+                rejected = chunks[received].code;
+            }
+            received++;
+        }
+        if(received < nchunks){
+            conn->broken = true;
+        }
+        else if(rejected != 0){
+            //A CHUNK WAS REJECTED AS A WHOLE. REPORT ITS CODE RATHER THAN A PARTIAL RESULT.
+            code = result->code = rejected;
+        }
+        else if(nchunks == 1){
+            *result = chunks[0];
+            memset(&chunks[0], 0, sizeof(cream_result_t));
+            code = OK;
+        }
+        else{
+            code = merge_chunks(chunks, nchunks, count, result) ? OK : -1;
+        }
+        cream_release(self, conn);
+        for(size_t i = 0; i < received; i++){
+            cream_result_free(&chunks[i]);
+        }
+        if(!reused){
+            break;
+        }
+    }
+    free(chunks);
+    return code;
+}
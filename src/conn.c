@@ -0,0 +1,549 @@
+#include "conn.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+_Static_assert(CONN_RBUF_SIZE >= CONN_MAX_FRAME, "receive buffer must hold the largest single-key frame");
+
+conn_t *create_conn(int fd, bool keepalive, char *rbuf) {
+    conn_t *conn = malloc(sizeof(conn_t));
+    char *home = rbuf;
+    if(rbuf == NULL){
+        rbuf = malloc(CONN_RBUF_SIZE);
+    }
+    if(conn == NULL || rbuf == NULL){
+        free(conn);
+        if(home == NULL){
+            free(rbuf);
+        }
+        errno = ENOMEM;
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->keepalive = keepalive;
+    conn->rbuf = rbuf;
+    conn->rbuf_home = home;
+    conn->rstart = conn->rend = 0;
+    conn->rcap = CONN_RBUF_SIZE;
+    conn->wbuf = NULL;
+    conn->wend = conn->wcap = 0;
+    conn->segs = NULL;
+    conn->shead = conn->stail = conn->scap = 0;
+    conn->wpending = 0;
+    conn->eof = false;
+    conn->closing = false;
+    return conn;
+}
+
+void destroy_conn(conn_t *self) {
+    if(self == NULL){
+        return;
+    }
+    if(self->fd >= 0){
+        close(self->fd);
+    }
+    if(self->rbuf != self->rbuf_home){
+        free(self->rbuf);
+    }
+    for(size_t i = self->shead; i < self->stail; i++){
+        item_release(self->segs[i].item);
+    }
+    free(self->segs);
+    free(self->wbuf);
+    free(self);
+}
+
+/*
+ * Computes the length of a whole frame from its header.
+ * Returns -1 if the header can not be valid.
+ */
+static ssize_t frame_length(request_header_t *header) {
+    size_t length = sizeof(request_header_t);
+    switch(header->request_code){
+        case PUT:
+            if(header->value_size < MIN_VALUE_SIZE || header->value_size > MAX_VALUE_SIZE){
+                return -1;
+            }
+            length += header->value_size;
+            //FALLTHROUGH
+        case GET:
+        case EVICT:
+            if(header->key_size < MIN_KEY_SIZE || header->key_size > MAX_KEY_SIZE){
+                return -1;
+            }
+            return length + header->key_size;
+        case CLEAR:
+            return length;
+        case MULTI_PUT:
+        case MULTI_GET:
+        case MULTI_EVICT:
+            if(header->key_size < 1 || header->key_size > MAX_MULTI_KEYS
+                || header->value_size < header->key_size * sizeof(multi_entry_t) || header->value_size > MAX_MULTI_SIZE){
+                return -1;
+            }
+            return length + header->value_size;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Looks at the frame at the start of the receive buffer.
+ * Returns its length if it is complete, 0 if more bytes are needed and -1 if
+ * the header can not be valid. The header is copied into header either way.
+ */
+static ssize_t next_frame(conn_t *self, request_header_t *header) {
+    size_t available = self->rend - self->rstart;
+    if(available < sizeof(request_header_t)){
+        return 0;
+    }
+    memcpy(header, self->rbuf + self->rstart, sizeof(request_header_t));
+
+    ssize_t length = frame_length(header);
+    return length > 0 && available < length ? 0 : length;
+}
+
+ssize_t conn_reserve(conn_t *self) {
+    //KEEP ROOM FOR A WHOLE FRAME AFTER THE UNPARSED BYTES. A BATCH FRAME MAY NEED MORE THAN THE DEFAULT.
+    request_header_t header;
+    size_t needed = CONN_MAX_FRAME;
+    if(next_frame(self, &header) >= 0 && self->rend - self->rstart >= sizeof(request_header_t)){
+        size_t length = frame_length(&header);
+        needed = length > needed ? length : needed;
+    }
+    if(self->rstart == self->rend){
+        self->rstart = self->rend = 0;
+        //GIVE BACK THE MEMORY A BATCH FRAME NEEDED.
+        if(self->rcap > CONN_RBUF_SIZE){
+            char *rbuf = self->rbuf_home != NULL ? self->rbuf_home : realloc(self->rbuf, CONN_RBUF_SIZE);
+            if(rbuf != NULL){
+                if(rbuf == self->rbuf_home){
+                    free(self->rbuf);
+                }
+                self->rbuf = rbuf;
+                self->rcap = CONN_RBUF_SIZE;
+            }
+        }
+    }
+    else if(self->rcap - self->rstart < needed){
+        memmove(self->rbuf, self->rbuf + self->rstart, self->rend - self->rstart);
+        self->rend -= self->rstart;
+        self->rstart = 0;
+    }
+    if(self->rcap < needed){
+        //A BORROWED BUFFER CAN NOT BE RESIZED, SO ITS CONTENTS MOVE TO THE HEAP.
+        char *rbuf = self->rbuf == self->rbuf_home ? malloc(needed) : realloc(self->rbuf, needed);
+        if(rbuf == NULL){
+            errno = ENOMEM;
+            return -1;
+        }
+        if(self->rbuf == self->rbuf_home){
+            memcpy(rbuf, self->rbuf, self->rend);
+        }
+        self->rbuf = rbuf;
+        self->rcap = needed;
+    }
+    return self->rcap - self->rend;
+}
+
+void conn_received(conn_t *self, size_t received) {
+    if(received == 0){
+        self->eof = true;
+    }
+    self->rend += received;
+}
+
+ssize_t conn_fill(conn_t *self) {
+    ssize_t room = conn_reserve(self);
+    if(room <= 0){
+        return room;
+    }
+
+    //ONE recv() PER CALL. A SHORT READ MEANS THE SOCKET IS DRAINED, A FULL ONE MEANS THE FRAMES HAVE TO BE
+    //PROCESSED BEFORE THERE IS ROOM FOR MORE. THE REACTOR RE-ARMS ITS ONESHOT EVENTS WITH EPOLL_CTL_MOD, WHICH
+    //RE-CHECKS READINESS, SO NO EDGE IS LOST BY NOT READING UNTIL EAGAIN.
+    ssize_t received;
+    do{
+        received = recv(self->fd, self->rbuf + self->rend, room, 0);
+    } while(received < 0 && errno == EINTR);
+
+    if(received >= 0){
+        conn_received(self, received);
+        return received;
+    }
+    if(errno == EAGAIN || errno == EWOULDBLOCK){
+        return 0;
+    }
+    self->eof = true;
+    return -1;
+}
+
+bool conn_has_frame(conn_t *self) {
+    request_header_t header;
+    return next_frame(self, &header) != 0;
+}
+
+static bool conn_push_seg(conn_t *self, item_t *item, size_t base, size_t len) {
+    if(self->stail == self->scap && self->shead > 0){
+        memmove(self->segs, self->segs + self->shead, (self->stail - self->shead) * sizeof(conn_seg_t));
+        self->stail -= self->shead;
+        self->shead = 0;
+    }
+    if(self->stail == self->scap){
+        size_t capacity = self->scap == 0 ? 16 : self->scap * 2;
+        conn_seg_t *segs = realloc(self->segs, capacity * sizeof(conn_seg_t));
+        if(segs == NULL){
+            return false;
+        }
+        self->segs = segs;
+        self->scap = capacity;
+    }
+    self->segs[self->stail++] = (conn_seg_t) {.item = item, .base = base, .len = len};
+    self->wpending += len;
+    return true;
+}
+
+static bool conn_write(conn_t *self, const void *buf, size_t len) {
+    if(self->wend + len > self->wcap){
+        size_t capacity = self->wcap == 0 ? 256 : self->wcap;
+        while(capacity < self->wend + len){
+            capacity *= 2;
+        }
+        char *wbuf = realloc(self->wbuf, capacity);
+        if(wbuf == NULL){
+            return false;
+        }
+        self->wbuf = wbuf;
+        self->wcap = capacity;
+    }
+    memcpy(self->wbuf + self->wend, buf, len);
+
+    //BYTES WRITTEN BACK TO BACK GO OUT AS ONE PIECE.
+    conn_seg_t *last = self->stail > self->shead ? &self->segs[self->stail - 1] : NULL;
+    if(last != NULL && last->item == NULL && last->base + last->len == self->wend){
+        last->len += len;
+        self->wpending += len;
+    }
+    else if(!conn_push_seg(self, NULL, self->wend, len)){
+        return false;
+    }
+    self->wend += len;
+    return true;
+}
+
+static bool conn_respond(conn_t *self, uint32_t response_code, const void *value, uint32_t value_size) {
+    response_header_t responseHeader;
+    responseHeader.response_code = response_code;
+    responseHeader.value_size = value_size;
+    if(!conn_write(self, &responseHeader, sizeof(responseHeader))){
+        return false;
+    }
+    return value == NULL || conn_write(self, value, value_size);
+}
+
+/*
+ * Responds with a value pinned by get_pinned(), taking over the reference.
+ */
+static bool conn_respond_item(conn_t *self, item_t *item) {
+    response_header_t responseHeader;
+    responseHeader.response_code = OK;
+    responseHeader.value_size = item->val_len;
+    if(!conn_write(self, &responseHeader, sizeof(responseHeader))){
+        item_release(item);
+        return false;
+    }
+    //A SMALL VALUE IS CHEAPER TO COPY THAN TO SEND AS A PIECE OF ITS OWN.
+    if(item->val_len <= CONN_COPY_MAX){
+        bool written = conn_write(self, item->data, item->val_len);
+        item_release(item);
+        return written;
+    }
+    if(!conn_push_seg(self, item, 0, item->val_len)){
+        item_release(item);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Copies a key and value out of the receive buffer into a new item.
+ */
+static item_t *copy_item(map_key_t key, map_val_t val) {
+    item_t *item = create_item(key.key_len, val.val_len);
+    if(item != NULL){
+        memcpy(item_key(item).key_base, key.key_base, key.key_len);
+        memcpy(item_val(item).val_base, val.val_base, val.val_len);
+    }
+    return item;
+}
+
+static void serve_put(conn_t *self, hashmap_t *map, request_header_t *header, char *body) {
+    //THE MAP KEEPS THE KEY AND VALUE, SO THEY ARE COPIED OUT OF THE RECEIVE BUFFER.
+    item_t *item = copy_item(MAP_KEY(body, header->key_size), MAP_VAL(body + header->key_size, header->value_size));
+    if(item == NULL){
+        conn_respond(self, BAD_REQUEST, NULL, 0);
+        return;
+    }
+
+    if(put(map, item_key(item), item_val(item), true)){
+        conn_respond(self, OK, NULL, header->value_size);
+    }
+    else{
+        item_release(item);
+        conn_respond(self, BAD_REQUEST, NULL, 0);
+    }
+}
+
+static void serve_get(conn_t *self, hashmap_t *map, request_header_t *header, char *body) {
+    //THE LOOKUP ONLY READS THE KEY, SO IT CAN POINT STRAIGHT INTO THE RECEIVE BUFFER. THE VALUE IS PINNED SO A
+    //CONCURRENT PUT OR EVICT CAN NOT FREE IT WHILE IT IS STILL WAITING TO BE SENT.
+    map_val_t getValue = get_pinned(map, MAP_KEY(body, header->key_size), item_pin);
+    if(getValue.val_base == NULL){
+        conn_respond(self, NOT_FOUND, NULL, 0);
+    }
+    else{
+        conn_respond_item(self, item_of(getValue));
+    }
+}
+
+static void serve_evict(conn_t *self, hashmap_t *map, request_header_t *header, char *body) {
+    //THE MAP DROPS ITS REFERENCE ONCE NO READER CAN SEE THE ITEM. THE WORKER DOES NOT WAIT FOR THAT.
+    discard(map, MAP_KEY(body, header->key_size));
+    conn_respond(self, OK, NULL, 0);
+}
+
+static void serve_clear(conn_t *self, hashmap_t *map) {
+    clear_map(map);
+    conn_respond(self, OK, NULL, 0);
+}
+
+/*
+ * Splits a batch body into its entries. The keys and values point into the body.
+ * Returns false if the entries do not add up to a valid body.
+ */
+static bool parse_entries(request_header_t *header, char *body, map_key_t *keys, map_val_t *vals) {
+    char *cursor = body;
+    char *end = body + header->value_size;
+    for(size_t i = 0; i < header->key_size; i++){
+        multi_entry_t entry;
+        if(end - cursor < sizeof(multi_entry_t)){
+            return false;
+        }
+        memcpy(&entry, cursor, sizeof(multi_entry_t));
+        cursor += sizeof(multi_entry_t);
+
+        if(entry.key_size < MIN_KEY_SIZE || entry.key_size > MAX_KEY_SIZE){
+            return false;
+        }
+        if(header->request_code == MULTI_PUT
+            ? entry.value_size < MIN_VALUE_SIZE || entry.value_size > MAX_VALUE_SIZE
+            : entry.value_size != 0){
+            return false;
+        }
+        if(end - cursor < (size_t) entry.key_size + entry.value_size){
+            return false;
+        }
+        keys[i] = MAP_KEY(cursor, entry.key_size);
+        vals[i] = MAP_VAL(cursor + entry.key_size, entry.value_size);
+        cursor += entry.key_size + entry.value_size;
+    }
+    return cursor == end;
+}
+
+static void serve_multi_put(conn_t *self, hashmap_t *map, size_t count, map_key_t *keys, map_val_t *vals, bool *results) {
+    //SAME OWNERSHIP RULES AS PUT: EVERY PAIR GETS AN ITEM OF ITS OWN. put_multi() SKIPS THE ONES THAT FAILED.
+    for(size_t i = 0; i < count; i++){
+        item_t *item = copy_item(keys[i], vals[i]);
+        keys[i] = item != NULL ? item_key(item) : MAP_KEY(NULL, 0);
+        vals[i] = item != NULL ? item_val(item) : MAP_VAL(NULL, vals[i].val_len);
+    }
+
+    //results STARTS OUT ALL false, SO A PAIR THE MAP NEVER GOT TO IS ANSWERED AS FAILED.
+    if(put_multi(map, keys, vals, count, true, results) == 0 && count > 0){
+        for(size_t i = 0; i < count; i++){
+            item_release(item_of(vals[i]));
+        }
+        conn_respond(self, BAD_REQUEST, NULL, 0);
+        return;
+    }
+
+    conn_respond(self, OK, NULL, count * sizeof(response_header_t));
+    for(size_t i = 0; i < count; i++){
+        if(results[i]){
+            conn_respond(self, OK, NULL, vals[i].val_len);
+        }
+        else{
+            item_release(item_of(vals[i]));
+            conn_respond(self, BAD_REQUEST, NULL, 0);
+        }
+    }
+}
+
+static void serve_multi_get(conn_t *self, hashmap_t *map, size_t count, map_key_t *keys, map_val_t *vals) {
+    //parse_entries() POINTED THE VALUES INTO THE BODY. A KEY THE MAP NEVER LOOKS UP MUST READ AS NOT FOUND, NOT AS AN ITEM.
+    for(size_t i = 0; i < count; i++){
+        vals[i] = MAP_VAL(NULL, 0);
+    }
+    get_multi_pinned(map, keys, vals, count, item_pin);
+
+    size_t length = count * sizeof(response_header_t);
+    for(size_t i = 0; i < count; i++){
+        length += vals[i].val_len;
+    }
+    conn_respond(self, OK, NULL, length);
+    for(size_t i = 0; i < count; i++){
+        if(vals[i].val_base == NULL){
+            conn_respond(self, NOT_FOUND, NULL, 0);
+        }
+        else{
+            conn_respond_item(self, item_of(vals[i]));
+        }
+    }
+}
+
+static void serve_multi_evict(conn_t *self, hashmap_t *map, size_t count, map_key_t *keys) {
+    discard_multi(map, keys, count);
+
+    conn_respond(self, OK, NULL, count * sizeof(response_header_t));
+    for(size_t i = 0; i < count; i++){
+        conn_respond(self, OK, NULL, 0);
+    }
+}
+
+/*
+ * Executes a batch request as one pass over the map, so the map's locks are
+ * taken once per batch instead of once per key.
+ */
+static void serve_multi(conn_t *self, hashmap_t *map, request_header_t *header, char *body) {
+    size_t count = header->key_size;
+    map_key_t *keys = malloc(count * sizeof(map_key_t));
+    map_val_t *vals = malloc(count * sizeof(map_val_t));
+    bool *results = calloc(count, sizeof(bool));
+    if(keys == NULL || vals == NULL || results == NULL || !parse_entries(header, body, keys, vals)){
+        //THE FRAME LENGTH IS KNOWN, SO THE CONNECTION STAYS USABLE.
+        conn_respond(self, BAD_REQUEST, NULL, 0);
+    }
+    else if(header->request_code == MULTI_PUT){
+        serve_multi_put(self, map, count, keys, vals, results);
+    }
+    else if(header->request_code == MULTI_GET){
+        serve_multi_get(self, map, count, keys, vals);
+    }
+    else{
+        serve_multi_evict(self, map, count, keys);
+    }
+    free(keys);
+    free(vals);
+    free(results);
+}
+
+int conn_process(conn_t *self, hashmap_t *map) {
+    int served = 0;
+    request_header_t header;
+    ssize_t length;
+
+    while(!self->closing && self->wpending < CONN_WBUF_HIGH_WATER && (length = next_frame(self, &header)) != 0){
+        debug("CODE: %d KEY SIZE: %d VAL SIZE: %d", header.request_code, header.key_size, header.value_size);
+        if(length < 0){
+            //THE FRAME LENGTH IS UNKNOWN, SO THE REST OF THE STREAM CAN NOT BE PARSED.
+            bool supported = header.request_code == PUT || header.request_code == GET
+                || header.request_code == EVICT || header.request_code == CLEAR || header.request_code == MULTI_PUT
+                || header.request_code == MULTI_GET || header.request_code == MULTI_EVICT;
+            conn_respond(self, supported ? BAD_REQUEST : UNSUPPORTED, NULL, 0);
+            self->rstart = self->rend = 0;
+            self->closing = true;
+            break;
+        }
+
+        char *body = self->rbuf + self->rstart + sizeof(request_header_t);
+        switch(header.request_code){
+            case PUT:
+                serve_put(self, map, &header, body);
+                break;
+            case GET:
+                serve_get(self, map, &header, body);
+                break;
+            case EVICT:
+                serve_evict(self, map, &header, body);
+                break;
+            case CLEAR:
+                serve_clear(self, map);
+                break;
+            default:
+                serve_multi(self, map, &header, body);
+                break;
+        }
+        self->rstart += length;
+        served++;
+        if(!self->keepalive){
+            self->closing = true;
+        }
+    }
+    return served;
+}
+
+int conn_iov(conn_t *self, struct iovec *iov, item_t **items, int max) {
+    int count = 0;
+    for(size_t i = self->shead; i < self->stail && count < max; i++, count++){
+        conn_seg_t *seg = &self->segs[i];
+        iov[count].iov_base = (seg->item != NULL ? seg->item->data : self->wbuf) + seg->base;
+        iov[count].iov_len = seg->len;
+        if(items != NULL){
+            items[count] = seg->item;
+        }
+    }
+    return count;
+}
+
+void conn_sent(conn_t *self, size_t sent) {
+    self->wpending -= sent;
+    while(sent > 0){
+        conn_seg_t *seg = &self->segs[self->shead];
+        if(sent < seg->len){
+            seg->base += sent;
+            seg->len -= sent;
+            return;
+        }
+        sent -= seg->len;
+        item_release(seg->item);
+        self->shead++;
+    }
+    if(self->shead == self->stail){
+        self->shead = self->stail = 0;
+        self->wend = 0;
+    }
+}
+
+int conn_flush(conn_t *self) {
+    struct iovec iov[CONN_IOV_MAX];
+    while(conn_pending(self)){
+        //HEADERS AND VALUES GO OUT TOGETHER, NO MATTER HOW MANY ITEMS THEY ARE SPREAD OVER.
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = conn_iov(self, iov, NULL, CONN_IOV_MAX)};
+        ssize_t sent = sendmsg(self->fd, &msg, MSG_NOSIGNAL);
+        if(sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return 1;
+            }
+            return -1;
+        }
+        conn_sent(self, sent);
+    }
+    return 0;
+}
+
+bool conn_pending(conn_t *self) {
+    return self->wpending > 0;
+}
+
+bool conn_done(conn_t *self) {
+    if(conn_pending(self)){
+        return false;
+    }
+    return self->closing || (self->eof && !conn_has_frame(self));
+}
@@ -1,26 +1,68 @@
+#include "conn.h"
 #include "cream.h"
+#include "hash.h"
+#include "item.h"
 #include "queue.h"
+#include "reactor.h"
+#include "shm.h"
+#include "uring.h"
 #include "utils.h"
 #include "debug.h"
 
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <getopt.h>
+
+/* Entries a store sized by -M starts with room for, unless -g says otherwise. */
+#define MEMORY_INITIAL_ENTRIES 1024
 
 queue_t *request_queue;
 hashmap_t *data;
+bool keepAlive = false;
+int unixfd = -1;
+
+void configure_connection(int connfd){
+    if(keepAlive){
+        //A RESPONSE IS USUALLY SMALLER THAN A SEGMENT. WITHOUT THIS, NAGLE HOLDS IT BACK WHILE AN EARLIER ONE IS
+        //UNACKED, WHICH STALLS EVERY REQUEST ON A LONG-LIVED CONNECTION.
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    }
+}
 
-void destroy_function(map_key_t key, map_val_t val) {
-    free(key.key_base);
-    free(val.val_base);
+void serve_connection(int connfd){
+    conn_t *conn = create_conn(connfd, keepAlive, NULL);
+    if(conn == NULL){
+        close(connfd);
+        return;
+    }
+    //WITH KEEP-ALIVE THE WORKER KEEPS SERVING BACK-TO-BACK (OR PIPELINED) REQUESTS IN ORDER UNTIL THE CLIENT
+    //CLOSES ITS END. OTHERWISE THE CONNECTION CARRIES EXACTLY ONE REQUEST.
+    //EACH recv() TAKES WHATEVER HAS ARRIVED, SO A FRAME SPLIT ACROSS SEGMENTS IS SIMPLY COMPLETED BY THE NEXT ONE
+    //AND MANY PIPELINED REQUESTS ARE PARSED OUT OF A SINGLE READ.
+    while(!conn_done(conn)){
+        if(!conn_has_frame(conn) && conn_fill(conn) < 0){
+            break;
+        }
+        conn_process(conn, data);
+        //THE SOCKET IS BLOCKING, SO THIS ONLY RETURNS ONCE EVERYTHING IS SENT OR THE CONNECTION BROKE.
+        if(conn_flush(conn) != 0){
+            break;
+        }
+    }
+    destroy_conn(conn);
 }
 
 void *thread(void *vargp){
@@ -33,185 +75,61 @@ void *thread(void *vargp){
 
         if(errno == EPIPE){
             close(*connfdp);
+            free(connfdp);
             continue;
         }
 
-        request_header_t requestHeader;
-        recv(*connfdp, &requestHeader, sizeof(requestHeader), 0);
-
-        if(errno == EINTR){
-            exit(1);
-        }
-
-        response_header_t responseHeader;
-
-        debug("CODE: %d\nKEY SIZE: %d\nVAL SIZE: %d\n", requestHeader.request_code, requestHeader.key_size, requestHeader.value_size);
-
-
-        // IT IS A file WHERE READING FROM connfdp WOULD OBTAIN THE REQUEST FROM THE CLIENT. WRITING TO connfdp WOULD WRITE TO THE CLIENT.
-        // FIRST PARSE THE requestHeader INTO THE BUFFER. READ IN requestHeader SIZE BYTES.
-
-        debug("Request code: %d", requestHeader.request_code);
-
-        //IF CLIENT SENDS MSG TO SERVER AND request_code IS NOT SET TO ANY OF THE ENUM CODES.
-        if(requestHeader.request_code == 0 || (requestHeader.request_code != PUT && requestHeader.request_code != GET && requestHeader.request_code != EVICT && requestHeader.request_code != CLEAR)){
-            responseHeader.response_code = UNSUPPORTED;
-            responseHeader.value_size = 0;
-            send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-        }
-
-        //WORK (MODIFYING THE DATA STRUCTURE) BY READING THE REQUEST FROM THE CONNFDP DEQUEUED FROM THE QUEUE.
-
-        if(requestHeader.request_code == PUT){
-            //NEXT, PARSE THE KEY VALUE BY recv FROM connfdp INTO THE BUFFER WITH key_size BYTES.
-            //AFTERWARDS, PARSE THE VAL VALUE BY recv FROM connfdp INTO THE BUFFER WITH value_size BYTES.
-            //NOT PARSING THE STRING USER TYPES INTO THE CLIENT (i.e: "put 0 1") SINCE THE CLIENT PARSES THE STRING INTO
-            //A SEQUENCE OF BYTES THAT IS requestHeader FOLLOWED BY keyvalue AND valvalue BEFORE SENDING IT TO THE SERVER.
-            if(requestHeader.key_size > MAX_KEY_SIZE || requestHeader.key_size < MIN_KEY_SIZE
-                || requestHeader.value_size > MAX_VALUE_SIZE || requestHeader.value_size < MIN_VALUE_SIZE){
-                // send(*connfdp, "Error Bad Request 400", 100, 0); //SEND ERROR MESSAGE RESPONSE HEADER OF BAD_REQUEST
-                //SEND ERROR MESSAGE BAD REQUEST
-                responseHeader.response_code = BAD_REQUEST;
-                responseHeader.value_size = requestHeader.value_size;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
-
-            debug("Thread puts");
-            //PUT
-            char *keyBuff = calloc(1, requestHeader.key_size);
-            char *valBuff = calloc(1, requestHeader.value_size);
-            recv(*connfdp, keyBuff, requestHeader.key_size, 0);
-
-            if(errno == EINTR){
-                exit(1);
-            }
-
-            recv(*connfdp, valBuff, requestHeader.value_size, 0);
-
-            if(errno == EINTR){
-                exit(1);
-            }
-
-            debug("READ KEY: %s\nREAD VALUE: %s\n", keyBuff, valBuff);
-
-            //DO NOT CALLOC THE STRUCTS BECAUSE THEY ARE ALREADY ALLOCATED SPACE IN MEMORY ON THE STACK. DOES NOT NEED TO BE
-            //ON THE HEAP BECAUSE IT DOES NOT NEED TO BE MODIFIED AND RETURNED BY ANOTHER FUNCTION.
-            map_key_t map_key;
-            map_key.key_base = keyBuff;
-            map_key.key_len = requestHeader.key_size;
-
-
-            map_val_t map_val;
-            map_val.val_base = valBuff;
-            map_val.val_len = requestHeader.value_size;
-
-            debug("Key value: %d", *(int *)(map_key.key_base));
-            debug("Key size: %d", (int) map_key.key_len);
-            debug("Val value: %d", *(int *)(map_val.val_base));
-            debug("Val size: %d", (int) map_val.val_len);
-            bool putResult = put(data, map_key, map_val, 1);
-
-            if(putResult == false){
-                //RESPOND TO CLIENT BAD REQUEST, AND RESPONSE HEADER VALUE SIZE TO 0
-                //SEND ERROR MESSAGE BAD REQUEST
-                responseHeader.response_code = BAD_REQUEST;
-                responseHeader.value_size = 0;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
-            else{
-                //RESPOND TO CLIENT OK WITH VALUE SIZE
-                responseHeader.response_code = OK;
-                responseHeader.value_size = requestHeader.value_size;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
+        serve_connection(*connfdp);
+        free(connfdp);
+    }
+    //RESPOND TO CLIENT
+    //RETURN
+    return NULL;
+}
 
+/*
+ * Accepts the next connection on listenfd or, if there is one, the AF_UNIX listener.
+ * Returns -1 if accept() failed.
+ */
+int accept_connection(int listenfd){
+    if(unixfd < 0){
+        return accept(listenfd, NULL, NULL);
+    }
+    struct pollfd fds[2] = {{.fd = listenfd, .events = POLLIN}, {.fd = unixfd, .events = POLLIN}};
+    while(1){
+        if(poll(fds, 2, -1) < 0){
+            continue;
         }
-        if(requestHeader.request_code == GET){
-            //PARSE THE BUFFER AND GET FROM HASHMAP
-            if(requestHeader.key_size > MAX_KEY_SIZE || requestHeader.key_size < MIN_KEY_SIZE){
-                // send(); //SEND ERROR MESSAGE RESPONSE HEADER OF BAD_REQUEST
-                responseHeader.response_code = BAD_REQUEST;
-                responseHeader.value_size = requestHeader.value_size;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
-
-            debug("Thread gets");
-            //GET
-            char *keyBuff = calloc(1, requestHeader.key_size);
-            recv(*connfdp, keyBuff, requestHeader.key_size, 0);
-
-            if(errno == EINTR){
-                exit(1);
+        for(int i = 0; i < 2; i++){
+            if(fds[i].revents & POLLIN){
+                //THE AF_UNIX LISTENER IS NON-BLOCKING. ANOTHER ACCEPTOR MAY HAVE TAKEN ITS CONNECTION ALREADY.
+                int connfd = accept(fds[i].fd, NULL, NULL);
+                if(connfd >= 0 || errno != EAGAIN){
+                    return connfd;
+                }
             }
-
-            debug("READ KEY: %s\n", keyBuff);
-
-            map_key_t map_key;
-            map_key.key_base = keyBuff;
-            map_key.key_len = requestHeader.key_size;
-
-
-            debug("Key value: %d", *(int *)(map_key.key_base));
-            debug("Key size: %d", (int) map_key.key_len);
-
-            map_val_t getValue = get(data, map_key);
-            if(getValue.val_base == NULL){
-                debug("Send response code not found.");
-                //SEND TO CLIENT RESPONSE CODE NOT FOUND
-                responseHeader.response_code = NOT_FOUND;
-                responseHeader.value_size = 0;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
-            else{
-                debug("send response code found.");
-                //SEND TO CLIENT RESPONSE CODE OK, AND THE VALUE SIZE IN BYTES OF THE CORRESPONDING VALUE FROM GET.
-                responseHeader.response_code = OK;
-                responseHeader.value_size = getValue.val_len;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-                send(*connfdp, getValue.val_base, getValue.val_len, 0);
-            }
-
         }
-        if(requestHeader.request_code == EVICT){
-            //PARSE THE BUFFER AND EVICT FROM HASHMAP
-            if(requestHeader.key_size > MAX_KEY_SIZE || requestHeader.key_size < MIN_KEY_SIZE){
-                // send(); //SEND ERROR MESSAGE RESPONSE HEADER OF BAD_REQUEST
-                responseHeader.response_code = BAD_REQUEST;
-                responseHeader.value_size = requestHeader.value_size;
-                send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-            }
-            //DELETE
-            void *keyBuff = calloc(1, requestHeader.key_size);
-            recv(*connfdp, keyBuff, requestHeader.key_size, 0);
-
-            if(errno == EINTR){
-                exit(1);
-            }
-
-            map_key_t map_key;
-            map_key.key_base = keyBuff;
-            map_key.key_len = requestHeader.key_size;
+    }
+}
 
-            delete(data, map_key);
-            responseHeader.response_code = OK;
-            responseHeader.value_size = 0;
-            send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
-        }
-        if(requestHeader.request_code == CLEAR){
-            //PARSE THE BUFFER AND CLEAR HASHMAP
-            clear_map(data);
-            responseHeader.response_code = OK;
-            responseHeader.value_size = 0;
-            send(*connfdp, &responseHeader, sizeof(responseHeader), 0);
+/*
+ * Worker routine for SO_REUSEPORT mode. The worker accepts from its own listening socket and serves each
+ * connection itself, so new connections never pass through request_queue.
+ */
+void *acceptor_thread(void *vargp){
+    int listenfd = *(int *)vargp;
+    while(1){
+        int connfd = accept_connection(listenfd);
+        if(connfd < 0){
+            continue;
         }
-        close(*connfdp);
+        configure_connection(connfd);
+        serve_connection(connfd);
     }
-    //RESPOND TO CLIENT
-    //RETURN
     return NULL;
 }
 
-int open_listenfd(char *port){
+int open_listenfd(char *port, bool reusePort){
     int listenfd, optval=1;
     struct sockaddr_in serveraddr;
 
@@ -223,6 +141,11 @@ int open_listenfd(char *port){
     if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int)) < 0)
         return -1;
 
+    /* Lets every worker bind its own listening socket to the same port. The kernel spreads
+       incoming connections across all of them */
+    if (reusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (const void *)&optval , sizeof(int)) < 0)
+        return -1;
+
     /* Listenfd will be an endpoint for all requests to port
        on any IP address for this host */
     bzero((char *) &serveraddr, sizeof(serveraddr));
@@ -238,34 +161,298 @@ int open_listenfd(char *port){
     return listenfd;
 }
 
+int open_unixfd(char *path){
+    int listenfd;
+    struct sockaddr_un serveraddr;
+
+    bzero((char *) &serveraddr, sizeof(serveraddr));
+    serveraddr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(serveraddr.sun_path))
+        return -1;
+    strcpy(serveraddr.sun_path, path);
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    /* A socket file left behind by an earlier run would make bind fail */
+    unlink(path);
+    if (bind(listenfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0)
+        return -1;
+
+    if (listen(listenfd, 1024) < 0)
+        return -1;
+    return listenfd;
+}
+
+/*
+ * Parses a number of bytes, with an optional K, M or G suffix.
+ * Returns 0 if str is not one.
+ */
+uint64_t parse_bytes(const char *str){
+    char *end;
+    uint64_t bytes = strtoull(str, &end, 10);
+    switch(*end){
+        case 'K': case 'k':
+            bytes <<= 10;
+            end++;
+            break;
+        case 'M': case 'm':
+            bytes <<= 20;
+            end++;
+            break;
+        case 'G': case 'g':
+            bytes <<= 30;
+            end++;
+            break;
+    }
+    return end == str || *end != '\0' ? 0 : bytes;
+}
+
+/*
+ * Parses the name of an eviction policy: hashed, clock or sample.
+ * Returns -1 if str is not one.
+ */
+int parse_eviction(const char *str){
+    static const char *names[] = {[MAP_EVICT_HASHED] = "hashed", [MAP_EVICT_CLOCK] = "clock", [MAP_EVICT_SAMPLE] = "sample"};
+    for(int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++){
+        if(strcmp(str, names[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
 void printhelp(){
-    printf("./cream [-h] NUM_WORKERS PORT_NUMBER MAX_ENTRIES\n-h                 Displays this help menu and returns EXIT_SUCCESS.\nNUM_WORKERS        The number of worker threads used to service requests.\nPORT_NUMBER        Port number to listen on for incoming connections.\nMAX_ENTRIES        The maximum number of entries that can be stored in `cream`'s underlying data store.");
+    printf("./cream [-h] [-e] [-E POLICY] [-g INITIAL] [-H HASH] [-i] [-k] [-m PATH] [-M BYTES] [-n SHARDS] [-r] [-s PATH] [-u] [-z] NUM_WORKERS PORT_NUMBER MAX_ENTRIES\n-h                 Displays this help menu and returns EXIT_SUCCESS.\n-e, --epoll        Serve connections from an edge-triggered epoll event loop instead of blocking worker threads.\n-E, --eviction POLICY Pick the entry a full store evicts by POLICY: hashed (the default, the entry the new key hashes to), clock (a CLOCK hand passing over entries read since it last went by) or sample (the first of 5 random entries not read since last sampled). GETs mark what they read with one store, and only once per pass.\n-g, --grow INITIAL Start the data store with room for INITIAL entries and grow it, a few slots per write, as it fills. MAX_ENTRIES caps the growth, after which entries are evicted as without -g. 0 means no cap.\n-H, --hash HASH    Hash keys with HASH: jenkins (the default), wy (wyhash-style, 8 bytes per step) or fx (FxHash, fastest for short keys).\n-i, --inline       With -e, execute requests on the event loop thread instead of the worker pool.\n-k, --keep-alive   Serve any number of (pipelined) requests per connection instead of closing it after one.\n-m, --shm PATH     Also serve clients on the same host through shared-memory rings in a file created at PATH (e.g. under /dev/shm), polled by one extra thread.\n-M, --max-memory BYTES Keep the data store within BYTES (with an optional K, M or G suffix), counting every key and value with its item header and slab rounding, and the store's probe array. A PUT that would go over evicts entries until it fits. The store starts small and grows, as with -g, while a larger probe array fits.\n-n, --shards N     Split the data store into N independently locked segments (rounded up to a power of two, at most 256, and no more than MAX_ENTRIES) so writers to different segments do not contend. Between them the segments hold at most MAX_ENTRIES entries.\n-r, --reuseport    Give every worker its own SO_REUSEPORT listening socket to accept from. With -e each worker runs its own event loop, as with -i.\n-s, --unix PATH    Also serve the protocol on an AF_UNIX stream socket at PATH, for clients on the same host.\n-u, --io-uring     Serve connections from one io_uring event loop per worker, falling back to -e if io_uring is unavailable.\n-z, --zerocopy     With -u, send large responses with MSG_ZEROCOPY where the kernel supports it.\nNUM_WORKERS        The number of worker threads used to service requests.\nPORT_NUMBER        Port number to listen on for incoming connections.\nMAX_ENTRIES        The maximum number of entries that can be stored in `cream`'s underlying data store.");
 }
 
-int main(int argc, char *argv[]) {
+static struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"epoll", no_argument, NULL, 'e'},
+    {"eviction", required_argument, NULL, 'E'},
+    {"grow", required_argument, NULL, 'g'},
+    {"hash", required_argument, NULL, 'H'},
+    {"inline", no_argument, NULL, 'i'},
+    {"keep-alive", no_argument, NULL, 'k'},
+    {"shm", required_argument, NULL, 'm'},
+    {"max-memory", required_argument, NULL, 'M'},
+    {"shards", required_argument, NULL, 'n'},
+    {"reuseport", no_argument, NULL, 'r'},
+    {"unix", required_argument, NULL, 's'},
+    {"io-uring", no_argument, NULL, 'u'},
+    {"zerocopy", no_argument, NULL, 'z'},
+    {NULL, 0, NULL, 0}
+};
 
-    if(strncmp(argv[1], "-h", 2) == 0){
-        printhelp();
-        exit(0);
+int main(int argc, char *argv[]) {
+    bool useEpoll = false;
+    bool runInline = false;
+    bool useUring = false;
+    bool reusePort = false;
+    bool zeroCopy = false;
+    char *unixPath = NULL;
+    char *shmPath = NULL;
+    int numberOfShards = 1;
+    int initialEntries = 0;
+    hash_func_f hashFunction = jenkins_one_at_a_time_hash;
+    uint64_t maxMemory = 0;
+    int eviction = MAP_EVICT_HASHED;
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "heE:g:H:ikm:M:n:rs:uz", long_options, NULL)) != -1){
+        switch(opt){
+            case 'h':
+                printhelp();
+                exit(0);
+            case 'e':
+                useEpoll = true;
+                break;
+            case 'E':
+                if((eviction = parse_eviction(optarg)) < 0){
+                    exit(1);
+                }
+                break;
+            case 'g':
+                initialEntries = atoi(optarg);
+                if(initialEntries <= 0){
+                    exit(1);
+                }
+                break;
+            case 'H':
+                if((hashFunction = find_hash(optarg)) == NULL){
+                    exit(1);
+                }
+                break;
+            case 'i':
+                runInline = true;
+                break;
+            case 'k':
+                keepAlive = true;
+                break;
+            case 'm':
+                shmPath = optarg;
+                break;
+            case 'M':
+                maxMemory = parse_bytes(optarg);
+                if(maxMemory == 0){
+                    exit(1);
+                }
+                break;
+            case 'n':
+                numberOfShards = atoi(optarg);
+                break;
+            case 'r':
+                reusePort = true;
+                break;
+            case 's':
+                unixPath = optarg;
+                break;
+            case 'u':
+                useUring = true;
+                break;
+            case 'z':
+                zeroCopy = true;
+                break;
+            default:
+                exit(1);
+        }
     }
 
-    if(argc != 4){
+    if(argc - optind != 3){
         exit(1);
     }
 
     signal(SIGPIPE, SIG_IGN);
 
-    int numberOfWorkers = atoi(argv[1]);
-    int maxEntries = atoi(argv[3]);
+    int numberOfWorkers = atoi(argv[optind]);
+    char *port = argv[optind + 1];
+    int maxEntries = atoi(argv[optind + 2]);
+    //EVERY SEGMENT MUST HOLD AN ENTRY FOR THE SEGMENTS TO HOLD MAX_ENTRIES BETWEEN THEM.
+    if(maxEntries > 0 && numberOfShards > maxEntries){
+        exit(1);
+    }
     pthread_t worker_threads[numberOfWorkers];
     request_queue = create_queue();
-    data = create_map(maxEntries, jenkins_one_at_a_time_hash, destroy_function);
+    //A STORE HELD TO A NUMBER OF BYTES HOLDS AS MANY ENTRIES AS FIT, SO IT STARTS SMALL AND GROWS INTO THEM.
+    if(maxMemory > 0 && initialEntries == 0){
+        initialEntries = maxEntries > 0 && maxEntries < MEMORY_INITIAL_ENTRIES ? maxEntries : MEMORY_INITIAL_ENTRIES;
+    }
+    if(initialEntries > 0){
+        data = create_growable_map(initialEntries, maxEntries, numberOfShards, hashFunction, item_destroy);
+    }
+    else{
+        data = numberOfShards > 1
+            ? create_sharded_map(maxEntries, numberOfShards, hashFunction, item_destroy)
+            : create_map(maxEntries, hashFunction, item_destroy);
+    }
 
     int listenfd = 0;
     int *connfdp = 0; //LINK BETWEEN SERVER AND CLIENT. WORKER THREADS RUN THIS TO MODIFY HASHMAP
 
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
+    if(data == NULL || (maxMemory > 0 && !set_max_memory(data, maxMemory, item_cost))
+        || (eviction != MAP_EVICT_HASHED && !set_eviction(data, eviction))){
+        exit(1);
+    }
+
+////////SET UP SERVER/////// SIMPLY LISTENS AND ACCEPTS
+
+    //WITHOUT SO_REUSEPORT ALL WORKERS SHARE ONE LISTENING SOCKET.
+    int numberOfListeners = reusePort && numberOfWorkers > 1 ? numberOfWorkers : 1;
+    int listenfds[numberOfListeners];
+    for(int i = 0; i < numberOfListeners; i++){
+        if((listenfds[i] = open_listenfd(port, reusePort)) < 0){
+            exit(1);
+        }
+    }
+    listenfd = listenfds[0];
+
+    //LOCAL CLIENTS SKIP THE TCP STACK. EVERY WORKER OR EVENT LOOP SHARES THE ONE AF_UNIX LISTENER.
+    if(unixPath != NULL && (unixfd = open_unixfd(unixPath)) < 0){
+        exit(1);
+    }
+
+    //SHARED-MEMORY CLIENTS ARE SERVED BY THEIR OWN POLLING THREAD NO MATTER HOW THE SOCKETS ARE SERVED.
+    if(shmPath != NULL){
+        shm_t *shm = create_shm(shmPath, SHM_CHANNELS, data);
+        pthread_t shm_thread_id;
+        if(shm == NULL || pthread_create(&shm_thread_id, NULL, shm_thread, shm) != 0){
+            exit(1);
+        }
+    }
+
+    if(useUring){
+        //EACH RING IS A SELF-CONTAINED EVENT LOOP THAT EXECUTES ITS REQUESTS INLINE. UNLESS EACH HAS ITS OWN
+        //SO_REUSEPORT SOCKET THEY SHARE THE LISTENER AND THE KERNEL HANDS EACH NEW CONNECTION TO ONE OF THEIR ACCEPTS.
+        int numberOfRings = numberOfWorkers > 0 ? numberOfWorkers : 1;
+        uring_t *rings[numberOfRings];
+        int i;
+        for(i = 0; i < numberOfRings; i++){
+            if((rings[i] = create_uring(listenfds[i % numberOfListeners], data, keepAlive, zeroCopy)) == NULL){
+                break;
+            }
+            if(unixfd >= 0){
+                uring_listen(rings[i], unixfd);
+            }
+        }
+        if(i == numberOfRings){
+            for(i = 1; i < numberOfRings; i++){
+                pthread_create(&worker_threads[i - 1], NULL, uring_thread, rings[i]);
+            }
+            uring_run(rings[0]);
+            exit(1);
+        }
+        fprintf(stderr, "io_uring is not available (%s), using epoll instead.\n", strerror(errno));
+        //THE RINGS ALREADY CREATED WOULD KEEP THEIR REGISTERED BUFFERS PINNED AGAINST RLIMIT_MEMLOCK.
+        while(i > 0){
+            destroy_uring(rings[--i]);
+        }
+        useEpoll = true;
+    }
+
+    if(useEpoll && numberOfListeners > 1){
+        //ONE INLINE EVENT LOOP PER LISTENING SOCKET. NO CONNECTION IS EVER HANDED BETWEEN THREADS.
+        for(int i = 0; i < numberOfListeners; i++){
+            reactor_t *reactor = create_reactor(listenfds[i], data, NULL, keepAlive);
+            if(reactor == NULL || (unixfd >= 0 && !reactor_listen(reactor, unixfd))){
+                exit(1);
+            }
+            if(i == numberOfListeners - 1){
+                reactor_run(reactor);
+                exit(1);
+            }
+            pthread_create(&worker_threads[i], NULL, reactor_thread, reactor);
+        }
+    }
+
+    if(useEpoll){
+        //THE EVENT LOOP OWNS ACCEPT AND ALL SOCKET READS. WORKERS ONLY SEE CONNECTIONS WITH A COMPLETE REQUEST
+        //BUFFERED, SO A SLOW CLIENT NEVER HOLDS A WORKER AND THE WORKER COUNT DOES NOT LIMIT OPEN CONNECTIONS.
+        reactor_t *reactor = create_reactor(listenfd, data, runInline ? NULL : request_queue, keepAlive);
+        if(reactor == NULL || (unixfd >= 0 && !reactor_listen(reactor, unixfd))){
+            exit(1);
+        }
+        if(!runInline){
+            for(int i = 0; i < numberOfWorkers; i++){
+                pthread_create(&worker_threads[i], NULL, reactor_worker, reactor);
+            }
+        }
+        reactor_run(reactor);
+        exit(1);
+    }
+
+    if(unixfd >= 0 && fcntl(unixfd, F_SETFL, fcntl(unixfd, F_GETFL, 0) | O_NONBLOCK) < 0){
+        exit(1);
+    }
+
+    if(numberOfListeners > 1){
+        //A WORKER ONLY ACCEPTS AGAIN ONCE ITS CURRENT CONNECTION CLOSES. CONNECTIONS THE KERNEL QUEUES ON A BUSY
+        //WORKER'S SOCKET WAIT FOR IT EVEN IF ANOTHER WORKER IS IDLE.
+        for(int i = 1; i < numberOfListeners; i++){
+            pthread_create(&worker_threads[i], NULL, acceptor_thread, &listenfds[i]);
+        }
+        acceptor_thread(&listenfds[0]);
+        exit(1);
+    }
 
 ////////SPAWN WORKER THREADS//////
     //WORKER THREAD SPAWNING. FOR INTERACTION WITH HASHMAP DATA.
@@ -276,14 +463,11 @@ int main(int argc, char *argv[]) {
         pthread_create(&worker_threads[i], NULL, thread, data);
     }
 
-////////SET UP SERVER/////// SIMPLY LISTENS AND ACCEPTS
-
-    listenfd = open_listenfd(argv[2]);
     //ACCEPT AWAITING REQUESTS ONE AT A TIME AND ENQUEUE TO THE QUEUE.
     while(1){
-        clientlen = sizeof(struct sockaddr_storage);
         connfdp = malloc(sizeof(int)); //SO THAT connfdp IS NOT SHARED ON THE STACK BETWEEN THREADS.
-        *connfdp = accept(listenfd, (struct sockaddr*)&clientaddr, &clientlen);
+        *connfdp = accept_connection(listenfd);
+        configure_connection(*connfdp);
         //ADD ACCEPTED SOCKET listenfd TO QUEUE. ENQUEUE
         debug("In main thread: Connfdp is %d", *connfdp);
         enqueue(request_queue, connfdp);
@@ -291,7 +475,6 @@ int main(int argc, char *argv[]) {
 
 }
 
-
 //EPIPE IS AN errno. CLOSE THE CONNECTION ONCE errno IS EPIPE.
 //SIGPIPE SHOULD BE SIGIGN. SHOULD BE IGNORED IN THE MAIN THREAD.
 //EINTR IS AN errno IS AN INTERRUPT DURING WRITE. DURING THE THREAD ROUTINE, IF THIS
@@ -0,0 +1,121 @@
+#include "epoch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Starts above 0 so a record's state is never 0 while it is active. */
+static uint64_t global_epoch = 1;
+static epoch_record_t *records;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+static __thread epoch_record_t *thread_record;
+
+/*
+ * Hands an exiting thread's record back for another thread to claim.
+ */
+static void release_record(void *vargp) {
+    epoch_record_t *record = vargp;
+    record->depth = 0;
+    __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&record->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void create_record_key(void) {
+    if(pthread_key_create(&record_key, release_record) != 0){
+        exit(1);
+    }
+}
+
+/*
+ * Finds the calling thread a record, reusing one left by an exited thread
+ * before adding a new one. Records are never freed, so scanners can walk the
+ * list without a lock.
+ */
+static epoch_record_t *claim_record(void) {
+    pthread_once(&record_key_once, create_record_key);
+
+    epoch_record_t *record;
+    for(record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record != NULL; record = record->next){
+        bool in_use = false;
+        if(!__atomic_load_n(&record->in_use, __ATOMIC_RELAXED)
+            && __atomic_compare_exchange_n(&record->in_use, &in_use, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            break;
+        }
+    }
+    if(record == NULL){
+        record = aligned_alloc(_Alignof(epoch_record_t), sizeof(epoch_record_t));
+        if(record == NULL){
+            errno = ENOMEM;
+            exit(1);
+        }
+        memset(record, 0, sizeof(epoch_record_t));
+        record->in_use = true;
+        record->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&records, &record->next, record, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(record_key, record);
+    return record;
+}
+
+void epoch_enter(void) {
+    epoch_record_t *record = thread_record;
+    if(record == NULL){
+        record = thread_record = claim_record();
+    }
+    if(record->depth++ > 0){
+        return;
+    }
+
+    //PUBLISH THE EPOCH, THEN CHECK IT IS STILL CURRENT. ONCE IT IS, THE EPOCH CAN NOT MOVE ON TWICE BEFORE epoch_exit().
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    while(true){
+        __atomic_store_n(&record->state, epoch << 1 | 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uint64_t now = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+        if(now == epoch){
+            return;
+        }
+        epoch = now;
+    }
+}
+
+void epoch_exit(void) {
+    epoch_record_t *record = thread_record;
+    if(--record->depth == 0){
+        __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+    }
+}
+
+uint64_t epoch_now(void) {
+    //WHATEVER WAS UNLINKED BEFORE THE CALL IS ORDERED BEFORE THE EPOCH IT IS TAGGED WITH.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+}
+
+bool epoch_try_advance(void) {
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for(epoch_record_t *record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record != NULL; record = record->next){
+        uint64_t state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+        //A READER STILL IN AN EARLIER EPOCH HOLDS THE EPOCH BACK.
+        if((state & 1) && state >> 1 != epoch){
+            return false;
+        }
+    }
+    return __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+bool epoch_safe(uint64_t retired) {
+    return __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) >= retired + 2;
+}
+
+void epoch_synchronize(void) {
+    uint64_t retired = epoch_now();
+    while(!epoch_safe(retired)){
+        if(!epoch_try_advance()){
+            sched_yield();
+        }
+    }
+}
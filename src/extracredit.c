@@ -1,25 +1,1007 @@
 #include "utils.h"
+//make BUILDS THIS FILE WITHOUT EC BUT LINKS hashmap.o IN ITS PLACE. ONLY make ec USES THE map_node_t AND hashmap_t BELOW.
+#ifdef EC
+#include "debug.h"
+#include "slab.h"
+#include <errno.h>
+#include <string.h>
+
+//W-TINYLFU KEEPS EACH OF ITS SEGMENTS IN RECENCY ORDER AS LRU DOES.
+#if defined(EC_TINYLFU) && !defined(EC_LRU)
+#define EC_LRU
+#endif
+
+/*
+ * @return The smallest power of two that is at least entries, the number of
+ *         buckets that holds them.
+ */
+static uint32_t capacity_for(uint32_t entries) {
+    uint32_t capacity = 1;
+    while(capacity < entries){
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/*
+ * @return The bytes capacity buckets take, with the sketch sized for them.
+ */
+static inline uint64_t buckets_bytes(uint32_t capacity) {
+#ifdef EC_TINYLFU
+    return (uint64_t) capacity * sizeof(map_node_t *) + sketch_bytes(capacity);
+#else
+    return (uint64_t) capacity * sizeof(map_node_t *);
+#endif
+}
+
+static map_node_t *alloc_node(void) {
+    return slab_alloc(sizeof(map_node_t));
+}
+
+static void free_node(map_node_t *node) {
+    slab_free(node, sizeof(map_node_t));
+}
+
+/*
+ * Sets up a map's buckets, enough for capacity entries, and its locks.
+ */
+static void init_map(hashmap_t *hashmap, uint32_t capacity, uint32_t max_capacity, hash_func_f hash_function, destructor_f destroy_function) {
+    hashmap->capacity = capacity_for(capacity);
+    hashmap->max_capacity = max_capacity;
+    hashmap->buckets = calloc(hashmap->capacity, sizeof(map_node_t *));
+    if(hashmap->buckets == NULL){
+        errno = ENOMEM;
+        exit(1);
+    }
+#ifdef EC_TINYLFU
+    if(!sketch_init(&hashmap->sketch, hashmap->capacity)){
+        errno = ENOMEM;
+        exit(1);
+    }
+#endif
+    hashmap->bytes = buckets_bytes(hashmap->capacity);
+    hashmap->hash_function = hash_function;
+    hashmap->destroy_function = destroy_function;
+
+    //A STEADY STREAM OF READERS MUST NOT KEEP A WRITER OUT FOREVER.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    if(pthread_rwlock_init(&hashmap->lock, &attr) != 0 || pthread_mutex_init(&hashmap->lru_lock, NULL) != 0){
+        errno = EINVAL;
+        exit(1);
+    }
+    pthread_rwlockattr_destroy(&attr);
+}
 
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
-    return NULL;
+    return create_growable_map(capacity, capacity, 1, hash_function, destroy_function);
+}
+
+hashmap_t *create_sharded_map(uint32_t capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function) {
+    return create_growable_map(capacity, capacity, num_shards, hash_function, destroy_function);
+}
+
+hashmap_t *create_growable_map(uint32_t capacity, uint32_t max_capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function) {
+    if(capacity <= 0 || num_shards == 0 || hash_function == NULL || destroy_function == NULL){
+        errno = EINVAL;
+        return NULL;
+    }
+    if(num_shards > MAP_MAX_SHARDS){
+        num_shards = MAP_MAX_SHARDS;
+    }
+    if(capacity > MAP_MAX_CAPACITY){
+        capacity = MAP_MAX_CAPACITY;
+    }
+    if(max_capacity == 0 || max_capacity > MAP_MAX_CAPACITY){
+        max_capacity = MAP_MAX_CAPACITY;
+    }
+    if(max_capacity < capacity){
+        max_capacity = capacity;
+    }
+
+    //ROUND UP TO A POWER OF TWO SO THE TOP log2(n) BITS OF A HASH NAME THE SHARD.
+    uint32_t n = 1;
+    uint32_t shift = 32;
+    while(n < num_shards){
+        n <<= 1;
+        shift--;
+    }
+    //NO MORE SHARDS THAN ENTRIES, SO EVERY SHARD CAN HOLD ONE.
+    while(n > max_capacity){
+        n >>= 1;
+        shift++;
+    }
+    hashmap_t *hashmap = calloc(1, sizeof(hashmap_t));
+    if(n == 1){
+        init_map(hashmap, capacity, max_capacity, hash_function, destroy_function);
+        return hashmap;
+    }
+
+    uint32_t per_shard = (capacity + n - 1) / n;
+    //THE PARENT HOLDS NO BUCKETS ITSELF. ITS size AND capacity ARE THE SUMS OF ITS SHARDS'.
+    init_map(hashmap, per_shard * n, max_capacity, hash_function, destroy_function);
+    free(hashmap->buckets);
+    hashmap->buckets = NULL;
+    sketch_free(&hashmap->sketch);
+    hashmap->shards = calloc(n, sizeof(hashmap_t));
+    hashmap->num_shards = n;
+    hashmap->shard_shift = shift;
+    for(uint32_t i = 0; i < n; i++){
+        //THE SHARDS' CAPS ADD UP TO max_capacity. THE FIRST max_capacity % n TAKE ONE EXTRA ENTRY EACH.
+        init_map(&hashmap->shards[i], per_shard, max_capacity / n + (i < max_capacity % n), hash_function, destroy_function);
+    }
+    hashmap->capacity = hashmap->shards[0].capacity * n;
+    hashmap->bytes = hashmap->shards[0].bytes * n;
+    return hashmap;
+}
+
+/*
+ * @return The shard key belongs in, or self if the map is not sharded.
+ */
+static hashmap_t *shard_of(hashmap_t *self, map_key_t key) {
+    if(self->shards == NULL){
+        return self;
+    }
+    //A NULL KEY IS NEVER STORED. IT GOES TO THE FIRST SHARD WITHOUT BEING HASHED.
+    if(key.key_base == NULL){
+        return &self->shards[0];
+    }
+    return &self->shards[self->hash_function(key) >> self->shard_shift];
+}
+
+/*
+ * What a shard holds and takes, before a write changes it.
+ */
+typedef struct map_usage_t {
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t bytes;
+} map_usage_t;
+
+static inline map_usage_t usage_of(hashmap_t *shard) {
+    return (map_usage_t) {.size = shard->size, .capacity = shard->capacity, .bytes = shard->bytes};
+}
+
+/*
+ * Carries the change in a shard's size, capacity and bytes since before over
+ * to its parent. Called with the shard's lock held for writing.
+ */
+static void shard_resized(hashmap_t *self, hashmap_t *shard, map_usage_t before) {
+    if(shard != self){
+        __atomic_add_fetch(&self->size, shard->size - before.size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&self->capacity, shard->capacity - before.capacity, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&self->bytes, shard->bytes - before.bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * @param count Set to the number of shards.
+ * @return The shards of self, or self alone if the map is not sharded.
+ */
+static hashmap_t *shards_of(hashmap_t *self, uint32_t *count) {
+    if(self->shards == NULL){
+        *count = 1;
+        return self;
+    }
+    *count = self->num_shards;
+    return self->shards;
+}
+
+/*
+ * The keys of a batch that belong to one shard: order[start] to order[end - 1].
+ */
+typedef struct map_run_t {
+    hashmap_t *shard;
+    size_t start;
+    size_t end;
+} map_run_t;
+
+/*
+ * Groups the keys of a batch by shard, so each shard is locked once however
+ * its keys are interleaved with others'. Keys keep their relative order
+ * within a shard.
+ *
+ * @param self The map the batch is for
+ * @param keys The keys of the batch
+ * @param count The number of keys
+ * @param order Set to the key indices grouped by shard, or to NULL when the
+ *              map is not sharded and the keys are taken in order. Must be
+ *              freed by the caller.
+ * @param runs Filled in with one run per shard that has keys, up to MAP_MAX_SHARDS.
+ * @return The number of runs. 0 with errno set to ENOMEM if there are keys
+ *         but no memory to group them.
+ */
+static size_t split_batch(hashmap_t *self, map_key_t *keys, size_t count, size_t **order, map_run_t *runs) {
+    *order = NULL;
+    if(self->shards == NULL){
+        runs[0] = (map_run_t) {.shard = self, .start = 0, .end = count};
+        return 1;
+    }
+    if(count == 0){
+        return 0;
+    }
+
+    uint8_t *which = malloc(count);
+    *order = malloc(count * sizeof(size_t));
+    if(which == NULL || *order == NULL){
+        free(which);
+        free(*order);
+        *order = NULL;
+        errno = ENOMEM;
+        return 0;
+    }
+
+    //COUNTING SORT OF THE KEY INDICES BY SHARD.
+    size_t starts[MAP_MAX_SHARDS] = {0};
+    for(size_t i = 0; i < count; i++){
+        which[i] = shard_of(self, keys[i]) - self->shards;
+        starts[which[i]]++;
+    }
+    size_t nruns = 0;
+    size_t offset = 0;
+    for(uint32_t s = 0; s < self->num_shards; s++){
+        size_t n = starts[s];
+        if(n > 0){
+            runs[nruns++] = (map_run_t) {.shard = &self->shards[s], .start = offset, .end = offset + n};
+        }
+        starts[s] = offset;
+        offset += n;
+    }
+    for(size_t i = 0; i < count; i++){
+        (*order)[starts[which[i]]++] = i;
+    }
+    free(which);
+    return nruns;
+}
+
+/*
+ * Puts a node at the newest end of the recency list of a segment. Called
+ * with the lock held for writing, or for reading and lru_lock held.
+ */
+static void list_push(hashmap_t *self, map_node_t *node, uint8_t segment) {
+    map_list_t *list = &self->lists[segment];
+    node->newer = NULL;
+    node->older = list->newest;
+    if(list->newest != NULL){
+        list->newest->newer = node;
+    }
+    else{
+        list->oldest = node;
+    }
+    list->newest = node;
+    list->size++;
+    //READERS CHECK THE STAMP AND SEGMENT WITHOUT lru_lock TO SEE IF THE NODE NEEDS MOVING.
+    __atomic_store_n(&node->segment, segment, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->stamp, __atomic_add_fetch(&self->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+/*
+ * Takes a node out of the recency list of its segment. Called as for list_push().
+ */
+static void list_remove(hashmap_t *self, map_node_t *node) {
+    map_list_t *list = &self->lists[node->segment];
+    if(node->newer != NULL){
+        node->newer->older = node->older;
+    }
+    else{
+        list->newest = node->older;
+    }
+    if(node->older != NULL){
+        node->older->newer = node->newer;
+    }
+    else{
+        list->oldest = node->newer;
+    }
+    list->size--;
+}
+
+#ifdef EC_TINYLFU
+/*
+ * @return The most entries the window holds before its oldest must be
+ *         admitted to the main segments or evicted.
+ */
+static inline uint32_t window_max(hashmap_t *self) {
+    return 1 + (uint64_t) self->size * MAP_WINDOW_PERCENT / 100;
+}
+
+/*
+ * @return The most entries the protected segment holds.
+ */
+static inline uint32_t protected_max(hashmap_t *self) {
+    return (uint64_t) (self->size - self->lists[MAP_WINDOW].size) * MAP_PROTECTED_PERCENT / 100;
+}
+#endif
+
+/*
+ * Moves a node that was used to the newest end of its segment. Under
+ * W-TinyLFU, a node used again while on probation is protected instead, and
+ * the oldest protected node goes back on probation if that takes the
+ * protected segment over its share. Called as for list_push().
+ */
+static void access_locked(hashmap_t *self, map_node_t *node) {
+    uint8_t segment = node->segment;
+    list_remove(self, node);
+#ifdef EC_TINYLFU
+    if(segment == MAP_PROBATION){
+        segment = MAP_PROTECTED;
+    }
+#endif
+    list_push(self, node, segment);
+#ifdef EC_TINYLFU
+    if(self->lists[MAP_PROTECTED].size > protected_max(self)){
+        map_node_t *demoted = self->lists[MAP_PROTECTED].oldest;
+        list_remove(self, demoted);
+        list_push(self, demoted, MAP_PROBATION);
+    }
+#endif
+}
+
+/*
+ * Records that a reader found a node. Under W-TinyLFU its key is counted in
+ * the sketch. The node is moved as access_locked() does, unless it would
+ * stay in its segment and is among the newest 1 / MAP_LRU_FRESH of the
+ * entries already, or another reader is moving one. So a read of a hot key
+ * writes nothing shared, and a read never waits for another. Called with
+ * the lock held for reading.
+ */
+static void lru_touch(hashmap_t *self, map_node_t *node) {
+#ifdef EC_LRU
+#ifdef EC_TINYLFU
+    sketch_increment(&self->sketch, node->hash);
+    bool moves = __atomic_load_n(&node->segment, __ATOMIC_RELAXED) == MAP_PROBATION;
+#else
+    bool moves = false;
+#endif
+    //EVERY NODE PUT AT THE NEWEST END OF A LIST SINCE THIS ONE WAS TAKES A STEP OF THE CLOCK, SO NO MORE THAN THAT MANY ARE NEWER.
+    uint64_t age = __atomic_load_n(&self->clock, __ATOMIC_RELAXED) - __atomic_load_n(&node->stamp, __ATOMIC_RELAXED);
+    if((!moves && age < self->size / MAP_LRU_FRESH) || pthread_mutex_trylock(&self->lru_lock) != 0){
+        return;
+    }
+    access_locked(self, node);
+    pthread_mutex_unlock(&self->lru_lock);
+#endif
+}
+
+/*
+ * @return The link to the node holding key in its bucket's chain: the bucket
+ *         itself or the next of the node before it. The link is to NULL if
+ *         the key is not in the map.
+ */
+static map_node_t **find_locked(hashmap_t *self, map_key_t key, uint32_t hash) {
+    map_node_t **link = &self->buckets[hash & (self->capacity - 1)];
+    while(*link != NULL){
+        map_node_t *node = *link;
+        if(node->hash == hash && node->key.key_len == key.key_len
+            && memcmp(node->key.key_base, key.key_base, key.key_len) == 0){
+            break;
+        }
+        link = &node->next;
+    }
+    return link;
+}
+
+/*
+ * Doubles the buckets of a map and relinks every node into them. Nodes do not
+ * move, so only the chains change. Called with the lock held for writing.
+ */
+static void grow_locked(hashmap_t *self) {
+    uint32_t capacity = self->capacity * 2;
+    map_node_t **buckets = calloc(capacity, sizeof(map_node_t *));
+    //NO MEMORY TO GROW. KEEP FILLING THE BUCKETS THERE ARE.
+    if(buckets == NULL){
+        return;
+    }
+#ifdef EC_TINYLFU
+    //A WIDER SKETCH TELLS MORE KEYS APART. IT STARTS OVER, AS THE COUNTS CAN NOT BE SPREAD OUT AGAIN.
+    sketch_t sketch;
+    if(!sketch_init(&sketch, capacity)){
+        free(buckets);
+        return;
+    }
+    sketch_free(&self->sketch);
+    self->sketch = sketch;
+#endif
+    for(uint32_t index = 0; index < self->capacity; index++){
+        map_node_t *node = self->buckets[index];
+        while(node != NULL){
+            map_node_t *next = node->next;
+            map_node_t **bucket = &buckets[node->hash & (capacity - 1)];
+            node->next = *bucket;
+            *bucket = node;
+            node = next;
+        }
+    }
+    free(self->buckets);
+    self->buckets = buckets;
+    self->bytes += buckets_bytes(capacity) - buckets_bytes(self->capacity);
+    self->capacity = capacity;
+}
+
+/*
+ * @return The bytes an entry takes, as the map counts them: its node, and its
+ *         key and value.
+ */
+static inline uint64_t entry_cost(hashmap_t *self, map_key_t key, map_val_t val) {
+    uint64_t cost = self->cost_function != NULL ? self->cost_function(key, val) : key.key_len + val.val_len;
+    return cost + slab_chunk_size(sizeof(map_node_t));
+}
+
+/*
+ * @return true if the map would go over its memory limit if it took extra more bytes.
+ */
+static inline bool over_budget(hashmap_t *self, uint64_t extra) {
+    return self->max_bytes != 0 && self->bytes + extra > self->max_bytes;
+}
+
+/*
+ * @return true if the map holds as many entries as it may.
+ */
+static inline bool full_locked(hashmap_t *self) {
+    return self->size >= self->max_capacity;
+}
+
+/*
+ * Takes the node a link points to out of the map. Does not destroy or free
+ * it. Called with the lock held for writing.
+ *
+ * @return The node.
+ */
+static map_node_t *unlink_locked(hashmap_t *self, map_node_t **link) {
+    map_node_t *node = *link;
+    *link = node->next;
+    list_remove(self, node);
+    self->bytes -= entry_cost(self, node->key, node->val);
+    self->size = (self->size) - 1;
+    return node;
+}
+
+#ifdef EC_TINYLFU
+/*
+ * Picks the entry W-TinyLFU evicts. Once the window is at its share, its
+ * oldest entry is the candidate for the main segments, and the oldest on
+ * probation, or protected if none is, the entry it would push out. The one
+ * the sketch estimates to be used less often is evicted. A candidate that
+ * wins is admitted on probation. While the window is short of its share,
+ * the main segments are evicted from, or the window once they are empty.
+ * Called with the lock held for writing.
+ */
+static map_node_t *tinylfu_victim(hashmap_t *self) {
+    map_node_t *victim = self->lists[MAP_PROBATION].oldest;
+    if(victim == NULL){
+        victim = self->lists[MAP_PROTECTED].oldest;
+    }
+    map_node_t *candidate = self->lists[MAP_WINDOW].size >= window_max(self) ? self->lists[MAP_WINDOW].oldest : NULL;
+    if(victim == NULL || candidate == NULL){
+        return victim != NULL ? victim : self->lists[MAP_WINDOW].oldest;
+    }
+    //A TIE GOES AGAINST THE CANDIDATE, SO A SCAN OF KEYS USED ONCE NEVER PUSHES OUT WHAT IS ALREADY THERE.
+    if(sketch_estimate(&self->sketch, candidate->hash) > sketch_estimate(&self->sketch, victim->hash)){
+        list_remove(self, candidate);
+        list_push(self, candidate, MAP_PROBATION);
+        return victim;
+    }
+    return candidate;
+}
+#endif
+
+/*
+ * Evicts an entry to make room for one with the given hash. Built with
+ * EC_TINYLFU, that is the entry tinylfu_victim() picks. Built with EC_LRU,
+ * it is the least recently used entry. Otherwise it is the first entry of
+ * the bucket the hash picks, or of the first bucket after it that is not
+ * empty. The map must not be empty. Called with the lock held for writing.
+ */
+static void evict_locked(hashmap_t *self, uint32_t hash) {
+#ifdef EC_LRU
+#ifdef EC_TINYLFU
+    map_node_t *victim = tinylfu_victim(self);
+#else
+    map_node_t *victim = self->lists[MAP_WINDOW].oldest;
+#endif
+    map_node_t **link = &self->buckets[victim->hash & (self->capacity - 1)];
+    while(*link != victim){
+        link = &(*link)->next;
+    }
+#else
+    uint32_t index = hash & (self->capacity - 1);
+    while(self->buckets[index] == NULL){
+        index = (index + 1) & (self->capacity - 1);
+    }
+    map_node_t **link = &self->buckets[index];
+#endif
+    map_node_t *node = unlink_locked(self, link);
+    //NO READER IS IN THE MAP WHILE THE LOCK IS HELD FOR WRITING. THE ENTRY CAN BE DESTROYED AT ONCE.
+    self->destroy_function(node->key, node->val);
+    free_node(node);
+}
+
+/*
+ * put() with the lock held for writing.
+ */
+static bool put_locked(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    uint64_t cost = entry_cost(self, key, val);
+    //IF MAP IS FULL AND FORCE IS FALSE
+    if((full_locked(self) || over_budget(self, cost)) && force == 0){
+        errno = ENOMEM;
+        return false;
+    }
+    //AN ENTRY TOO BIG FOR THE MAP EVEN ONCE EVERYTHING ELSE IS EVICTED IS TURNED AWAY BEFORE ANYTHING IS.
+    if(self->max_bytes != 0 && cost > self->max_bytes - buckets_bytes(self->capacity)){
+        errno = ENOMEM;
+        return false;
+    }
+
+    uint32_t hash = self->hash_function(key);
+#ifdef EC_TINYLFU
+    //NO READER IS COUNTING WHILE THE LOCK IS HELD FOR WRITING, SO THE SKETCH CAN BE AGED.
+    sketch_age(&self->sketch);
+    sketch_increment(&self->sketch, hash);
+#endif
+    //FIRST FIND IF THERE IS A NODE WITH THE SAME KEY. IF THERE IS ONE, REPLACE THAT NODE'S VALUE.
+    map_node_t **link = find_locked(self, key, hash);
+    map_node_t *node = *link;
+    if(node != NULL){
+        uint64_t old_cost = entry_cost(self, node->key, node->val);
+        if(!over_budget(self, cost - old_cost)){
+            debug("There exists a same key. Destroy the node and replace key and value.");
+            self->destroy_function(node->key, node->val);
+            node->key = key;
+            node->val = val;
+            self->bytes += cost - old_cost;
+            access_locked(self, node);
+            return true;
+        }
+        //THE NEW VALUE DOES NOT FIT IN PLACE OF THE OLD ONE. TAKE THE OLD ONE OUT AND MAKE ROOM AS FOR A NEW KEY.
+        unlink_locked(self, link);
+        self->destroy_function(node->key, node->val);
+        free_node(node);
+    }
+
+    //IF THE MAP IS FULL, OR THE ENTRY DOES NOT FIT IN ITS MEMORY, AND FORCE IS TRUE, EVICT TO MAKE ROOM.
+    while(full_locked(self) || over_budget(self, cost)){
+        debug("There is no same key in the full hashmap. Evict an entry");
+        evict_locked(self, hash);
+    }
+    node = alloc_node();
+    if(node == NULL){
+        errno = ENOMEM;
+        return false;
+    }
+    map_node_t **bucket = &self->buckets[hash & (self->capacity - 1)];
+    *node = (map_node_t) {.key = key, .val = val, .tombstone = false, .hash = hash, .next = *bucket};
+    *bucket = node;
+    list_push(self, node, MAP_WINDOW);
+    self->size = (self->size) + 1;
+    self->bytes += cost;
+#ifdef EC_TINYLFU
+    //WHILE THE MAP IS NOT FULL, WHAT THE WINDOW HAS NO ROOM FOR GOES ON PROBATION WITHOUT HAVING TO WIN ITS PLACE.
+    while(self->lists[MAP_WINDOW].size > window_max(self)){
+        map_node_t *admitted = self->lists[MAP_WINDOW].oldest;
+        list_remove(self, admitted);
+        list_push(self, admitted, MAP_PROBATION);
+    }
+#endif
+
+    if(self->capacity < self->max_capacity
+        && (uint64_t) self->size * 100 >= (uint64_t) self->capacity * MAP_MAX_LOAD
+        && !over_budget(self, buckets_bytes(self->capacity * 2) - buckets_bytes(self->capacity))){
+        grow_locked(self);
+    }
+    return true;
+}
+
+bool set_max_memory(hashmap_t *self, uint64_t max_bytes, cost_f cost_function) {
+    if(self == NULL || self->invalid){
+        errno = EINVAL;
+        return false;
+    }
+
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    for(uint32_t i = 0; i < count; i++){
+        pthread_rwlock_wrlock(&shards[i].lock);
+    }
+    //ENTRIES ALREADY IN THE MAP WERE NOT COUNTED BY cost_function.
+    bool result = self->size == 0;
+    for(uint32_t i = 0; i < count && max_bytes != 0; i++){
+        result &= shards[i].bytes <= max_bytes / count;
+    }
+    if(result){
+        for(uint32_t i = 0; i < count; i++){
+            shards[i].max_bytes = max_bytes / count;
+            shards[i].cost_function = cost_function;
+        }
+        self->max_bytes = max_bytes;
+        self->cost_function = cost_function;
+    }
+    for(uint32_t i = count; i > 0; i--){
+        pthread_rwlock_unlock(&shards[i - 1].lock);
+    }
+    if(!result){
+        errno = EINVAL;
+    }
+    return result;
+}
+
+bool set_eviction(hashmap_t *self, map_evict_t eviction) {
+    //THIS MAP EVICTS AS IT WAS BUILT TO. ITS NODES HAVE NO REFERENCE BITS FOR CLOCK OR SAMPLING.
+    if(self == NULL || self->invalid || eviction != MAP_EVICT_HASHED){
+        errno = EINVAL;
+        return false;
+    }
+    return true;
 }
 
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
-    return false;
+    //IF ANY PARAMETERS INVALID
+    if(self == NULL || self->invalid || key.key_base == NULL || val.val_base == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    debug("Put function force value: %d", force);
+
+    hashmap_t *shard = shard_of(self, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    //invalidate_map() MAY HAVE FREED THE BUCKETS SINCE invalid WAS CHECKED.
+    if(shard->invalid){
+        pthread_rwlock_unlock(&shard->lock);
+        errno = EINVAL;
+        return false;
+    }
+    map_usage_t before = usage_of(shard);
+    bool result = put_locked(shard, key, val, force);
+    shard_resized(self, shard, before);
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+/*
+ * get_pinned() with the lock held for reading.
+ */
+static map_val_t get_locked(hashmap_t *self, map_key_t key, pin_f pin) {
+    map_node_t *node = *find_locked(self, key, self->hash_function(key));
+    if(node == NULL){
+        debug("KEY VALUE PAIR NOT FOUND.");
+        return MAP_VAL(NULL, 0);
+    }
+    debug("KEY VALUE PAIR FOUND.");
+    //WRITERS ARE SHUT OUT UNTIL THE LOCK IS RELEASED, SO THE VALUE CAN NOT BE DESTROYED BEFORE IT IS PINNED.
+    if(pin != NULL){
+        pin(node->val);
+    }
+    lru_touch(self, node);
+    return node->val;
 }
 
 map_val_t get(hashmap_t *self, map_key_t key) {
-    return MAP_VAL(NULL, 0);
+    return get_pinned(self, key, NULL);
+}
+
+map_val_t get_pinned(hashmap_t *self, map_key_t key, pin_f pin) {
+    if(self == NULL || self->invalid){
+        errno = EINVAL;
+        return MAP_VAL(NULL, 0);
+    }
+
+    hashmap_t *shard = shard_of(self, key);
+    map_val_t result = MAP_VAL(NULL, 0);
+    pthread_rwlock_rdlock(&shard->lock);
+    if(shard->invalid){
+        errno = EINVAL;
+    }
+    else{
+        result = get_locked(shard, key, pin);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+/*
+ * delete() with the lock held for writing.
+ */
+static map_node_t delete_locked(hashmap_t *self, map_key_t key) {
+    map_node_t **link = find_locked(self, key, self->hash_function(key));
+    //IF KEY IS NOT FOUND.
+    if(*link == NULL){
+        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
+
+    map_node_t *node = unlink_locked(self, link);
+    map_node_t returnNode = MAP_NODE(key, node->val, false);
+    free_node(node);
+    return returnNode;
 }
 
 map_node_t delete(hashmap_t *self, map_key_t key) {
-    return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    if(self == NULL || self->invalid){
+        errno = EINVAL;
+        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
+
+    hashmap_t *shard = shard_of(self, key);
+    map_node_t result = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    pthread_rwlock_wrlock(&shard->lock);
+    if(!shard->invalid){
+        map_usage_t before = usage_of(shard);
+        result = delete_locked(shard, key);
+        shard_resized(self, shard, before);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+/*
+ * discard() with the lock held for writing.
+ */
+static bool discard_locked(hashmap_t *self, map_key_t key) {
+    map_node_t **link = find_locked(self, key, self->hash_function(key));
+    if(*link == NULL){
+        return false;
+    }
+    map_node_t *node = unlink_locked(self, link);
+    //NO READER IS IN THE MAP WHILE THE LOCK IS HELD FOR WRITING. THE ENTRY CAN BE DESTROYED AT ONCE.
+    self->destroy_function(node->key, node->val);
+    free_node(node);
+    return true;
+}
+
+bool discard(hashmap_t *self, map_key_t key) {
+    if(self == NULL || self->invalid || key.key_base == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    hashmap_t *shard = shard_of(self, key);
+    bool result = false;
+    pthread_rwlock_wrlock(&shard->lock);
+    if(!shard->invalid){
+        map_usage_t before = usage_of(shard);
+        result = discard_locked(shard, key);
+        shard_resized(self, shard, before);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return result;
+}
+
+size_t put_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, bool force, bool *results) {
+    if(self == NULL || self->invalid || keys == NULL || vals == NULL){
+        //CALLERS READ EVERY RESULT, SO THE ONES OF A BATCH THAT WAS NOT TAKEN ARE false.
+        for(size_t i = 0; results != NULL && i < count; i++){
+            results[i] = false;
+        }
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t inserted = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        bool result = put(self, keys[i], vals[i], force);
+        if(results != NULL){
+            results[i] = result;
+        }
+        inserted += result;
+    }
+    //ONE TRIP THROUGH THE WRITE LOCK OF EACH SHARD FOR ALL OF ITS KEYS IN THE BATCH.
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        pthread_rwlock_wrlock(&shard->lock);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            bool result = !shard->invalid && keys[i].key_base != NULL && vals[i].val_base != NULL
+                && put_locked(shard, keys[i], vals[i], force);
+            if(results != NULL){
+                results[i] = result;
+            }
+            inserted += result;
+        }
+        shard_resized(self, shard, before);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    free(order);
+    return inserted;
+}
+
+size_t get_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count) {
+    return get_multi_pinned(self, keys, vals, count, NULL);
+}
+
+size_t get_multi_pinned(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, pin_f pin) {
+    if(self == NULL || self->invalid || keys == NULL || vals == NULL){
+        //CALLERS READ EVERY VALUE, SO THOSE OF A BATCH THAT WAS NOT TAKEN ARE NOT FOUND.
+        for(size_t i = 0; vals != NULL && i < count; i++){
+            vals[i] = MAP_VAL(NULL, 0);
+        }
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t found = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        vals[i] = get_pinned(self, keys[i], pin);
+        found += vals[i].val_base != NULL;
+    }
+    //ENTER EACH SHARD ONCE FOR ALL OF ITS KEYS, NOT ONCE PER KEY.
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        pthread_rwlock_rdlock(&shard->lock);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            vals[i] = shard->invalid ? MAP_VAL(NULL, 0) : get_locked(shard, keys[i], pin);
+            found += vals[i].val_base != NULL;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    free(order);
+    return found;
+}
+
+size_t delete_multi(hashmap_t *self, map_key_t *keys, map_node_t *nodes, size_t count) {
+    if(self == NULL || self->invalid || keys == NULL){
+        //CALLERS READ EVERY NODE, SO THOSE OF A BATCH THAT WAS NOT TAKEN ARE EMPTY.
+        for(size_t i = 0; nodes != NULL && i < count; i++){
+            nodes[i] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+        }
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t removed = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        map_node_t node = delete(self, keys[i]);
+        if(nodes != NULL){
+            nodes[i] = node;
+        }
+        removed += node.val.val_base != NULL;
+    }
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        pthread_rwlock_wrlock(&shard->lock);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            map_node_t node = shard->invalid ? MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false)
+                : delete_locked(shard, keys[i]);
+            if(nodes != NULL){
+                nodes[i] = node;
+            }
+            removed += node.val.val_base != NULL;
+        }
+        shard_resized(self, shard, before);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    free(order);
+    return removed;
+}
+
+size_t discard_multi(hashmap_t *self, map_key_t *keys, size_t count) {
+    if(self == NULL || self->invalid || keys == NULL){
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t removed = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        removed += discard(self, keys[i]);
+    }
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        pthread_rwlock_wrlock(&shard->lock);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            removed += !shard->invalid && discard_locked(shard, keys[i]);
+        }
+        shard_resized(self, shard, before);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    free(order);
+    return removed;
+}
+
+/*
+ * Destroys every entry of a map and frees its nodes. Called with the lock
+ * held for writing.
+ */
+static void wipe_locked(hashmap_t *self) {
+    for(uint32_t index = 0; index < self->capacity && self->buckets != NULL; index++){
+        map_node_t *node = self->buckets[index];
+        while(node != NULL){
+            map_node_t *next = node->next;
+            self->destroy_function(node->key, node->val);
+            free_node(node);
+            node = next;
+        }
+        self->buckets[index] = NULL;
+    }
+    memset(self->lists, 0, sizeof(self->lists));
+    self->size = 0;
+    self->bytes = buckets_bytes(self->capacity);
+}
+
+/*
+ * Sums what the shards of a map take into the map itself, once they have
+ * all been changed at once. Called with every shard's lock held for writing.
+ */
+static void sum_shards_locked(hashmap_t *self) {
+    if(self->shards == NULL){
+        return;
+    }
+    uint64_t bytes = 0;
+    for(uint32_t i = 0; i < self->num_shards; i++){
+        bytes += self->shards[i].bytes;
+    }
+    __atomic_store_n(&self->bytes, bytes, __ATOMIC_RELAXED);
 }
 
 bool clear_map(hashmap_t *self) {
-	return false;
+
+    if(self == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    //EVERY SHARD IS LOCKED, ALWAYS IN THE SAME ORDER, SO THE WHOLE MAP IS CLEARED AT ONCE AND TWO CLEARS CAN NOT DEADLOCK.
+    for(uint32_t i = 0; i < count; i++){
+        pthread_rwlock_wrlock(&shards[i].lock);
+    }
+    for(uint32_t i = 0; i < count; i++){
+        wipe_locked(&shards[i]);
+    }
+    __atomic_store_n(&self->size, 0, __ATOMIC_RELAXED);
+    sum_shards_locked(self);
+    for(uint32_t i = count; i > 0; i--){
+        pthread_rwlock_unlock(&shards[i - 1].lock);
+    }
+    return true;
 }
 
 bool invalidate_map(hashmap_t *self) {
-    return false;
+
+    if(self == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    for(uint32_t i = 0; i < count; i++){
+        pthread_rwlock_wrlock(&shards[i].lock);
+    }
+    //READERS AND WRITERS CHECK invalid UNDER THE LOCK, SO NONE TOUCHES THE BUCKETS ONCE THEY ARE FREED.
+    for(uint32_t i = 0; i < count; i++){
+        wipe_locked(&shards[i]);
+        free(shards[i].buckets);
+        shards[i].buckets = NULL;
+        sketch_free(&shards[i].sketch);
+        shards[i].invalid = true;
+    }
+    __atomic_store_n(&self->size, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->invalid, true, __ATOMIC_SEQ_CST);
+    for(uint32_t i = count; i > 0; i--){
+        pthread_rwlock_unlock(&shards[i - 1].lock);
+    }
+    return true;
 }
+
+#endif
@@ -0,0 +1,112 @@
+#include "hash.h"
+
+#include <string.h>
+
+/* The default secret of wyhash. */
+static const uint64_t wy_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * Multiplies a by b into 128 bits and folds the halves together.
+ */
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+uint32_t wy_hash(map_key_t map_key) {
+    const uint8_t *p = map_key.key_base;
+    size_t len = map_key.key_len;
+    uint64_t seed = wy_mix(wy_secret[0], wy_secret[1]);
+    uint64_t a, b;
+
+    if(len <= 16){
+        //SHORT KEYS ARE READ AS TWO OVERLAPPING HALVES, SO NO BYTE-AT-A-TIME TAIL IS NEEDED.
+        if(len >= 4){
+            a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if(len > 0){
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else{
+            a = b = 0;
+        }
+    }
+    else{
+        size_t i = len;
+        //THREE INDEPENDENT LANES, SO THE MULTIPLIES OF LONG KEYS OVERLAP.
+        if(i > 48){
+            uint64_t see1 = seed, see2 = seed;
+            do{
+                seed = wy_mix(read64(p) ^ wy_secret[1], read64(p + 8) ^ seed);
+                see1 = wy_mix(read64(p + 16) ^ wy_secret[2], read64(p + 24) ^ see1);
+                see2 = wy_mix(read64(p + 32) ^ wy_secret[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16){
+            seed = wy_mix(read64(p) ^ wy_secret[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    uint64_t hash = wy_mix(wy_mix(a ^ wy_secret[1], b ^ seed) ^ wy_secret[0] ^ len, wy_secret[1]);
+    return (uint32_t) (hash ^ (hash >> 32));
+}
+
+#define FX_SEED 0x517cc1b727220a95ull
+
+uint32_t fx_hash(map_key_t map_key) {
+    const uint8_t *p = map_key.key_base;
+    size_t len = map_key.key_len;
+    uint64_t hash = 0;
+
+    for(; len >= 8; p += 8, len -= 8){
+        hash = (((hash << 5) | (hash >> 59)) ^ read64(p)) * FX_SEED;
+    }
+    if(len >= 4){
+        hash = (((hash << 5) | (hash >> 59)) ^ read32(p)) * FX_SEED;
+        p += 4;
+        len -= 4;
+    }
+    for(; len > 0; p++, len--){
+        hash = (((hash << 5) | (hash >> 59)) ^ *p) * FX_SEED;
+    }
+    //THE LOW BITS OF A PRODUCT ARE THE WEAKEST. THE MAP INDEXES WITH THE LOW BITS OF THE RESULT, SO HAND IT THE HIGH ONES.
+    return (uint32_t) (hash >> 32);
+}
+
+const hash_entry_t hash_functions[] = {
+    {"jenkins", jenkins_one_at_a_time_hash},
+    {"wy", wy_hash},
+    {"fx", fx_hash},
+    {NULL, NULL}
+};
+
+hash_func_f find_hash(const char *name) {
+    for(const hash_entry_t *entry = hash_functions; entry->name != NULL; entry++){
+        if(strcmp(entry->name, name) == 0){
+            return entry->function;
+        }
+    }
+    return NULL;
+}
@@ -1,391 +1,1443 @@
 #include "utils.h"
+//make ec BUILDS THIS FILE BUT LINKS extracredit.o IN ITS PLACE, AGAINST A map_node_t AND hashmap_t OF ITS OWN.
+#ifndef EC
 #include "debug.h"
+#include "epoch.h"
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MAP_KEY(base, len) (map_key_t) {.key_base = base, .key_len = len}
 #define MAP_VAL(base, len) (map_val_t) {.val_base = base, .val_len = len}
 #define MAP_NODE(key_arg, val_arg, tombstone_arg) (map_node_t) {.key = key_arg, .val = val_arg, .tombstone = tombstone_arg}
 
-hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
-    if(capacity <= 0 || hash_function == NULL || destroy_function == NULL){
-        errno = EINVAL;
-        return NULL;
+_Static_assert(sizeof(map_node_t) == 64, "a node must fill a cache line");
+
+/* The control byte of an empty node. */
+#define MAP_EMPTY 0
+
+/*
+ * @return The smallest power of two that is at least entries, the size of the
+ *         probe array that holds them.
+ */
+static uint32_t capacity_for(uint32_t entries) {
+    uint32_t capacity = 1;
+    while(capacity < entries){
+        capacity <<= 1;
     }
+    return capacity;
+}
 
-    hashmap_t *hashmap = calloc(1, sizeof(hashmap_t));
-    hashmap->capacity = capacity;
-    hashmap->nodes = calloc(capacity, sizeof(map_node_t));
+/*
+ * @return The bytes a probe array of capacity nodes and its control bytes take.
+ */
+static size_t nodes_bytes(uint32_t capacity) {
+    size_t size = (size_t) capacity * sizeof(map_node_t) + capacity + MAP_GROUP - 1;
+    return (size + 63) & ~(size_t) 63;
+}
+
+/*
+ * Allocates a probe array of capacity empty nodes, followed by their control bytes.
+ */
+static map_node_t *alloc_nodes(uint32_t capacity) {
+    //A NODE IS A CACHE LINE. START THE ARRAY ON ONE SO NO NODE STRADDLES TWO.
+    size_t size = nodes_bytes(capacity);
+    map_node_t *nodes = aligned_alloc(64, size);
+    if(nodes != NULL){
+        memset(nodes, 0, size);
+    }
+    return nodes;
+}
+
+/*
+ * @return The control bytes of a probe array.
+ */
+static inline uint8_t *ctrl_bytes(map_node_t *nodes, uint32_t capacity) {
+    return (uint8_t *) (nodes + capacity);
+}
+
+/*
+ * @return The control byte of an entry with the given hash.
+ */
+static inline uint8_t ctrl_of(uint32_t hash) {
+    //THE LOW BITS OF A HASH PICK ITS INDEX AND THE HIGH BITS ITS SHARD, SO MIX THEM ALL INTO THE 7 KEPT.
+    return 0x80 | (hash * 0x9E3779B1u) >> 25;
+}
+
+/*
+ * Sets the control byte of a node, and its copy past the end of the array.
+ */
+static void set_ctrl(map_node_t *nodes, uint32_t capacity, uint32_t index, uint8_t ctrl) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    bytes[index] = ctrl;
+    for(uint32_t copy = index; copy < MAP_GROUP - 1; copy += capacity){
+        bytes[capacity + copy] = ctrl;
+    }
+}
+
+/*
+ * Compares MAP_GROUP control bytes at once.
+ *
+ * @param bytes The first control byte of the group.
+ * @param ctrl The control byte searched for.
+ * @param match Set to a bit for each byte of the group equal to ctrl.
+ * @param empty Set to a bit for each empty node of the group.
+ */
+static inline void scan_group(const uint8_t *bytes, uint8_t ctrl, uint32_t *match, uint32_t *empty) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *) bytes);
+    *match = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(ctrl)));
+    *empty = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_setzero_si128()));
+#else
+    *match = *empty = 0;
+    for(int i = 0; i < MAP_GROUP; i++){
+        *match |= (uint32_t) (bytes[i] == ctrl) << i;
+        *empty |= (uint32_t) (bytes[i] == MAP_EMPTY) << i;
+    }
+#endif
+}
+
+/*
+ * @param left How many slots past the first of the group the search may go, up to max_dist.
+ * @param empty The empty nodes of the group, from scan_group().
+ * @return A bit for each node of the group the search covers: those before
+ *         the first empty one and within max_dist. All MAP_GROUP bits if the
+ *         search goes on to the next group.
+ */
+static inline uint32_t group_window(uint32_t left, uint32_t empty) {
+    uint32_t window = left < MAP_GROUP ? (2u << left) - 1 : (1u << MAP_GROUP) - 1;
+    if(empty != 0){
+        window &= (empty & -empty) - 1;
+    }
+    return window;
+}
+
+/*
+ * Sets up a map's probe array, sized for capacity entries, and its locks.
+ */
+static void init_map(hashmap_t *hashmap, uint32_t capacity, uint32_t max_capacity, hash_func_f hash_function, destructor_f destroy_function) {
+    hashmap->capacity = capacity_for(capacity);
+    hashmap->max_capacity = max_capacity;
+    hashmap->nodes = alloc_nodes(hashmap->capacity);
+    hashmap->bytes = nodes_bytes(hashmap->capacity);
     hashmap->hash_function = hash_function;
     hashmap->destroy_function = destroy_function;
+    //ANY NONZERO SEED. SHARDS START FROM DIFFERENT ONES.
+    hashmap->rng = (uintptr_t) hashmap | 1;
     if(pthread_mutex_init(&hashmap->write_lock, NULL) != 0){
         errno = EINVAL;
         exit(1);
     }
-    if(pthread_mutex_init(&hashmap->fields_lock, NULL) != 0){
-        errno = EINVAL;
+    hashmap->readers = aligned_alloc(_Alignof(map_reader_slot_t), MAP_READER_SLOTS * sizeof(map_reader_slot_t));
+    if(hashmap->readers == NULL){
+        errno = ENOMEM;
         exit(1);
     }
-    return hashmap;
+    memset(hashmap->readers, 0, MAP_READER_SLOTS * sizeof(map_reader_slot_t));
 }
 
+hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
+    return create_growable_map(capacity, capacity, 1, hash_function, destroy_function);
+}
 
-bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
-    //IF ANY PARAMETERS INVALID
-    if(self == NULL || self->invalid || key.key_base == NULL || val.val_base == NULL){
+hashmap_t *create_sharded_map(uint32_t capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function) {
+    return create_growable_map(capacity, capacity, num_shards, hash_function, destroy_function);
+}
+
+hashmap_t *create_growable_map(uint32_t capacity, uint32_t max_capacity, uint32_t num_shards, hash_func_f hash_function, destructor_f destroy_function) {
+    if(capacity <= 0 || num_shards == 0 || hash_function == NULL || destroy_function == NULL){
         errno = EINVAL;
-        return false;
+        return NULL;
+    }
+    if(num_shards > MAP_MAX_SHARDS){
+        num_shards = MAP_MAX_SHARDS;
+    }
+    if(capacity > MAP_MAX_CAPACITY){
+        capacity = MAP_MAX_CAPACITY;
+    }
+    if(max_capacity == 0 || max_capacity > MAP_MAX_CAPACITY){
+        max_capacity = MAP_MAX_CAPACITY;
+    }
+    if(max_capacity < capacity){
+        max_capacity = capacity;
     }
 
-    debug("Put function force value: %d", force);
+    //ROUND UP TO A POWER OF TWO SO THE TOP log2(n) BITS OF A HASH NAME THE SHARD.
+    uint32_t n = 1;
+    uint32_t shift = 32;
+    while(n < num_shards){
+        n <<= 1;
+        shift--;
+    }
+    //NO MORE SHARDS THAN ENTRIES, SO EVERY SHARD CAN HOLD ONE.
+    while(n > max_capacity){
+        n >>= 1;
+        shift++;
+    }
+    hashmap_t *hashmap = calloc(1, sizeof(hashmap_t));
+    if(n == 1){
+        init_map(hashmap, capacity, max_capacity, hash_function, destroy_function);
+        return hashmap;
+    }
 
-    //THREAD TAKES THE LOCK. NO OTHER THREAD CAN COME IN WHEN WRITING.
-    pthread_mutex_lock(&self->write_lock);
+    uint32_t per_shard = (capacity + n - 1) / n;
+    //THE PARENT HOLDS NO NODES ITSELF. ITS size AND capacity ARE THE SUMS OF ITS SHARDS'.
+    init_map(hashmap, per_shard * n, max_capacity, hash_function, destroy_function);
+    free(hashmap->nodes);
+    hashmap->nodes = NULL;
+    hashmap->shards = calloc(n, sizeof(hashmap_t));
+    hashmap->num_shards = n;
+    hashmap->shard_shift = shift;
+    for(uint32_t i = 0; i < n; i++){
+        //THE SHARDS' CAPS ADD UP TO max_capacity. THE FIRST max_capacity % n TAKE ONE EXTRA ENTRY EACH.
+        init_map(&hashmap->shards[i], per_shard, max_capacity / n + (i < max_capacity % n), hash_function, destroy_function);
+    }
+    hashmap->capacity = hashmap->shards[0].capacity * n;
+    hashmap->bytes = hashmap->shards[0].bytes * n;
+    return hashmap;
+}
 
-    //IF MAP IS FULL AND FORCE IS FALSE
-    if(self->size == self->capacity && force == 0){
+/*
+ * @return The shard key belongs in, or self if the map is not sharded.
+ */
+static hashmap_t *shard_of(hashmap_t *self, map_key_t key) {
+    if(self->shards == NULL){
+        return self;
+    }
+    //A NULL KEY IS NEVER STORED. IT GOES TO THE FIRST SHARD WITHOUT BEING HASHED.
+    if(key.key_base == NULL){
+        return &self->shards[0];
+    }
+    return &self->shards[self->hash_function(key) >> self->shard_shift];
+}
+
+/*
+ * What a shard holds and takes, before a write changes it.
+ */
+typedef struct map_usage_t {
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t bytes;
+} map_usage_t;
+
+static inline map_usage_t usage_of(hashmap_t *shard) {
+    return (map_usage_t) {.size = shard->size, .capacity = shard->capacity, .bytes = shard->bytes};
+}
+
+/*
+ * Carries the change in a shard's size, capacity and bytes since before over
+ * to its parent. Called between writer_enter() and writer_exit() on the shard.
+ */
+static void shard_resized(hashmap_t *self, hashmap_t *shard, map_usage_t before) {
+    if(shard != self){
+        __atomic_add_fetch(&self->size, shard->size - before.size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&self->capacity, shard->capacity - before.capacity, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&self->bytes, shard->bytes - before.bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * @param count Set to the number of shards.
+ * @return The shards of self, or self alone if the map is not sharded.
+ */
+static hashmap_t *shards_of(hashmap_t *self, uint32_t *count) {
+    if(self->shards == NULL){
+        *count = 1;
+        return self;
+    }
+    *count = self->num_shards;
+    return self->shards;
+}
+
+/*
+ * The keys of a batch that belong to one shard: order[start] to order[end - 1].
+ */
+typedef struct map_run_t {
+    hashmap_t *shard;
+    size_t start;
+    size_t end;
+} map_run_t;
+
+/*
+ * Groups the keys of a batch by shard, so each shard is locked once however
+ * its keys are interleaved with others'. Keys keep their relative order
+ * within a shard.
+ *
+ * @param self The map the batch is for
+ * @param keys The keys of the batch
+ * @param count The number of keys
+ * @param order Set to the key indices grouped by shard, or to NULL when the
+ *              map is not sharded and the keys are taken in order. Must be
+ *              freed by the caller.
+ * @param runs Filled in with one run per shard that has keys, up to MAP_MAX_SHARDS.
+ * @return The number of runs. 0 with errno set to ENOMEM if there are keys
+ *         but no memory to group them.
+ */
+static size_t split_batch(hashmap_t *self, map_key_t *keys, size_t count, size_t **order, map_run_t *runs) {
+    *order = NULL;
+    if(self->shards == NULL){
+        runs[0] = (map_run_t) {.shard = self, .start = 0, .end = count};
+        return 1;
+    }
+    if(count == 0){
+        return 0;
+    }
+
+    uint8_t *which = malloc(count);
+    *order = malloc(count * sizeof(size_t));
+    if(which == NULL || *order == NULL){
+        free(which);
+        free(*order);
+        *order = NULL;
         errno = ENOMEM;
-        pthread_mutex_unlock(&self->write_lock);
-        return false;
+        return 0;
     }
 
-    uint32_t index = get_index(self, key);
-    //IF THE MAP IS FULL AND FORCE IS TRUE.
-    if(self->size == self->capacity && force == 1){
-        debug("Put when map is full and force is true.");
-        int total_count = 0;
-        //FIRST, SEARCH IF THERE IS AN EXISTING KEY FOR IT. IF THERE IS, REPLACE THAT KEY. OTHERWISE, HASH IT IMMEDIATELY TO ITS INDEX.
-        while(total_count < self->capacity){
-            //COMPARE KEYS OF THE SAME LENGTH
-            if(key.key_len == self->nodes[index].key.key_len){
-                //IF THEY ARE THE SAME KEY, SIMPLY REPLACE THE VALUE FOR THAT KEY.
-                if(memcmp(key.key_base, self->nodes[index].key.key_base, key.key_len) == 0){
-                    //DESTROY FUNCTION ON KEY AND VAL. destroy_function() DOES NOT FREE THE NODE. WILL ONLY FREE THE KEY AND VAL.
+    //COUNTING SORT OF THE KEY INDICES BY SHARD.
+    size_t starts[MAP_MAX_SHARDS] = {0};
+    for(size_t i = 0; i < count; i++){
+        which[i] = shard_of(self, keys[i]) - self->shards;
+        starts[which[i]]++;
+    }
+    size_t nruns = 0;
+    size_t offset = 0;
+    for(uint32_t s = 0; s < self->num_shards; s++){
+        size_t n = starts[s];
+        if(n > 0){
+            runs[nruns++] = (map_run_t) {.shard = &self->shards[s], .start = offset, .end = offset + n};
+        }
+        starts[s] = offset;
+        offset += n;
+    }
+    for(size_t i = 0; i < count; i++){
+        (*order)[starts[which[i]]++] = i;
+    }
+    free(which);
+    return nruns;
+}
 
-                    debug("Put into hashmap at same key.");
-                    self->destroy_function(self->nodes[index].key, self->nodes[index].val);
-                    self->nodes[index].key = key;
-                    self->nodes[index].val = val;
+/* The states of a map's writer word: no writer, a writer, or a writer that readers are waiting out. */
+#define MAP_NO_WRITER 0
+#define MAP_WRITER 1
+#define MAP_WRITER_WAITED 2
+
+/* The reader slot of the calling thread, handed out round robin on its first get(). */
+static __thread int reader_slot = -1;
+static int next_reader_slot;
+
+/*
+ * Leaves the map as a reader. The reader that empties a slot a writer is
+ * waiting on wakes it.
+ */
+static void reader_exit(hashmap_t *self, int *count) {
+    //DROP THE COUNT BEFORE LOOKING FOR A WRITER, SO EITHER THE WRITER SEES 0 OR THE READER SEES THE WRITER.
+    if(__atomic_sub_fetch(count, 1, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&self->writer, __ATOMIC_SEQ_CST)){
+        syscall(SYS_futex, count, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
 
-                    pthread_mutex_unlock(&self->write_lock);
+/*
+ * Enters the map as a reader. Readers only touch their own slot's cache line,
+ * so they do not contend with each other. A reader that finds a writer
+ * waiting backs out and sleeps until the writer is done, so a steady stream
+ * of readers can not keep a writer out.
+ *
+ * @return The slot counter to pass to reader_exit().
+ */
+static int *reader_enter(hashmap_t *self) {
+    if(reader_slot < 0){
+        reader_slot = __atomic_fetch_add(&next_reader_slot, 1, __ATOMIC_RELAXED) % MAP_READER_SLOTS;
+    }
+    int *count = &self->readers[reader_slot].count;
+    while(true){
+        //ANNOUNCE THE READER BEFORE LOOKING FOR A WRITER. A WRITER DOES THE OPPOSITE, SO ONE OF THE TWO ALWAYS SEES THE OTHER.
+        __atomic_add_fetch(count, 1, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&self->writer, __ATOMIC_SEQ_CST)){
+            return count;
+        }
+        reader_exit(self, count);
+        //SLEEP UNTIL THE WRITER IS DONE. READERS STAY OFF write_lock SO WRITERS QUEUED ON IT ARE NOT CROWDED OUT.
+        uint32_t seen = MAP_WRITER;
+        if(__atomic_compare_exchange_n(&self->writer, &seen, MAP_WRITER_WAITED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+            || seen == MAP_WRITER_WAITED){
+            syscall(SYS_futex, &self->writer, FUTEX_WAIT_PRIVATE, MAP_WRITER_WAITED, NULL, NULL, 0);
+        }
+    }
+}
 
-                    return true;
-                }
-            }
-            index = (index + 1) % self->capacity;
-            total_count++;
+/*
+ * Takes the map for writing. Writers are serialized by write_lock, then sleep
+ * until the readers that entered before them have left. Lock-free readers
+ * are not waited for. They see seq change and search again.
+ */
+static void writer_enter(hashmap_t *self) {
+    pthread_mutex_lock(&self->write_lock);
+    //AN ODD seq TELLS LOCK-FREE READERS THAT WHAT THEY READ FROM nodes MAY BE TORN.
+    __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&self->writer, MAP_WRITER, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < MAP_READER_SLOTS; i++){
+        int *count = &self->readers[i].count;
+        int seen;
+        //FUTEX_WAIT RETURNS AT ONCE IF THE COUNT CHANGED SINCE IT WAS READ, SO A WAKE CAN NOT BE MISSED.
+        while((seen = __atomic_load_n(count, __ATOMIC_SEQ_CST)) != 0){
+            syscall(SYS_futex, count, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
         }
-        debug("There is no same key in the full hashmap. Just replace at hashed index");
-        //THERE IS NO SAME KEY IN THE HASHMAP. JUST REPLACE AT THE HASHED INDEX.
-        index = get_index(self, key);
-        //DESTROY FUNCTION ON KEY AND VAL. USER's destroy_function() DOES NOT FREE THE NODE. ONLY THE KEY AND VAL.
-        self->destroy_function(self->nodes[index].key, self->nodes[index].val);
-        self->nodes[index].key = key;
-        self->nodes[index].val = val;
+    }
+}
 
-        pthread_mutex_unlock(&self->write_lock);
+static void writer_exit(hashmap_t *self) {
+    __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELEASE);
+    if(__atomic_exchange_n(&self->writer, MAP_NO_WRITER, __ATOMIC_SEQ_CST) == MAP_WRITER_WAITED){
+        syscall(SYS_futex, &self->writer, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+    pthread_mutex_unlock(&self->write_lock);
+}
 
-        return true;
+/*
+ * Destroys up to limit of the oldest retired entries, if no lock-free reader
+ * can still see them. Called after writer_enter().
+ */
+static void reclaim_locked(hashmap_t *self, uint32_t limit) {
+    uint32_t mask = self->retired_cap - 1;
+    //ENTRIES ARE RETIRED IN EPOCH ORDER, SO ONLY THE OLDEST NEEDS CHECKING. THE EPOCH IS PUSHED ON
+    //ONLY NOW AND THEN, AS THAT LOOKS AT EVERY READER.
+    if(!epoch_safe(self->retired[self->retired_head & mask].epoch)
+        && (self->num_retired % (MAP_RETIRE_BATCH / 4) != 0 || !epoch_try_advance())){
+        return;
     }
-    //OTHERWISE, THE MAP IS NOT FULL AND FORCE CAN BE TRUE OR NOT TRUE
-    else{
-        debug("Map is not full");
-        int total_count = 0;
-        //FIRST FIND IF THERE IS A NODE WITH THE SAME KEY. IF THERE IS ONE, REPLACE THAT NODE'S VALUE.
-        //SKIP OVER TOMBSTONES BECAUSE THERE CAN BE MORE NODES AFTER THE TOMBSTONE TO CHECK.
-        while((self->nodes[index].key.key_base != 0 && self->nodes[index].key.key_len != 0
-        && self->nodes[index].val.val_base != 0 && self->nodes[index].val.val_len != 0)
-        || self->nodes[index].tombstone == 1){
-            if(total_count == self->capacity){
-                break;
-            }
-            //COMPARE KEYS OF THE SAME LENGTH
-            if(key.key_len == self->nodes[index].key.key_len){
-                //IF THEY ARE THE SAME KEY, SIMPLY REPLACE THE VALUE FOR THAT KEY.
-                if(memcmp(key.key_base, self->nodes[index].key.key_base, key.key_len) == 0){
-                    debug("There exists a same key. Destroy the node and replace key and value.");
-                    //DESTROY FUNCTION ON KEY AND VAL. destroy_function() DOES NOT FREE THE NODE. WILL ONLY FREE THE KEY AND VAL.
-                    self->destroy_function(self->nodes[index].key, self->nodes[index].val);
-                    self->nodes[index].key = key;
-                    self->nodes[index].val = val;
-
-                    pthread_mutex_unlock(&self->write_lock);
-
-                    return true;
-                }
+    while(limit-- > 0 && self->num_retired > 0 && epoch_safe(self->retired[self->retired_head & mask].epoch)){
+        map_retired_t *retired = &self->retired[self->retired_head++ & mask];
+        self->num_retired--;
+        self->destroy_function(retired->key, retired->val);
+    }
+}
+
+/*
+ * Takes the place of destroy_function for an entry just unlinked from the
+ * map, destroying it once no lock-free reader can still see it. Called after
+ * writer_enter().
+ */
+static void retire_locked(hashmap_t *self, map_key_t key, map_val_t val) {
+    if(self->num_retired == self->retired_cap){
+        //THE RING IS FULL. GROW IT, UNWRAPPING THE ENTRIES INTO THE NEW ONE.
+        uint32_t cap = self->retired_cap ? self->retired_cap * 2 : MAP_RETIRE_BATCH * 2;
+        map_retired_t *retired = malloc(cap * sizeof(map_retired_t));
+        if(retired == NULL){
+            //NO ROOM TO DEFER IT. WAIT THE READERS OUT INSTEAD.
+            epoch_synchronize();
+            self->destroy_function(key, val);
+            return;
+        }
+        for(uint32_t i = 0; i < self->num_retired; i++){
+            retired[i] = self->retired[(self->retired_head + i) & (self->retired_cap - 1)];
+        }
+        free(self->retired);
+        self->retired = retired;
+        self->retired_head = 0;
+        self->retired_cap = cap;
+    }
+    uint32_t tail = (self->retired_head + self->num_retired++) & (self->retired_cap - 1);
+    self->retired[tail] = (map_retired_t) {.key = key, .val = val, .epoch = epoch_now()};
+    //TWO FOR EVERY ONE RETIRED, SO THE BACKLOG SHRINKS WITHOUT ANY ONE WRITE PAYING FOR ALL OF IT.
+    if(self->num_retired > MAP_RETIRE_BATCH){
+        reclaim_locked(self, 2);
+    }
+}
+
+/*
+ * Compares a key with the key of a node whose hash matches it.
+ *
+ * @param key_inline The first MAP_INLINE_KEY bytes of the node's key, from the node.
+ * @param key_base The node's key.
+ * @param key_len The length of the node's key.
+ * @return true if the keys are the same.
+ */
+static inline bool key_equals(map_key_t key, const uint8_t *key_inline, const void *key_base, size_t key_len) {
+    if(key.key_len != key_len){
+        return false;
+    }
+    //SHORT KEYS ARE COMPARED WHOLE FROM THE NODE. ONLY THE TAIL OF A LONGER ONE IS READ THROUGH ITS POINTER.
+    size_t inline_len = key_len < MAP_INLINE_KEY ? key_len : MAP_INLINE_KEY;
+    return memcmp(key.key_base, key_inline, inline_len) == 0
+        && (key_len == inline_len
+            || memcmp((const uint8_t *) key.key_base + inline_len, (const uint8_t *) key_base + inline_len, key_len - inline_len) == 0);
+}
+
+/*
+ * Finds the node holding a key in one probe array. Only nodes whose control
+ * byte matches the key's are looked at.
+ *
+ * @param max_dist The largest distance of any entry in the array.
+ * @param hash The hash of the key.
+ * @return The index of the node, or capacity if the key is not in the array.
+ */
+static uint32_t find_in(map_node_t *nodes, uint32_t capacity, uint32_t max_dist, map_key_t key, uint32_t hash) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    uint8_t ctrl = ctrl_of(hash);
+    uint32_t index = hash & (capacity - 1);
+    for(uint32_t probed = 0; probed <= max_dist; probed += MAP_GROUP){
+        uint32_t match, empty;
+        scan_group(bytes + index, ctrl, &match, &empty);
+        uint32_t window = group_window(max_dist - probed, empty);
+        for(match &= window; match != 0; match &= match - 1){
+            uint32_t slot = (index + __builtin_ctz(match)) & (capacity - 1);
+            map_node_t *node = &nodes[slot];
+            //COMPARE THE FULL HASHES, THEN THE KEYS OF THE SAME LENGTH
+            if(hash == node->hash && key_equals(key, node->key_inline, node->key.key_base, node->key.key_len)){
+                return slot;
             }
-            index = (index + 1) % self->capacity;
-            total_count++;
-        }
-        //THERE IS NO NODE WITH THE SAME KEY.
-        debug("There is no node with the same key.");
-        //WHEN THE MAP IS NOT FULL, LINEAR PROBE IF NEEDED
-        //IF THE INDEX ALREADY HAS AN ELEMENT LINEAR PROBE TO FIND THE FIRST NEXT FREE INDEX OR A TOMBSTONE AND PUT
-        total_count = 0;
-        index = get_index(self, key);
-        while((self->nodes[index].key.key_base != 0 && self->nodes[index].key.key_len != 0
-        && self->nodes[index].val.val_base != 0 && self->nodes[index].val.val_len != 0)
-            || self->nodes[index].tombstone == 1){
-            //MAP IS FULL
-            if(total_count == self->capacity){
-                pthread_mutex_unlock(&self->write_lock);
-                return false;
+        }
+        //AN EMPTY NODE, OR THE LONGEST PROBE IN THE ARRAY, ENDS THE SEARCH. PUT WOULD HAVE PLACED THE KEY BEFORE IT.
+        if(window != (1u << MAP_GROUP) - 1){
+            break;
+        }
+        index = (index + MAP_GROUP) & (capacity - 1);
+    }
+    return capacity;
+}
+
+/*
+ * @return How far the node at index sits past the index its hash picks.
+ */
+static inline uint32_t dist_of(uint32_t hash, uint32_t index, uint32_t capacity) {
+    return (index - hash) & (capacity - 1);
+}
+
+/*
+ * Places an entry whose key is not in a probe array, probing from the index
+ * it hashes to. An entry found closer to its home than the one being placed
+ * gives up its node and is placed further on in turn. The array must have an
+ * empty node.
+ *
+ * @param max_dist The largest distance of any entry in the array, raised if need be.
+ */
+static void insert_in(map_node_t *nodes, uint32_t capacity, uint32_t *max_dist, map_key_t key, map_val_t val, uint32_t hash) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    map_node_t entry = MAP_NODE(key, val, false);
+    entry.hash = hash;
+    memcpy(entry.key_inline, key.key_base, key.key_len < MAP_INLINE_KEY ? key.key_len : MAP_INLINE_KEY);
+    uint8_t ctrl = ctrl_of(hash);
+    uint32_t index = hash & (capacity - 1);
+    uint32_t dist = 0;
+    while(bytes[index] != MAP_EMPTY){
+        uint32_t other = dist_of(nodes[index].hash, index, capacity);
+        if(other < dist){
+            map_node_t displaced = nodes[index];
+            uint8_t displaced_ctrl = bytes[index];
+            nodes[index] = entry;
+            set_ctrl(nodes, capacity, index, ctrl);
+            if(dist > *max_dist){
+                *max_dist = dist;
             }
-            index = (index + 1) % self->capacity;
-            total_count++;
+            entry = displaced;
+            ctrl = displaced_ctrl;
+            dist = other;
         }
+        index = (index + 1) & (capacity - 1);
+        dist++;
+    }
+    nodes[index] = entry;
+    set_ctrl(nodes, capacity, index, ctrl);
+    if(dist > *max_dist){
+        *max_dist = dist;
+    }
+}
 
-        //CURRENT NODE IN THE ARRAY IS FREE.
-        if((self->nodes[index].key.key_base == 0 && self->nodes[index].key.key_len == 0
-        && self->nodes[index].val.val_base == 0 && self->nodes[index].val.val_len == 0)
-            || self->nodes[index].tombstone == 1){
-            debug("Current node in the array is free. Put into this node.");
-            debug("key value: %d", *(int *)key.key_base);
-            self->nodes[index].key = key;
-            self->nodes[index].val = val;
-            self->nodes[index].tombstone = 0;
-            self->size = (self->size) + 1;
+/*
+ * Empties a node of a probe array, shifting the entries after it back by one
+ * until one that is in its own slot or an empty node. Does not destroy what
+ * was in the node.
+ */
+static void remove_in(map_node_t *nodes, uint32_t capacity, uint32_t index) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    uint32_t next = (index + 1) & (capacity - 1);
+    for(uint32_t moved = 1; moved < capacity; moved++){
+        if(bytes[next] == MAP_EMPTY || (nodes[next].hash & (capacity - 1)) == next){
+            break;
         }
+        nodes[index] = nodes[next];
+        set_ctrl(nodes, capacity, index, bytes[next]);
+        index = next;
+        next = (next + 1) & (capacity - 1);
+    }
+    nodes[index] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    set_ctrl(nodes, capacity, index, MAP_EMPTY);
+}
 
-        pthread_mutex_unlock(&self->write_lock);
+/*
+ * Finds the node holding a key. Called after reader_enter() or writer_enter().
+ *
+ * @param hash The hash of the key.
+ * @return The node, in nodes or old_nodes, or NULL if the key is not in the map.
+ */
+static map_node_t *find_locked(hashmap_t *self, map_key_t key, uint32_t hash) {
+    uint32_t index = find_in(self->nodes, self->capacity, self->max_dist, key, hash);
+    if(index != self->capacity){
+        return &self->nodes[index];
+    }
+    //WHILE THE MAP IS RESIZING, KEYS NOT MOVED YET ARE STILL IN THE OLD ARRAY.
+    if(self->old_nodes != NULL){
+        index = find_in(self->old_nodes, self->old_capacity, self->old_max_dist, key, hash);
+        if(index != self->old_capacity){
+            return &self->old_nodes[index];
+        }
+    }
+    return NULL;
+}
 
-        return true;
+/*
+ * Frees the probe array the last resize moved out of, once no lock-free
+ * reader can still be searching it. Called after writer_enter().
+ *
+ * @param wait Whether to wait for the readers instead of leaving it to a later write.
+ */
+static void free_old_locked(hashmap_t *self, bool wait) {
+    if(self->freed_nodes == NULL){
+        return;
+    }
+    if(wait){
+        epoch_synchronize();
+    }
+    else if(!epoch_safe(self->freed_epoch) && (!epoch_try_advance() || !epoch_safe(self->freed_epoch))){
+        return;
     }
+    free(self->freed_nodes);
+    self->freed_nodes = NULL;
 }
 
-map_val_t get(hashmap_t *self, map_key_t key) {
-    //WHEN SEARCHING, SKIP OVER TOMBSTONED NODES. ONCE A NODE IS REACHED THAT IS EMPTY, AND
-    //KEY HAS YET TO BE FOUND, THE KEY VALUE PAIR DOES NOT EXIST.
+/*
+ * Moves the entries of up to slots slots of the old probe array into the new
+ * one while the map is resizing. Called after writer_enter().
+ */
+static void migrate_locked(hashmap_t *self, uint32_t slots) {
+    free_old_locked(self, false);
+    while(self->old_nodes != NULL && slots-- > 0){
+        //TAKING EACH ENTRY OUT THE WAY delete() DOES SHIFTS THE NEXT ONES BACK INTO THIS SLOT, SO THE OLD ARRAY
+        //STAYS SEARCHABLE AND EVERYTHING BEFORE migrated IS EMPTY.
+        map_node_t *node = &self->old_nodes[self->migrated];
+        while(node->key.key_base != NULL){
+            insert_in(self->nodes, self->capacity, &self->max_dist, node->key, node->val, node->hash);
+            remove_in(self->old_nodes, self->old_capacity, self->migrated);
+        }
+        if(++self->migrated == self->old_capacity){
+            //LOCK-FREE READERS MAY STILL BE SEARCHING THE OLD ARRAY. IT IS FREED ONCE THEY ARE DONE.
+            self->freed_nodes = self->old_nodes;
+            self->bytes -= nodes_bytes(self->old_capacity);
+            self->old_nodes = NULL;
+            self->old_capacity = 0;
+            self->old_max_dist = 0;
+            self->migrated = 0;
+            self->freed_epoch = epoch_now();
+        }
+    }
+}
 
-    if(self == NULL || self->invalid){
-        errno = EINVAL;
-        return MAP_VAL(NULL, 0);
+/*
+ * Starts moving the map into a probe array twice the size. Called after
+ * writer_enter(), once the old array is done with.
+ */
+static void grow_locked(hashmap_t *self) {
+    uint32_t capacity = self->capacity * 2;
+    map_node_t *nodes = alloc_nodes(capacity);
+    //NO MEMORY TO GROW. KEEP FILLING THE ARRAY THERE IS.
+    if(nodes == NULL){
+        return;
     }
+    //AT MOST ONE ARRAY WAITS FOR READERS AT A TIME. A WHOLE RESIZE HAS PASSED SINCE THIS ONE WAS LEFT, SO THIS RARELY WAITS.
+    free_old_locked(self, true);
+    self->old_nodes = self->nodes;
+    self->old_capacity = self->capacity;
+    self->old_max_dist = self->max_dist;
+    self->migrated = 0;
+    self->nodes = nodes;
+    self->capacity = capacity;
+    self->max_dist = 0;
+    self->bytes += nodes_bytes(capacity);
+}
 
-    // take fields lock
-    // increment num readers
-    // if you're the first reader, take write lock
-    // put back fields lock
+/*
+ * @return The bytes an entry's key and value take, as the map counts them.
+ */
+static inline uint64_t entry_cost(hashmap_t *self, map_key_t key, map_val_t val) {
+    return self->cost_function != NULL ? self->cost_function(key, val) : key.key_len + val.val_len;
+}
 
+/*
+ * @return The bytes the probe arrays of a map take, without its entries.
+ */
+static inline uint64_t arrays_bytes(hashmap_t *self) {
+    return nodes_bytes(self->capacity) + (self->old_nodes != NULL ? nodes_bytes(self->old_capacity) : 0);
+}
 
-    // read
+/*
+ * @return true if the map would go over its memory limit if it took extra more bytes.
+ */
+static inline bool over_budget(hashmap_t *self, uint64_t extra) {
+    return self->max_bytes != 0 && self->bytes + extra > self->max_bytes;
+}
 
-    // take fields
-    // decrement num readers
-    // if you're the last reader to leave, put back write lock
-    // put back fields lock
+/*
+ * @return true if the map holds as many entries as it may, or its probe array
+ *         has no empty node because a larger one would not fit in max_bytes.
+ */
+static inline bool full_locked(hashmap_t *self) {
+    return self->size >= self->max_capacity || self->size == self->capacity;
+}
 
-    //fields_lock TO PROTECT ACCESS TO THE READER COUNTER. MULTIPLE THREADS CAN CORRUPT THE num_readers COUNTER.
-    pthread_mutex_lock(&self->fields_lock);
-    self->num_readers = (self->num_readers) + 1;
-    if(self->num_readers == 1){
-        //ONLY THE FIRST READER TAKES THE WRITE LOCK. THIS IS BECAUSE IF EVERY READER TAKES A WRITE LOCK,
-        //THE HASH MAP WOULD BE SINGLE THREADED AS EVERY READER AND WRITER WOULD WAIT UNTIL THE WRITE LOCK IS UNLOCKED.
-        //THATS WHY EVERY SUBSEQUENT READER AFTER THE FIRST NEED NOT TO TAKE A WRITE LOCK, SO THAT THERE CAN BE AN UNLIMITED
-        //NUMBER OF READERS, BUT NO WRITERS. ONCE THIS READER THREAD (THREAD THAT RUNS get() METHOD), WHEN A WRITER
-        //THREAD (THREAD THAT RUNS put() OR delete() METHODS), THOSE THREADS NEED TO WAIT UNTIL THE LAST READER RELEASES THE WRITE LOCK.
-        //THIS PREVENTS THREADS TO WRITE TO THE DATASTRUCTURE WHEN THREAD(S) ARE READING IT.
-        pthread_mutex_lock(&self->write_lock);
+/*
+ * Takes the entry in a node of nodes or old_nodes out of the map. Does not
+ * destroy it. Called after writer_enter().
+ */
+static void unlink_locked(hashmap_t *self, map_node_t *node) {
+    self->bytes -= entry_cost(self, node->key, node->val);
+    if(node >= self->nodes && node < self->nodes + self->capacity){
+        remove_in(self->nodes, self->capacity, node - self->nodes);
     }
-    pthread_mutex_unlock(&self->fields_lock);
-
-    uint32_t index = get_index(self, key);
-    int total_count = 0;
+    else{
+        remove_in(self->old_nodes, self->old_capacity, node - self->old_nodes);
+    }
+    self->size = (self->size) - 1;
+}
 
-    while(total_count < self->capacity){
-        if(self->nodes[index].tombstone == 1){
-            index = (index + 1) % self->capacity;
-            total_count++;
+/*
+ * @return The index of the first entry at or after index in a probe array,
+ *         or capacity if the array is empty.
+ */
+static uint32_t next_entry(map_node_t *nodes, uint32_t capacity, uint32_t index) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    for(uint32_t scanned = 0; scanned < capacity; scanned++){
+        if(bytes[index] != MAP_EMPTY){
+            return index;
         }
-        if(key.key_len == self->nodes[index].key.key_len){
-            if(memcmp(key.key_base, self->nodes[index].key.key_base, key.key_len) == 0){
-
-                debug("KEY VALUE PAIR FOUND.");
-                map_val_t returnval = MAP_VAL(self->nodes[index].val.val_base, self->nodes[index].val.val_len);
+        index = (index + 1) & (capacity - 1);
+    }
+    return capacity;
+}
 
-                pthread_mutex_lock(&self->fields_lock);
-                self->num_readers = (self->num_readers) - 1;
-                if(self->num_readers == 0){
-                    pthread_mutex_unlock(&self->write_lock);
-                }
-                pthread_mutex_unlock(&self->fields_lock);
+/*
+ * Marks an entry a reader found as used since eviction last looked at it.
+ * The bit is only written while clear, so reading a hot entry again does
+ * not write its cache line. A reader may race a writer moving the entry and
+ * mark the one moved in instead, which costs that entry no more than a
+ * second chance.
+ */
+static inline void mark_referenced(hashmap_t *self, map_node_t *node) {
+    if(self->eviction != MAP_EVICT_HASHED && !__atomic_load_n(&node->referenced, __ATOMIC_RELAXED)){
+        __atomic_store_n(&node->referenced, true, __ATOMIC_RELAXED);
+    }
+}
 
-                return returnval;
+/*
+ * @return The index of the entry MAP_EVICT_CLOCK evicts from a probe array
+ *         that is not empty. The hand stops there, so the entry shifted back
+ *         into its place is the next one it looks at.
+ */
+static uint32_t clock_victim(hashmap_t *self, map_node_t *nodes, uint32_t capacity) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    uint32_t index = self->hand & (capacity - 1);
+    //ONE SWEEP CLEARS EVERY BIT, SO THE SECOND FINDS AN ENTRY UNLESS READERS KEEP SETTING THEM. THEN TAKE THE NEXT ONE.
+    for(uint32_t swept = 0; swept < capacity * 2; swept++){
+        if(bytes[index] != MAP_EMPTY){
+            if(!__atomic_load_n(&nodes[index].referenced, __ATOMIC_RELAXED)){
+                break;
             }
+            __atomic_store_n(&nodes[index].referenced, false, __ATOMIC_RELAXED);
         }
-        //EMPTY NODE IN THE ARRAY. ONCE REACH EMPTY NODE, ASSUME THAT THE KEY DOESNT EXIST.
-        if(self->nodes[index].key.key_base == 0 && self->nodes[index].key.key_len == 0 && self->nodes[index].tombstone == 0){
-            //IF KEY IS NOT FOUND IN THE MAP, RETURN THIS.
-            debug("KEY VALUE PAIR NOT FOUND. DOES NOT EXIST BECAUSE EMPTY NODE FOUND.");
-            pthread_mutex_lock(&self->fields_lock);
-            self->num_readers = (self->num_readers) - 1;
-            if(self->num_readers == 0){
-                pthread_mutex_unlock(&self->write_lock);
-            }
-            pthread_mutex_unlock(&self->fields_lock);
+        index = (index + 1) & (capacity - 1);
+    }
+    index = next_entry(nodes, capacity, index);
+    self->hand = index;
+    return index;
+}
 
-            return MAP_VAL(NULL, 0);
+/*
+ * @return The index of the entry MAP_EVICT_SAMPLE evicts from a probe array
+ *         that is not empty.
+ */
+static uint32_t sample_victim(hashmap_t *self, map_node_t *nodes, uint32_t capacity) {
+    uint32_t index = capacity;
+    uint32_t sampled[MAP_EVICT_SAMPLES];
+    for(int sample = 0; sample < MAP_EVICT_SAMPLES; sample++){
+        //XORSHIFT64*. THE HIGH BITS ARE THE BEST MIXED.
+        self->rng ^= self->rng >> 12;
+        self->rng ^= self->rng << 25;
+        self->rng ^= self->rng >> 27;
+        uint32_t random = (self->rng * 0x2545F4914F6CDD1DULL) >> 32;
+        index = next_entry(nodes, capacity, random & (capacity - 1));
+        //AN ENTRY SAMPLED AGAIN HAD ITS BIT CLEARED BY THIS SAME EVICTION. IT HAS NOT USED UP ITS SECOND CHANCE YET.
+        bool repeated = false;
+        for(int earlier = 0; earlier < sample; earlier++){
+            repeated |= sampled[earlier] == index;
         }
-        else{
-            index = (index + 1) % self->capacity;
-            total_count++;
+        sampled[sample] = index;
+        if(repeated){
+            continue;
+        }
+        if(!__atomic_load_n(&nodes[index].referenced, __ATOMIC_RELAXED)){
+            break;
+        }
+        __atomic_store_n(&nodes[index].referenced, false, __ATOMIC_RELAXED);
+    }
+    return index;
+}
+
+/*
+ * Evicts an entry to make room for one with the given hash, picked as the
+ * map's map_evict_t says. While the map is resizing, the entries not yet
+ * moved are evicted first, so eviction never has to wait for the whole move.
+ * The map must not be empty. Called after writer_enter().
+ */
+static void evict_locked(hashmap_t *self, uint32_t hash) {
+    map_node_t *nodes = self->nodes;
+    uint32_t capacity = self->capacity;
+    if(self->old_nodes != NULL
+        && next_entry(self->old_nodes, self->old_capacity, hash & (self->old_capacity - 1)) != self->old_capacity){
+        nodes = self->old_nodes;
+        capacity = self->old_capacity;
+    }
+    uint32_t index;
+    switch(self->eviction){
+        case MAP_EVICT_CLOCK:
+            index = clock_victim(self, nodes, capacity);
+            break;
+        case MAP_EVICT_SAMPLE:
+            index = sample_victim(self, nodes, capacity);
+            break;
+        default:
+            index = next_entry(nodes, capacity, hash & (capacity - 1));
+            break;
+    }
+    map_node_t *node = &nodes[index];
+    retire_locked(self, node->key, node->val);
+    unlink_locked(self, node);
+}
+
+/*
+ * put() after writer_enter().
+ */
+static bool put_locked(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    uint64_t cost = entry_cost(self, key, val);
+    //IF MAP IS FULL AND FORCE IS FALSE
+    if((full_locked(self) || over_budget(self, cost)) && force == 0){
+        errno = ENOMEM;
+        return false;
+    }
+    //AN ENTRY TOO BIG FOR THE MAP EVEN ONCE EVERYTHING ELSE IS EVICTED IS TURNED AWAY BEFORE ANYTHING IS.
+    if(self->max_bytes != 0 && cost > self->max_bytes - arrays_bytes(self)){
+        errno = ENOMEM;
+        return false;
+    }
+
+    migrate_locked(self, MAP_MIGRATE_SLOTS);
+    uint32_t hash = self->hash_function(key);
+    //FIRST FIND IF THERE IS A NODE WITH THE SAME KEY. IF THERE IS ONE, REPLACE THAT NODE'S VALUE.
+    map_node_t *node = find_locked(self, key, hash);
+    if(node != NULL){
+        uint64_t old_cost = entry_cost(self, node->key, node->val);
+        if(!over_budget(self, cost - old_cost)){
+            debug("There exists a same key. Destroy the node and replace key and value.");
+            //RETIRE THE OLD KEY AND VAL. destroy_function() RUNS ON THEM ONCE NO READER CAN SEE THEM, AND DOES NOT FREE THE NODE.
+            retire_locked(self, node->key, node->val);
+            node->key = key;
+            node->val = val;
+            node->referenced = true;
+            self->bytes += cost - old_cost;
+            return true;
         }
+        //THE NEW VALUE DOES NOT FIT IN PLACE OF THE OLD ONE. TAKE THE OLD ONE OUT AND MAKE ROOM AS FOR A NEW KEY.
+        retire_locked(self, node->key, node->val);
+        unlink_locked(self, node);
     }
-    debug("KEY VALUE PAIR NOT FOUND. ENTIRE MAP SEARCHED.");
 
-    //IF KEY IS NOT FOUND IN THE ARRAY AND ITS BEEN COMPLETELY SEARCHED.
-    pthread_mutex_lock(&self->fields_lock);
-    self->num_readers = (self->num_readers) - 1;
-    if(self->num_readers == 0){
-        pthread_mutex_unlock(&self->write_lock);
+    //IF THE MAP IS FULL, OR THE ENTRY DOES NOT FIT IN ITS MEMORY, AND FORCE IS TRUE, EVICT TO MAKE ROOM.
+    while(full_locked(self) || over_budget(self, cost)){
+        debug("There is no same key in the full hashmap. Evict the entry at the hashed index");
+        evict_locked(self, hash);
+    }
+    insert_in(self->nodes, self->capacity, &self->max_dist, key, val, hash);
+    self->size = (self->size) + 1;
+    self->bytes += cost;
+
+    if(self->old_nodes == NULL && self->capacity < self->max_capacity
+        && (uint64_t) self->size * 100 >= (uint64_t) self->capacity * MAP_MAX_LOAD
+        && !over_budget(self, nodes_bytes(self->capacity * 2))){
+        grow_locked(self);
     }
-    pthread_mutex_unlock(&self->fields_lock);
+    return true;
+}
 
-    return MAP_VAL(NULL, 0);
+bool set_max_memory(hashmap_t *self, uint64_t max_bytes, cost_f cost_function) {
+    if(self == NULL || self->invalid){
+        errno = EINVAL;
+        return false;
+    }
+
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    for(uint32_t i = 0; i < count; i++){
+        writer_enter(&shards[i]);
+    }
+    //ENTRIES ALREADY IN THE MAP WERE NOT COUNTED BY cost_function.
+    bool result = self->size == 0;
+    for(uint32_t i = 0; i < count && max_bytes != 0; i++){
+        result &= shards[i].bytes <= max_bytes / count;
+    }
+    if(result){
+        for(uint32_t i = 0; i < count; i++){
+            shards[i].max_bytes = max_bytes / count;
+            shards[i].cost_function = cost_function;
+        }
+        self->max_bytes = max_bytes;
+        self->cost_function = cost_function;
+    }
+    for(uint32_t i = count; i > 0; i--){
+        writer_exit(&shards[i - 1]);
+    }
+    if(!result){
+        errno = EINVAL;
+    }
+    return result;
 }
 
-map_node_t delete(hashmap_t *self, map_key_t key) {
+bool set_eviction(hashmap_t *self, map_evict_t eviction) {
+    if(self == NULL || self->invalid || eviction > MAP_EVICT_SAMPLE){
+        errno = EINVAL;
+        return false;
+    }
 
-    pthread_mutex_lock(&self->write_lock);
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    for(uint32_t i = 0; i < count; i++){
+        writer_enter(&shards[i]);
+        shards[i].eviction = eviction;
+        writer_exit(&shards[i]);
+    }
+    self->eviction = eviction;
+    return true;
+}
 
-    uint32_t index = get_index(self, key);
+bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    //IF ANY PARAMETERS INVALID
+    if(self == NULL || self->invalid || key.key_base == NULL || val.val_base == NULL){
+        errno = EINVAL;
+        return false;
+    }
 
-    //CHECK IF IMMEDIATE INDEX CONTAINS THE KEY
-    if(key.key_len == self->nodes[index].key.key_len){
-        //IF THEY ARE THE SAME KEY, SIMPLY REPLACE THE VALUE FOR THAT KEY.
-        if(memcmp(key.key_base, self->nodes[index].key.key_base, key.key_len) == 0){
-            //REMOVE THE NODE
-            map_node_t returnNode = MAP_NODE(key, self->nodes[index].val, self->nodes[index].tombstone);
-            self->nodes[index].key.key_base = 0;
-            self->nodes[index].key.key_len = 0;
-            self->nodes[index].val.val_base = 0;
-            self->nodes[index].val.val_len = 0;
-            self->nodes[index].tombstone = 1;
-            self->size = (self->size) - 1;
+    debug("Put function force value: %d", force);
 
-            pthread_mutex_unlock(&self->write_lock);
+    //THREAD TAKES THE LOCK. NO OTHER THREAD CAN COME IN WHEN WRITING.
+    hashmap_t *shard = shard_of(self, key);
+    writer_enter(shard);
+    map_usage_t before = usage_of(shard);
+    bool result = put_locked(shard, key, val, force);
+    shard_resized(self, shard, before);
+    writer_exit(shard);
+    return result;
+}
 
-            return returnNode;
+/*
+ * get() after reader_enter().
+ */
+static map_val_t get_locked(hashmap_t *self, map_key_t key) {
+    map_node_t *node = find_locked(self, key, self->hash_function(key));
+    if(node == NULL){
+        debug("KEY VALUE PAIR NOT FOUND.");
+        return MAP_VAL(NULL, 0);
+    }
+    debug("KEY VALUE PAIR FOUND.");
+    mark_referenced(self, node);
+    return node->val;
+}
+
+/*
+ * find_in() without any lock, for use between epoch_enter() and epoch_exit().
+ * Control bytes and nodes are read while writers may be changing them, and
+ * nothing read is acted on until seq shows no writer has been through.
+ *
+ * @param nodes The probe array to search, read while seq was still seq.
+ * @param capacity The size of nodes.
+ * @param max_dist The largest distance of any entry in nodes.
+ * @param hash The hash of the key.
+ * @param seq The even value of self->seq read before the search.
+ * @param val Set to the value found in nodes, or a null value if the key is not there.
+ * @return false if a writer changed the map and the search must be repeated.
+ */
+static bool get_optimistic(hashmap_t *self, map_node_t *nodes, uint32_t capacity, uint32_t max_dist, map_key_t key, uint32_t hash, uint32_t seq, map_val_t *val) {
+    uint8_t *bytes = ctrl_bytes(nodes, capacity);
+    uint8_t ctrl = ctrl_of(hash);
+    uint32_t index = hash & (capacity - 1);
+    for(uint32_t probed = 0; probed <= max_dist; probed += MAP_GROUP){
+        uint32_t match, empty;
+        scan_group(bytes + index, ctrl, &match, &empty);
+        uint32_t window = group_window(max_dist - probed, empty);
+        for(match &= window; match != 0; match &= match - 1){
+            map_node_t *node = &nodes[(index + __builtin_ctz(match)) & (capacity - 1)];
+            void *key_base = __atomic_load_n(&node->key.key_base, __ATOMIC_RELAXED);
+            size_t key_len = __atomic_load_n(&node->key.key_len, __ATOMIC_RELAXED);
+            uint32_t node_hash = __atomic_load_n(&node->hash, __ATOMIC_RELAXED);
+            map_val_t found = MAP_VAL(__atomic_load_n(&node->val.val_base, __ATOMIC_RELAXED),
+                __atomic_load_n(&node->val.val_len, __ATOMIC_RELAXED));
+            uint8_t key_inline[MAP_INLINE_KEY];
+            memcpy(key_inline, node->key_inline, MAP_INLINE_KEY);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&self->seq, __ATOMIC_RELAXED) != seq){
+                return false;
+            }
+            //THE TAIL OF A LONG KEY CAN BE COMPARED EVEN IF IT WAS RETIRED SINCE. IT IS NOT DESTROYED BEFORE epoch_exit().
+            if(key_base != NULL && node_hash == hash && key_equals(key, key_inline, key_base, key_len)){
+                *val = found;
+                mark_referenced(self, node);
+                return true;
+            }
         }
+        //AN EMPTY NODE, OR THE LONGEST PROBE IN THE ARRAY, ENDS THE SEARCH.
+        if(window != (1u << MAP_GROUP) - 1){
+            break;
+        }
+        index = (index + MAP_GROUP) & (capacity - 1);
+    }
+    //THE CONTROL BYTES THAT ENDED THE SEARCH MUST NOT HAVE BEEN CHANGING EITHER.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&self->seq, __ATOMIC_RELAXED) != seq){
+        return false;
     }
+    *val = MAP_VAL(NULL, 0);
+    return true;
+}
 
-    //IMMEDIATE INDEX DOES NOT CONTAIN THE KEY, SO LOOP THROUGH THE REST OF THE HASH MAP TO FIND IT.
-    int total_count = 0;
-    while(total_count < self->capacity){
-        if(self->nodes[index].tombstone == 1){
-            index = (index + 1) % self->capacity;
-            total_count++;
+/*
+ * Looks a key up without any lock, for use between epoch_enter() and epoch_exit().
+ *
+ * @param val Set to the value get_locked() would return.
+ * @return false if writers kept changing the map and the read lock is needed.
+ */
+static bool get_lockless(hashmap_t *self, map_key_t key, map_val_t *val) {
+    uint32_t hash = self->hash_function(key);
+    for(int tries = 0; tries < MAP_OPTIMISTIC_TRIES; tries++){
+        uint32_t seq = __atomic_load_n(&self->seq, __ATOMIC_ACQUIRE);
+        if((seq & 1) != 0){
+            continue;
         }
-        if(key.key_len == self->nodes[index].key.key_len){
-            if(memcmp(key.key_base, self->nodes[index].key.key_base, key.key_len) == 0){
-                //REMOVE THE NODE
-                map_node_t returnNode = MAP_NODE(key, self->nodes[index].val, self->nodes[index].tombstone);
-                self->nodes[index].key.key_base = 0;
-                self->nodes[index].key.key_len = 0;
-                self->nodes[index].val.val_base = 0;
-                self->nodes[index].val.val_len = 0;
-                self->nodes[index].tombstone = 1;
-                self->size = (self->size) - 1;
+        map_node_t *nodes = __atomic_load_n(&self->nodes, __ATOMIC_RELAXED);
+        uint32_t capacity = __atomic_load_n(&self->capacity, __ATOMIC_RELAXED);
+        uint32_t max_dist = __atomic_load_n(&self->max_dist, __ATOMIC_RELAXED);
+        map_node_t *old_nodes = __atomic_load_n(&self->old_nodes, __ATOMIC_RELAXED);
+        uint32_t old_capacity = __atomic_load_n(&self->old_capacity, __ATOMIC_RELAXED);
+        uint32_t old_max_dist = __atomic_load_n(&self->old_max_dist, __ATOMIC_RELAXED);
+        //AN ARRAY AND A CAPACITY FROM EITHER SIDE OF A RESIZE COULD INDEX PAST THE END OF THE ARRAY.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&self->seq, __ATOMIC_RELAXED) != seq){
+            continue;
+        }
+        if(!get_optimistic(self, nodes, capacity, max_dist, key, hash, seq, val)){
+            continue;
+        }
+        //WHILE THE MAP IS RESIZING, KEYS NOT MOVED YET ARE STILL IN THE OLD ARRAY.
+        if(val->val_base != NULL || old_nodes == NULL
+            || get_optimistic(self, old_nodes, old_capacity, old_max_dist, key, hash, seq, val)){
+            return true;
+        }
+    }
+    return false;
+}
 
-                pthread_mutex_unlock(&self->write_lock);
+map_val_t get(hashmap_t *self, map_key_t key) {
+    return get_pinned(self, key, NULL);
+}
 
-                return returnNode;
-            }
-        }
-        //EMPTY NODE IN THE ARRAY. ONCE REACH EMPTY NODE, ASSUME THAT THE KEY DOESNT EXIST.
-        if(self->nodes[index].key.key_base == 0 && self->nodes[index].key.key_len == 0 && self->nodes[index].tombstone == 0){
-            //IF KEY IS NOT FOUND.
+map_val_t get_pinned(hashmap_t *self, map_key_t key, pin_f pin) {
+    //ONCE A NODE IS REACHED THAT IS EMPTY, OR HOLDS AN ENTRY CLOSER TO ITS HOME THAN THE KEY
+    //WOULD BE, AND KEY HAS YET TO BE FOUND, THE KEY VALUE PAIR DOES NOT EXIST.
 
-            pthread_mutex_unlock(&self->write_lock);
+    if(self == NULL || self->invalid){
+        errno = EINVAL;
+        return MAP_VAL(NULL, 0);
+    }
 
-            return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
-        }
-        else{
-            index = (index + 1) % self->capacity;
-            total_count++;
+    hashmap_t *shard = shard_of(self, key);
+    map_val_t result;
+    epoch_enter();
+    //invalidate_map() WAITS FOR READERS THAT COULD HAVE MISSED invalid BEFORE IT FREES nodes.
+    if(!__atomic_load_n(&self->invalid, __ATOMIC_SEQ_CST) && get_lockless(shard, key, &result)){
+        //THE VALUE IS NOT DESTROYED BEFORE epoch_exit(), SO IT CAN STILL BE PINNED.
+        if(pin != NULL && result.val_base != NULL){
+            pin(result);
         }
+        epoch_exit();
+        return result;
+    }
+    epoch_exit();
+    if(self->invalid){
+        errno = EINVAL;
+        return MAP_VAL(NULL, 0);
     }
 
-    //KEY IS NOT FOUND AFTER SEARCHING ENTIRE ARRAY
+    //WRITERS KEPT GETTING IN THE WAY. QUEUE UP BEHIND THEM FOR THE READ LOCK.
+    int *reader = reader_enter(shard);
+    result = get_locked(shard, key);
+    //WRITERS ARE SHUT OUT UNTIL reader_exit(), SO THE VALUE CAN NOT BE DESTROYED BEFORE IT IS PINNED.
+    if(pin != NULL && result.val_base != NULL){
+        pin(result);
+    }
+    reader_exit(shard, reader);
+    return result;
+}
 
-    pthread_mutex_unlock(&self->write_lock);
+/*
+ * delete() after writer_enter().
+ */
+static map_node_t delete_locked(hashmap_t *self, map_key_t key) {
+    migrate_locked(self, MAP_MIGRATE_SLOTS);
+    map_node_t *node = find_locked(self, key, self->hash_function(key));
+    //IF KEY IS NOT FOUND.
+    if(node == NULL){
+        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
 
-    return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    //REMOVE THE NODE. THE ENTRIES AFTER IT MOVE BACK, SO NO TOMBSTONE IS LEFT FOR LATER SEARCHES TO WALK THROUGH.
+    map_node_t returnNode = MAP_NODE(key, node->val, false);
+    unlink_locked(self, node);
+    return returnNode;
 }
 
-bool clear_map(hashmap_t *self) {
+map_node_t delete(hashmap_t *self, map_key_t key) {
 
-    if(self == NULL){
+    hashmap_t *shard = shard_of(self, key);
+    writer_enter(shard);
+    map_usage_t before = usage_of(shard);
+    map_node_t result = delete_locked(shard, key);
+    shard_resized(self, shard, before);
+    writer_exit(shard);
+    //THE CALLER FREES WHAT WAS REMOVED. LET LOCK-FREE READERS THAT MAY HAVE FOUND IT FINISH FIRST.
+    if(result.val.val_base != NULL){
+        epoch_synchronize();
+    }
+    return result;
+}
+
+/*
+ * discard() after writer_enter().
+ */
+static bool discard_locked(hashmap_t *self, map_key_t key) {
+    migrate_locked(self, MAP_MIGRATE_SLOTS);
+    map_node_t *node = find_locked(self, key, self->hash_function(key));
+    if(node == NULL){
+        return false;
+    }
+    //destroy_function() RUNS ON THE ENTRY ONCE NO LOCK-FREE READER CAN SEE IT, SO NOTHING WAITS FOR THEM HERE.
+    retire_locked(self, node->key, node->val);
+    unlink_locked(self, node);
+    return true;
+}
+
+bool discard(hashmap_t *self, map_key_t key) {
+    if(self == NULL || self->invalid || key.key_base == NULL){
         errno = EINVAL;
         return false;
     }
 
-    pthread_mutex_lock(&self->write_lock);
+    hashmap_t *shard = shard_of(self, key);
+    writer_enter(shard);
+    map_usage_t before = usage_of(shard);
+    bool result = discard_locked(shard, key);
+    shard_resized(self, shard, before);
+    writer_exit(shard);
+    return result;
+}
+
+size_t put_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, bool force, bool *results) {
+    if(self == NULL || self->invalid || keys == NULL || vals == NULL){
+        //CALLERS READ EVERY RESULT, SO THE ONES OF A BATCH THAT WAS NOT TAKEN ARE false.
+        for(size_t i = 0; results != NULL && i < count; i++){
+            results[i] = false;
+        }
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t inserted = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        bool result = put(self, keys[i], vals[i], force);
+        if(results != NULL){
+            results[i] = result;
+        }
+        inserted += result;
+    }
+    //ONE TRIP THROUGH THE WRITE LOCK OF EACH SHARD FOR ALL OF ITS KEYS IN THE BATCH.
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        writer_enter(shard);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            bool result = keys[i].key_base != NULL && vals[i].val_base != NULL
+                && put_locked(shard, keys[i], vals[i], force);
+            if(results != NULL){
+                results[i] = result;
+            }
+            inserted += result;
+        }
+        shard_resized(self, shard, before);
+        writer_exit(shard);
+    }
+    free(order);
+    return inserted;
+}
+
+size_t get_multi(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count) {
+    return get_multi_pinned(self, keys, vals, count, NULL);
+}
+
+size_t get_multi_pinned(hashmap_t *self, map_key_t *keys, map_val_t *vals, size_t count, pin_f pin) {
+    if(self == NULL || self->invalid || keys == NULL || vals == NULL){
+        //CALLERS READ EVERY VALUE, SO THOSE OF A BATCH THAT WAS NOT TAKEN ARE NOT FOUND.
+        for(size_t i = 0; vals != NULL && i < count; i++){
+            vals[i] = MAP_VAL(NULL, 0);
+        }
+        errno = EINVAL;
+        return 0;
+    }
+
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t found = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        vals[i] = get_pinned(self, keys[i], pin);
+        found += vals[i].val_base != NULL;
+    }
+    //ENTER EACH SHARD ONCE FOR ALL OF ITS KEYS, NOT ONCE PER KEY.
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        size_t j = runs[r].start;
+        epoch_enter();
+        if(!__atomic_load_n(&self->invalid, __ATOMIC_SEQ_CST)){
+            for(; j < runs[r].end; j++){
+                size_t i = order != NULL ? order[j] : j;
+                if(!get_lockless(shard, keys[i], &vals[i])){
+                    break;
+                }
+                if(vals[i].val_base != NULL){
+                    if(pin != NULL){
+                        pin(vals[i]);
+                    }
+                    found++;
+                }
+            }
+        }
+        epoch_exit();
+        if(j == runs[r].end){
+            continue;
+        }
+
+        //THE REST OF THE SHARD'S KEYS ARE LOOKED UP UNDER THE READ LOCK.
+        int *reader = reader_enter(shard);
+        for(; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            vals[i] = get_locked(shard, keys[i]);
+            if(vals[i].val_base != NULL){
+                if(pin != NULL){
+                    pin(vals[i]);
+                }
+                found++;
+            }
+        }
+        reader_exit(shard, reader);
+    }
+    free(order);
+    return found;
+}
 
-    int index = 0;
-    int total_count = 0;
+size_t delete_multi(hashmap_t *self, map_key_t *keys, map_node_t *nodes, size_t count) {
+    if(self == NULL || self->invalid || keys == NULL){
+        //CALLERS READ EVERY NODE, SO THOSE OF A BATCH THAT WAS NOT TAKEN ARE EMPTY.
+        for(size_t i = 0; nodes != NULL && i < count; i++){
+            nodes[i] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+        }
+        errno = EINVAL;
+        return 0;
+    }
 
-    //WHEN CAN OPERATION FAIL?????
-    while(total_count < self->capacity){
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t removed = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        map_node_t node = delete(self, keys[i]);
+        if(nodes != NULL){
+            nodes[i] = node;
+        }
+        removed += node.val.val_base != NULL;
+    }
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        writer_enter(shard);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            map_node_t node = delete_locked(shard, keys[i]);
+            if(nodes != NULL){
+                nodes[i] = node;
+            }
+            removed += node.val.val_base != NULL;
+        }
+        shard_resized(self, shard, before);
+        writer_exit(shard);
+    }
+    free(order);
+    if(removed > 0){
+        epoch_synchronize();
+    }
+    return removed;
+}
 
-        if((self->nodes[index].key.key_base != 0 && self->nodes[index].key.key_len != 0
-            && self->nodes[index].val.val_base != 0 && self->nodes[index].val.val_len != 0)
-            || self->nodes[index].tombstone == 1){
+size_t discard_multi(hashmap_t *self, map_key_t *keys, size_t count) {
+    if(self == NULL || self->invalid || keys == NULL){
+        errno = EINVAL;
+        return 0;
+    }
 
-            self->nodes[index].key.key_base = 0;
-            self->nodes[index].key.key_len = 0;
-            self->nodes[index].val.val_base = 0;
-            self->nodes[index].val.val_len = 0;
-            self->nodes[index].tombstone = 0;
-            self->destroy_function(MAP_KEY(self->nodes[index].key.key_base, self->nodes[index].key.key_len), MAP_VAL(self->nodes[index].val.val_base, self->nodes[index].val.val_len));
+    map_run_t runs[MAP_MAX_SHARDS];
+    size_t *order;
+    size_t nruns = split_batch(self, keys, count, &order, runs);
+    size_t removed = 0;
+    //NO MEMORY TO GROUP THE KEYS BY SHARD. EACH KEY TAKES ITS OWN TRIP THROUGH THE LOCK INSTEAD.
+    for(size_t i = 0; nruns == 0 && i < count; i++){
+        removed += discard(self, keys[i]);
+    }
+    for(size_t r = 0; r < nruns; r++){
+        hashmap_t *shard = runs[r].shard;
+        writer_enter(shard);
+        map_usage_t before = usage_of(shard);
+        for(size_t j = runs[r].start; j < runs[r].end; j++){
+            size_t i = order != NULL ? order[j] : j;
+            removed += discard_locked(shard, keys[i]);
         }
+        shard_resized(self, shard, before);
+        writer_exit(shard);
+    }
+    free(order);
+    return removed;
+}
 
-        index = (index + 1) % self->capacity;
-        total_count++;
+/*
+ * Retires every entry of a map and empties its probe array. Called after
+ * writer_enter().
+ */
+static void wipe_locked(hashmap_t *self) {
+    for(uint32_t index = 0; index < self->capacity; index++){
+        //A LIVE ENTRY IS RETIRED BEFORE THE NODE IS WIPED.
+        if(self->nodes[index].key.key_base != NULL){
+            retire_locked(self, self->nodes[index].key, self->nodes[index].val);
+            self->nodes[index] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+            set_ctrl(self->nodes, self->capacity, index, MAP_EMPTY);
+        }
+    }
+    //THE RESIZE CARRIES ON OVER THE EMPTIED OLD ARRAY.
+    for(uint32_t index = 0; index < self->old_capacity; index++){
+        if(self->old_nodes[index].key.key_base != NULL){
+            retire_locked(self, self->old_nodes[index].key, self->old_nodes[index].val);
+            self->old_nodes[index] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+            set_ctrl(self->old_nodes, self->old_capacity, index, MAP_EMPTY);
+        }
     }
 
     self->size = 0;
+    self->bytes = arrays_bytes(self);
+    self->max_dist = 0;
+    self->old_max_dist = 0;
+}
 
-    pthread_mutex_unlock(&self->write_lock);
-    return true;
+/*
+ * Sums what the shards of a map take into the map itself, once they have
+ * all been changed at once. Called after writer_enter() on every shard.
+ */
+static void sum_shards_locked(hashmap_t *self) {
+    if(self->shards == NULL){
+        return;
+    }
+    uint64_t bytes = 0;
+    for(uint32_t i = 0; i < self->num_shards; i++){
+        bytes += self->shards[i].bytes;
+    }
+    __atomic_store_n(&self->bytes, bytes, __ATOMIC_RELAXED);
 }
 
-bool invalidate_map(hashmap_t *self) {
+bool clear_map(hashmap_t *self) {
 
     if(self == NULL){
         errno = EINVAL;
         return false;
     }
 
-    pthread_mutex_lock(&self->write_lock);
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    //EVERY SHARD IS LOCKED, ALWAYS IN THE SAME ORDER, SO THE WHOLE MAP IS CLEARED AT ONCE AND TWO CLEARS CAN NOT DEADLOCK.
+    for(uint32_t i = 0; i < count; i++){
+        writer_enter(&shards[i]);
+    }
+    for(uint32_t i = 0; i < count; i++){
+        wipe_locked(&shards[i]);
+    }
+    __atomic_store_n(&self->size, 0, __ATOMIC_RELAXED);
+    sum_shards_locked(self);
+    for(uint32_t i = count; i > 0; i--){
+        writer_exit(&shards[i - 1]);
+    }
+    return true;
+}
 
-    int index = 0;
-    int total_count = 0;
+bool invalidate_map(hashmap_t *self) {
 
-    //WHEN CAN OPERATION FAIL?????
-    while(total_count < self->capacity){
+    if(self == NULL){
+        errno = EINVAL;
+        return false;
+    }
 
-        if((self->nodes[index].key.key_base != 0 && self->nodes[index].key.key_len != 0
-            && self->nodes[index].val.val_base != 0 && self->nodes[index].val.val_len != 0)
-            || self->nodes[index].tombstone == 1){
+    uint32_t count;
+    hashmap_t *shards = shards_of(self, &count);
+    for(uint32_t i = 0; i < count; i++){
+        writer_enter(&shards[i]);
+    }
+    for(uint32_t i = 0; i < count; i++){
+        wipe_locked(&shards[i]);
+        shards[i].invalid = true;
+    }
+    __atomic_store_n(&self->size, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->invalid, true, __ATOMIC_SEQ_CST);
+    for(uint32_t i = count; i > 0; i--){
+        writer_exit(&shards[i - 1]);
+    }
 
-            self->nodes[index].key.key_base = 0;
-            self->nodes[index].key.key_len = 0;
-            self->nodes[index].val.val_base = 0;
-            self->nodes[index].val.val_len = 0;
-            self->nodes[index].tombstone = 0;
-            self->destroy_function(MAP_KEY(self->nodes[index].key.key_base, self->nodes[index].key.key_len), MAP_VAL(self->nodes[index].val.val_base, self->nodes[index].val.val_len));
+    //ONCE EVERY LOCK-FREE READER THAT MISSED invalid IS DONE, NOTHING CAN SEE THE NODES OR WHAT WAS IN THEM.
+    epoch_synchronize();
+    for(uint32_t i = 0; i < count; i++){
+        for(uint32_t n = 0; n < shards[i].num_retired; n++){
+            map_retired_t *retired = &shards[i].retired[(shards[i].retired_head + n) & (shards[i].retired_cap - 1)];
+            shards[i].destroy_function(retired->key, retired->val);
         }
-
-        index = (index + 1) % self->capacity;
-        total_count++;
+        free(shards[i].retired);
+        shards[i].retired = NULL;
+        shards[i].retired_head = shards[i].num_retired = shards[i].retired_cap = 0;
+        free(shards[i].nodes);
+        free(shards[i].old_nodes);
+        free(shards[i].freed_nodes);
+        shards[i].old_nodes = shards[i].freed_nodes = NULL;
     }
-
-    self->size = 0;
-
-    free(self->nodes);
-    self->invalid = true;
-
-    pthread_mutex_unlock(&self->write_lock);
     return true;
 }
+
+#endif
@@ -0,0 +1,66 @@
+#include "item.h"
+#include "slab.h"
+
+#include <errno.h>
+#include <stddef.h>
+
+/*
+ * @return The number of bytes an item with the given key and value takes.
+ */
+static inline size_t item_size(uint32_t key_len, uint32_t val_len) {
+    return sizeof(item_t) + (size_t) val_len + key_len;
+}
+
+item_t *create_item(uint32_t key_len, uint32_t val_len) {
+    item_t *item = slab_alloc(item_size(key_len, val_len));
+    if(item == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+    item->refcount = 1;
+    item->key_len = key_len;
+    item->val_len = val_len;
+    return item;
+}
+
+map_key_t item_key(item_t *self) {
+    return MAP_KEY(self->data + self->val_len, self->key_len);
+}
+
+map_val_t item_val(item_t *self) {
+    return MAP_VAL(self->data, self->val_len);
+}
+
+item_t *item_of(map_val_t val) {
+    if(val.val_base == NULL){
+        return NULL;
+    }
+    //THE VALUE IS THE FIRST THING AFTER THE HEADER.
+    return (item_t *) ((char *) val.val_base - offsetof(item_t, data));
+}
+
+void item_retain(item_t *self) {
+    __atomic_add_fetch(&self->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void item_release(item_t *self) {
+    if(self == NULL){
+        return;
+    }
+    //THE THREAD THAT DROPS THE LAST REFERENCE MUST SEE EVERY OTHER HOLDER'S ACCESSES AS FINISHED.
+    if(__atomic_sub_fetch(&self->refcount, 1, __ATOMIC_ACQ_REL) == 0){
+        slab_free(self, item_size(self->key_len, self->val_len));
+    }
+}
+
+void item_destroy(map_key_t key, map_val_t val) {
+    item_release(item_of(val));
+}
+
+void item_pin(map_val_t val) {
+    item_retain(item_of(val));
+}
+
+size_t item_cost(map_key_t key, map_val_t val) {
+    return slab_chunk_size(item_size(key.key_len, val.val_len));
+}
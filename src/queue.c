@@ -75,7 +75,7 @@ void *dequeue(queue_t *self){
         errno = EINVAL;
         return NULL;
     }
-    void *temp_item;
+    void *temp_item = NULL;
 
     //DECREMENT / P() SEMAPHORE ITEM COUNT.
     //IF THERE IS NO ITEMS, I.E: THE SEMAPHORE IS 0, THE THREAD WILL BE BLOCKED UNTIL ANOTHER THREAD
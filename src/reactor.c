@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Every connection is registered EPOLLONESHOT, so exactly one thread owns it
+ * at a time: the event loop while it reads, a worker while it executes.
+ * Whoever owns it last re-arms it, and EPOLL_CTL_MOD re-checks readiness so
+ * bytes that arrived in between still produce an event.
+ */
+static void rearm(reactor_t *self, conn_t *conn) {
+    struct epoll_event event;
+    //WHILE OUTPUT IS BACKED UP, STOP READING SO A CLIENT THAT PIPELINES WITHOUT READING CAN NOT GROW OUR BUFFERS.
+    event.events = (conn_pending(conn) ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    event.data.ptr = conn;
+    if(epoll_ctl(self->epfd, EPOLL_CTL_MOD, conn->fd, &event) < 0){
+        destroy_conn(conn);
+    }
+}
+
+/*
+ * Executes buffered requests, sends what it can and either re-arms or
+ * destroys the connection.
+ */
+static void serve(reactor_t *self, conn_t *conn) {
+    int flushed;
+    //conn_process() STOPS AT THE OUTPUT HIGH-WATER MARK. KEEP GOING AS LONG AS THE SOCKET TAKES THE RESPONSES.
+    do{
+        conn_process(conn, self->map);
+        flushed = conn_flush(conn);
+    } while(flushed == 0 && !conn->closing && conn_has_frame(conn));
+
+    if(flushed < 0 || conn_done(conn)){
+        destroy_conn(conn);
+        return;
+    }
+    rearm(self, conn);
+}
+
+static void accept_all(reactor_t *self, int listenfd) {
+    while(1){
+        int connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if(connfd < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            //EAGAIN MEANS THE BACKLOG IS DRAINED. ANYTHING ELSE (EMFILE...) IS RETRIED ON THE NEXT EDGE.
+            return;
+        }
+
+        conn_t *conn = create_conn(connfd, self->keepalive, NULL);
+        if(conn == NULL){
+            close(connfd);
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+        event.data.ptr = conn;
+        if(epoll_ctl(self->epfd, EPOLL_CTL_ADD, connfd, &event) < 0){
+            destroy_conn(conn);
+            continue;
+        }
+        debug("Accepted connection %d", connfd);
+    }
+}
+
+static void on_ready(reactor_t *self, conn_t *conn, uint32_t events) {
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        if(conn_fill(conn) < 0){
+            destroy_conn(conn);
+            return;
+        }
+    }
+    //ONLY CONNECTIONS WITH A COMPLETE REQUEST COST A QUEUE ROUND TRIP. PARTIAL FRAMES AND PENDING OUTPUT
+    //ARE HANDLED HERE WITHOUT TYING UP A WORKER.
+    if(self->queue != NULL && !conn->closing && conn_has_frame(conn)){
+        enqueue(self->queue, conn);
+        return;
+    }
+    serve(self, conn);
+}
+
+reactor_t *create_reactor(int listenfd, hashmap_t *map, queue_t *queue, bool keepalive) {
+    if(listenfd < 0 || map == NULL){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    reactor_t *reactor = calloc(1, sizeof(reactor_t));
+    if(reactor == NULL){
+        return NULL;
+    }
+    reactor->map = map;
+    reactor->queue = queue;
+    reactor->keepalive = keepalive;
+    if((reactor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+        free(reactor);
+        return NULL;
+    }
+
+    if(!reactor_listen(reactor, listenfd)){
+        close(reactor->epfd);
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+bool reactor_listen(reactor_t *self, int listenfd) {
+    if(self->nlisteners == REACTOR_MAX_LISTENERS){
+        errno = ENOSPC;
+        return false;
+    }
+    int flags = fcntl(listenfd, F_GETFL, 0);
+    if(flags < 0 || fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0){
+        return false;
+    }
+
+    struct epoll_event event;
+    //EPOLLEXCLUSIVE KEEPS A CONNECTION ON A LISTENER SHARED BY SEVERAL REACTORS FROM WAKING ALL OF THEM.
+    event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+    //LISTENERS ARE TAGGED WITH THEIR INDEX + 1. NO CONNECTION POINTER IS THAT SMALL.
+    event.data.u64 = self->nlisteners + 1;
+    if(epoll_ctl(self->epfd, EPOLL_CTL_ADD, listenfd, &event) < 0){
+        return false;
+    }
+    self->listenfds[self->nlisteners++] = listenfd;
+    return true;
+}
+
+void reactor_run(reactor_t *self) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while(1){
+        int ready = epoll_wait(self->epfd, events, REACTOR_MAX_EVENTS, -1);
+        if(ready < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return;
+        }
+        for(int i = 0; i < ready; i++){
+            //THE LISTENING SOCKETS ARE THE ONLY ENTRIES WITHOUT A CONNECTION ATTACHED.
+            if(events[i].data.u64 <= REACTOR_MAX_LISTENERS){
+                accept_all(self, self->listenfds[events[i].data.u64 - 1]);
+            }
+            else{
+                on_ready(self, events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+}
+
+void *reactor_thread(void *vargp) {
+    reactor_run(vargp);
+    return NULL;
+}
+
+void *reactor_worker(void *vargp) {
+    reactor_t *reactor = vargp;
+    while(1){
+        conn_t *conn = dequeue(reactor->queue);
+        if(conn == NULL){
+            continue;
+        }
+        serve(reactor, conn);
+    }
+    return NULL;
+}
@@ -0,0 +1,430 @@
+#include "shm.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert((SHM_RING_SIZE & (SHM_RING_SIZE - 1)) == 0, "ring size must be a power of two");
+
+/* Busy scans of every channel between checks for clients that exited without detaching. */
+#define SHM_REAP_INTERVAL 65536
+
+static int spin_limit() {
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+}
+
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * The futexes live in a MAP_SHARED file, so they must not be FUTEX_PRIVATE.
+ */
+static bool futex_wait(uint32_t *word, uint32_t seen, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, FUTEX_WAIT, seen, timeout, NULL, 0) == 0 || errno != ETIMEDOUT;
+}
+
+/*
+ * Wakes the other side if it went to sleep. A sleeper sets waiting before it
+ * looks at the rings one last time, and a waker has published its ring update
+ * before it looks at waiting, so with the fences in between at least one of
+ * them sees the other and no wakeup is lost.
+ */
+static void notify(uint32_t *wake, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(waiting, __ATOMIC_RELAXED)){
+        __atomic_add_fetch(wake, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+static void ring_copy_in(shm_ring_t *ring, uint64_t position, const char *src, size_t len) {
+    size_t offset = position & (SHM_RING_SIZE - 1);
+    size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, src + first, len - first);
+}
+
+static void ring_copy_out(shm_ring_t *ring, uint64_t position, char *dst, size_t len) {
+    size_t offset = position & (SHM_RING_SIZE - 1);
+    size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+    memcpy(dst, ring->data + offset, first);
+    memcpy(dst + first, ring->data, len - first);
+}
+
+/*
+ * Moves request bytes from the ring into the connection's receive buffer.
+ */
+static size_t pull(conn_t *conn, shm_ring_t *ring) {
+    uint64_t head = ring->head;
+    size_t available = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+    if(available == 0){
+        return 0;
+    }
+    ssize_t room = conn_reserve(conn);
+    if(room <= 0){
+        return 0;
+    }
+    size_t len = available < room ? available : room;
+    ring_copy_out(ring, head, conn->rbuf + conn->rend, len);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    conn_received(conn, len);
+    return len;
+}
+
+/*
+ * Copies as much pending output as fits into the ring and publishes it at once.
+ */
+static size_t push(conn_t *conn, shm_ring_t *ring) {
+    struct iovec iov[CONN_IOV_MAX];
+    uint64_t tail = ring->tail;
+    size_t room = SHM_RING_SIZE - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    size_t pushed = 0;
+    int count = conn_iov(conn, iov, NULL, CONN_IOV_MAX);
+    for(int i = 0; i < count && room > 0; i++){
+        size_t len = iov[i].iov_len < room ? iov[i].iov_len : room;
+        ring_copy_in(ring, tail + pushed, iov[i].iov_base, len);
+        pushed += len;
+        room -= len;
+    }
+    if(pushed > 0){
+        __atomic_store_n(&ring->tail, tail + pushed, __ATOMIC_RELEASE);
+        conn_sent(conn, pushed);
+    }
+    return pushed;
+}
+
+/*
+ * Returns a channel the client let go of to the free list. The rings are
+ * reset before the channel is marked free, and it only becomes claimable
+ * once the owner is cleared after that.
+ */
+static void recycle(shm_t *self, int index) {
+    shm_channel_t *channel = &self->region->channels[index];
+    destroy_conn(self->conns[index]);
+    self->conns[index] = NULL;
+    channel->requests.head = channel->requests.tail = 0;
+    channel->responses.head = channel->responses.tail = 0;
+    channel->client_waiting = 0;
+    __atomic_store_n(&channel->state, SHM_FREE, __ATOMIC_RELEASE);
+    __atomic_store_n(&channel->owner, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Executes the requests waiting on one channel and queues their responses.
+ * Returns whether anything moved through either ring.
+ */
+static bool serve_channel(shm_t *self, int index) {
+    shm_channel_t *channel = &self->region->channels[index];
+    uint32_t state = __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE);
+    if(state == SHM_CLOSING){
+        recycle(self, index);
+        return true;
+    }
+    if(state != SHM_OPEN){
+        return false;
+    }
+
+    conn_t *conn = self->conns[index];
+    if(conn == NULL && (conn = self->conns[index] = create_conn(-1, true, NULL)) == NULL){
+        return false;
+    }
+    //THE SAME LOOP AS A SOCKET: READ, EXECUTE UP TO THE HIGH-WATER MARK, WRITE. A FULL RESPONSE RING PAUSES
+    //THE CHANNEL UNTIL THE CLIENT READS, JUST AS A FULL SOCKET BUFFER WOULD.
+    bool progress = false;
+    bool moved;
+    do{
+        moved = pull(conn, &channel->requests) > 0;
+        conn_process(conn, self->map);
+        moved |= push(conn, &channel->responses) > 0;
+        progress |= moved;
+    } while(moved && !conn->closing);
+
+    //A MALFORMED FRAME ENDS THE CHANNEL ONCE ITS ERROR RESPONSE IS IN THE RING. THE CLIENT STILL HAS TO DETACH.
+    if(conn_done(conn)){
+        destroy_conn(conn);
+        self->conns[index] = NULL;
+        __atomic_compare_exchange_n(&channel->state, &state, SHM_SHUTDOWN, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        progress = true;
+    }
+    if(progress){
+        notify(&channel->client_wake, &channel->client_waiting);
+    }
+    return progress;
+}
+
+/*
+ * Marks the channels of clients that no longer exist as closing.
+ */
+static void reap(shm_t *self) {
+    for(int i = 0; i < self->region->nchannels; i++){
+        shm_channel_t *channel = &self->region->channels[i];
+        uint32_t state = __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE);
+        pid_t owner = __atomic_load_n(&channel->owner, __ATOMIC_RELAXED);
+        if((state == SHM_OPEN || state == SHM_SHUTDOWN) && owner != 0 && kill(owner, 0) < 0 && errno == ESRCH){
+            debug("Reclaiming shared memory channel %d of exited process %d", i, owner);
+            __atomic_compare_exchange_n(&channel->state, &state, SHM_CLOSING, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+shm_t *create_shm(const char *path, int channels, hashmap_t *map) {
+    if(path == NULL || channels <= 0 || map == NULL){
+        errno = EINVAL;
+        return NULL;
+    }
+    shm_t *self = malloc(sizeof(shm_t));
+    conn_t **conns = calloc(channels, sizeof(conn_t *));
+    if(self == NULL || conns == NULL){
+        free(self);
+        free(conns);
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t size = sizeof(shm_region_t) + channels * sizeof(shm_channel_t);
+
+    //CLIENTS STILL MAPPING A PREVIOUS SERVER'S FILE KEEP THEIR OLD COPY INSTEAD OF SEEING THIS ONE BEING SET UP.
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if(fd < 0){
+        free(self);
+        free(conns);
+        return NULL;
+    }
+    void *region = MAP_FAILED;
+    if(ftruncate(fd, size) == 0){
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(region == MAP_FAILED){
+        unlink(path);
+        free(self);
+        free(conns);
+        return NULL;
+    }
+
+    self->region = region;
+    self->size = size;
+    self->map = map;
+    self->conns = conns;
+    self->spin = spin_limit();
+    self->region->version = SHM_VERSION;
+    self->region->nchannels = channels;
+    self->region->ring_size = SHM_RING_SIZE;
+    self->region->server_pid = getpid();
+    __atomic_store_n(&self->region->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return self;
+}
+
+void shm_run(shm_t *self) {
+    shm_region_t *region = self->region;
+    struct timespec timeout = {1, 0};
+    unsigned scans = 0;
+    int idle = 0;
+    while(1){
+        bool progress = false;
+        for(int i = 0; i < region->nchannels; i++){
+            progress |= serve_channel(self, i);
+        }
+        if(++scans % SHM_REAP_INTERVAL == 0){
+            reap(self);
+        }
+        if(progress){
+            idle = 0;
+            continue;
+        }
+        if(++idle < self->spin){
+            cpu_relax();
+            continue;
+        }
+
+        //NOTHING HAS MOVED FOR A WHILE. ANNOUNCE THE SLEEP, LOOK ONE LAST TIME, THEN WAIT FOR A CLIENT TO
+        //BUMP server_wake. THE TIMEOUT BOUNDS HOW LONG AN EXITED CLIENT'S CHANNEL STAYS TAKEN.
+        idle = 0;
+        uint32_t wake = __atomic_load_n(&region->server_wake, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&region->server_waiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for(int i = 0; i < region->nchannels; i++){
+            progress |= serve_channel(self, i);
+        }
+        if(!progress){
+            futex_wait(&region->server_wake, wake, &timeout);
+        }
+        __atomic_store_n(&region->server_waiting, 0, __ATOMIC_RELAXED);
+        if(!progress){
+            reap(self);
+        }
+    }
+}
+
+void *shm_thread(void *vargp) {
+    shm_run(vargp);
+    return NULL;
+}
+
+shm_client_t *shm_attach(const char *path) {
+    shm_client_t *self = malloc(sizeof(shm_client_t));
+    if(self == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+    int fd = open(path, O_RDWR);
+    if(fd < 0){
+        free(self);
+        return NULL;
+    }
+    struct stat st;
+    void *mapped = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size >= sizeof(shm_region_t)){
+        mapped = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(mapped == MAP_FAILED){
+        free(self);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    shm_region_t *region = mapped;
+    self->region = region;
+    self->size = st.st_size;
+    self->channel = NULL;
+    self->spin = spin_limit();
+    if(__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || region->version != SHM_VERSION
+        || region->ring_size != SHM_RING_SIZE
+        || st.st_size < sizeof(shm_region_t) + (size_t) region->nchannels * sizeof(shm_channel_t)){
+        munmap(mapped, st.st_size);
+        free(self);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for(int i = 0; i < region->nchannels; i++){
+        shm_channel_t *channel = &region->channels[i];
+        uint32_t expected = 0;
+        if(__atomic_compare_exchange_n(&channel->owner, &expected, getpid(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            self->channel = channel;
+            __atomic_store_n(&channel->state, SHM_OPEN, __ATOMIC_RELEASE);
+            return self;
+        }
+    }
+    munmap(mapped, st.st_size);
+    free(self);
+    errno = EBUSY;
+    return NULL;
+}
+
+void shm_detach(shm_client_t *self) {
+    if(self == NULL){
+        return;
+    }
+    __atomic_store_n(&self->channel->state, SHM_CLOSING, __ATOMIC_RELEASE);
+    notify(&self->region->server_wake, &self->region->server_waiting);
+    munmap(self->region, self->size);
+    free(self);
+}
+
+/*
+ * Spins, then sleeps, until the server moves position away from seen or stops
+ * serving the channel. May return early; callers check again.
+ */
+static void client_wait(shm_client_t *self, uint64_t *position, uint64_t seen) {
+    shm_channel_t *channel = self->channel;
+    for(int i = 0; i < self->spin; i++){
+        if(__atomic_load_n(position, __ATOMIC_ACQUIRE) != seen
+            || __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE) != SHM_OPEN){
+            return;
+        }
+        cpu_relax();
+    }
+    //A SERVER THAT DIED NEVER WAKES US, SO THE SLEEP IS BOUNDED AND A TIMEOUT CHECKS WHETHER IT IS STILL THERE.
+    struct timespec timeout = {1, 0};
+    uint32_t wake = __atomic_load_n(&channel->client_wake, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&channel->client_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t state = __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE);
+    if(__atomic_load_n(position, __ATOMIC_ACQUIRE) == seen && state == SHM_OPEN
+        && !futex_wait(&channel->client_wake, wake, &timeout)
+        && kill(self->region->server_pid, 0) < 0 && errno == ESRCH){
+        __atomic_compare_exchange_n(&channel->state, &state, SHM_SHUTDOWN, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&channel->client_waiting, 0, __ATOMIC_RELAXED);
+}
+
+ssize_t shm_send(shm_client_t *self, const void *buf, size_t len) {
+    shm_ring_t *ring = &self->channel->requests;
+    const char *bytes = buf;
+    size_t left = len;
+    while(left > 0){
+        if(__atomic_load_n(&self->channel->state, __ATOMIC_ACQUIRE) != SHM_OPEN){
+            errno = ECONNRESET;
+            return -1;
+        }
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t room = SHM_RING_SIZE - (tail - head);
+        if(room == 0){
+            client_wait(self, &ring->head, head);
+            continue;
+        }
+        size_t chunk = left < room ? left : room;
+        ring_copy_in(ring, tail, bytes, chunk);
+        __atomic_store_n(&ring->tail, tail + chunk, __ATOMIC_RELEASE);
+        notify(&self->region->server_wake, &self->region->server_waiting);
+        bytes += chunk;
+        left -= chunk;
+    }
+    return len;
+}
+
+size_t shm_peek(shm_client_t *self, const char **bytes) {
+    shm_ring_t *ring = &self->channel->responses;
+    uint64_t head = ring->head;
+    while(1){
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if(tail == head && __atomic_load_n(&self->channel->state, __ATOMIC_ACQUIRE) != SHM_OPEN){
+            //THE SERVER PUBLISHES ITS LAST RESPONSE BEFORE IT SHUTS THE CHANNEL DOWN.
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            if(tail == head){
+                return 0;
+            }
+        }
+        if(tail != head){
+            size_t offset = head & (SHM_RING_SIZE - 1);
+            size_t available = tail - head;
+            *bytes = ring->data + offset;
+            return available < SHM_RING_SIZE - offset ? available : SHM_RING_SIZE - offset;
+        }
+        client_wait(self, &ring->tail, tail);
+    }
+}
+
+void shm_consume(shm_client_t *self, size_t len) {
+    shm_ring_t *ring = &self->channel->responses;
+    __atomic_store_n(&ring->head, ring->head + len, __ATOMIC_RELEASE);
+    //THE SERVER MAY BE HOLDING RESPONSES BACK UNTIL THERE IS ROOM FOR THEM.
+    notify(&self->region->server_wake, &self->region->server_waiting);
+}
+
+ssize_t shm_recv(shm_client_t *self, void *buf, size_t len) {
+    const char *bytes;
+    size_t available = shm_peek(self, &bytes);
+    if(available == 0){
+        return 0;
+    }
+    size_t copied = available < len ? available : len;
+    memcpy(buf, bytes, copied);
+    shm_consume(self, copied);
+    return copied;
+}
@@ -0,0 +1,104 @@
+#include "sketch.h"
+
+#include <stdlib.h>
+
+/* The most counters in a row. A sketch this wide tells apart more keys than any map holds. */
+#define SKETCH_MAX_WIDTH (1u << 26)
+/* Counters in a 64 bit word. */
+#define SKETCH_PER_WORD 16
+/* Counters in a row per key the sketch tells apart, so few keys share all of theirs. */
+#define SKETCH_ROW_SCALE 4
+/* Increments per key the sketch tells apart before its counters are halved. */
+#define SKETCH_SAMPLE_SCALE 10
+
+/* One odd multiplier per row, so a key's counters in different rows are picked independently. */
+static const uint64_t row_seeds[SKETCH_DEPTH] = {
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL
+};
+
+/*
+ * @return The number of counters in a row of a sketch for entries keys.
+ */
+static uint32_t width_for(uint32_t entries) {
+    uint32_t width = SKETCH_PER_WORD;
+    while(width / SKETCH_ROW_SCALE < entries && width < SKETCH_MAX_WIDTH){
+        width <<= 1;
+    }
+    return width;
+}
+
+size_t sketch_bytes(uint32_t entries) {
+    return (size_t) SKETCH_DEPTH * (width_for(entries) / SKETCH_PER_WORD) * sizeof(uint64_t);
+}
+
+bool sketch_init(sketch_t *self, uint32_t entries) {
+    self->width = width_for(entries);
+    self->table = calloc((size_t) SKETCH_DEPTH * (self->width / SKETCH_PER_WORD), sizeof(uint64_t));
+    self->additions = 0;
+    self->sample_size = self->width / SKETCH_ROW_SCALE * SKETCH_SAMPLE_SCALE;
+    return self->table != NULL;
+}
+
+void sketch_free(sketch_t *self) {
+    free(self->table);
+    self->table = NULL;
+}
+
+/*
+ * @param counter Set to the index of the key's counter within its word.
+ * @return The word holding the counter of a key in a row.
+ */
+static inline uint64_t *word_of(sketch_t *self, uint32_t hash, int row, uint32_t *counter) {
+    //SPREAD THE 32 BIT HASH OVER 64 AND TAKE THE TOP BITS OF THE PRODUCT, THE ONLY ONES EVERY BIT OF IT REACHES.
+    uint64_t spread = ((uint64_t) hash << 32 | hash) ^ 0xFF51AFD7ED558CCDULL;
+    uint32_t index = (uint32_t) ((spread * row_seeds[row]) >> (64 - __builtin_ctz(self->width)));
+    *counter = index % SKETCH_PER_WORD;
+    return &self->table[(size_t) row * (self->width / SKETCH_PER_WORD) + index / SKETCH_PER_WORD];
+}
+
+void sketch_increment(sketch_t *self, uint32_t hash) {
+    bool added = false;
+    for(int row = 0; row < SKETCH_DEPTH; row++){
+        uint32_t counter;
+        uint64_t *word = word_of(self, hash, row, &counter);
+        uint32_t shift = counter * 4;
+        uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+        //A FAILED EXCHANGE RELOADS old. GIVE UP ONCE ANOTHER THREAD HAS TAKEN THE COUNTER TO THE TOP.
+        while(((old >> shift) & 0xF) < SKETCH_MAX_COUNT){
+            if(__atomic_compare_exchange_n(word, &old, old + (1ULL << shift), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                added = true;
+                break;
+            }
+        }
+    }
+    //A KEY WHOSE COUNTERS ARE ALL AT THE TOP ADDS NOTHING, AND BRINGS AGING NO CLOSER.
+    if(added){
+        __atomic_add_fetch(&self->additions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t sketch_estimate(sketch_t *self, uint32_t hash) {
+    uint32_t estimate = SKETCH_MAX_COUNT;
+    for(int row = 0; row < SKETCH_DEPTH; row++){
+        uint32_t counter;
+        uint64_t word = __atomic_load_n(word_of(self, hash, row, &counter), __ATOMIC_RELAXED);
+        uint32_t count = (word >> (counter * 4)) & 0xF;
+        if(count < estimate){
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+bool sketch_age(sketch_t *self) {
+    if(self->additions < self->sample_size){
+        return false;
+    }
+    size_t words = (size_t) SKETCH_DEPTH * (self->width / SKETCH_PER_WORD);
+    for(size_t i = 0; i < words; i++){
+        //EVERY COUNTER SHIFTS RIGHT ONE BIT. THE MASK DROPS WHAT SHIFTED IN FROM THE COUNTER ABOVE IT.
+        self->table[i] = (self->table[i] >> 1) & 0x7777777777777777ULL;
+    }
+    self->additions /= 2;
+    return true;
+}
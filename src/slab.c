@@ -0,0 +1,209 @@
+#include "slab.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Room for every class from SLAB_MIN_CHUNK to SLAB_MAX_CHUNK. */
+#define SLAB_MAX_CLASSES 32
+
+/*
+ * The chunks of one size. Free chunks are kept in a list linked through
+ * their first word. The newest page is cut into chunks only as the free list
+ * runs out, from page_next on.
+ */
+typedef struct slab_class_t {
+    _Alignas(64) pthread_mutex_t lock;
+    size_t chunk_size;
+    uint32_t magazine_cap;
+    void *free_list;
+    char *page_next;
+    size_t page_left;
+} slab_class_t;
+
+/*
+ * A thread's free chunks of one class, taken and given back without a lock.
+ */
+typedef struct slab_magazine_t {
+    uint32_t count;
+    void *chunks[SLAB_MAGAZINE];
+} slab_magazine_t;
+
+static slab_class_t classes[SLAB_MAX_CLASSES];
+static uint32_t num_classes;
+/* The class of every size up to SLAB_MAX_CHUNK, indexed by the size in 8 byte words, rounded up. */
+static uint8_t class_of_words[SLAB_MAX_CHUNK / 8 + 1];
+static size_t footprint;
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazine_key;
+static __thread slab_magazine_t magazines[SLAB_MAX_CLASSES];
+static __thread bool magazines_registered;
+
+/*
+ * Puts the chunks of a magazine past its first keep back on its class's free list.
+ */
+static void flush_magazine(slab_class_t *class, slab_magazine_t *magazine, uint32_t keep) {
+    if(magazine->count <= keep){
+        return;
+    }
+    pthread_mutex_lock(&class->lock);
+    while(magazine->count > keep){
+        void *chunk = magazine->chunks[--magazine->count];
+        *(void **) chunk = class->free_list;
+        class->free_list = chunk;
+    }
+    pthread_mutex_unlock(&class->lock);
+}
+
+/*
+ * Hands an exiting thread's free chunks back for other threads to use.
+ */
+static void flush_magazines(void *vargp) {
+    slab_magazine_t *thread_magazines = vargp;
+    for(uint32_t i = 0; i < num_classes; i++){
+        flush_magazine(&classes[i], &thread_magazines[i], 0);
+    }
+}
+
+static void init_classes(void) {
+    size_t size = SLAB_MIN_CHUNK;
+    while(true){
+        slab_class_t *class = &classes[num_classes++];
+        if(pthread_mutex_init(&class->lock, NULL) != 0){
+            exit(1);
+        }
+        class->chunk_size = size;
+        class->magazine_cap = SLAB_MAGAZINE_BYTES / size;
+        if(class->magazine_cap > SLAB_MAGAZINE){
+            class->magazine_cap = SLAB_MAGAZINE;
+        }
+        if(class->magazine_cap < 2){
+            class->magazine_cap = 2;
+        }
+        if(size == SLAB_MAX_CHUNK){
+            break;
+        }
+        //CHUNKS STAY 8 BYTE ALIGNED. THE LAST CLASS IS SLAB_MAX_CHUNK ITSELF.
+        size = (size * SLAB_GROWTH_PERCENT / 100 + 7) & ~(size_t) 7;
+        if(size > SLAB_MAX_CHUNK || num_classes == SLAB_MAX_CLASSES - 1){
+            size = SLAB_MAX_CHUNK;
+        }
+    }
+    uint32_t class = 0;
+    for(size_t words = 0; words <= SLAB_MAX_CHUNK / 8; words++){
+        while(classes[class].chunk_size < words * 8){
+            class++;
+        }
+        class_of_words[words] = class;
+    }
+    if(pthread_key_create(&magazine_key, flush_magazines) != 0){
+        exit(1);
+    }
+}
+
+/*
+ * Sets up the size classes if no thread has yet, and has the calling
+ * thread's magazines flushed when it exits.
+ */
+static void register_thread(void) {
+    pthread_once(&classes_once, init_classes);
+    pthread_setspecific(magazine_key, magazines);
+    magazines_registered = true;
+}
+
+/*
+ * Fills half of an empty magazine from its class's free list, cutting new
+ * chunks out of the class's page, and a new page, as needed.
+ *
+ * @return false if out of memory and the magazine is still empty.
+ */
+static bool refill_magazine(slab_class_t *class, slab_magazine_t *magazine) {
+    uint32_t want = class->magazine_cap / 2;
+    pthread_mutex_lock(&class->lock);
+    while(magazine->count < want && class->free_list != NULL){
+        void *chunk = class->free_list;
+        class->free_list = *(void **) chunk;
+        magazine->chunks[magazine->count++] = chunk;
+    }
+    while(magazine->count < want){
+        if(class->page_left == 0){
+            //A PAGE ONLY GOES WITHOUT CHUNKS WHEN NOTHING ELSE CAN BE HAD.
+            if(magazine->count > 0){
+                break;
+            }
+            char *page = aligned_alloc(64, SLAB_PAGE_SIZE);
+            if(page == NULL){
+                break;
+            }
+            __atomic_add_fetch(&footprint, SLAB_PAGE_SIZE, __ATOMIC_RELAXED);
+            class->page_next = page;
+            class->page_left = SLAB_PAGE_SIZE / class->chunk_size;
+        }
+        magazine->chunks[magazine->count++] = class->page_next;
+        class->page_next += class->chunk_size;
+        class->page_left--;
+    }
+    pthread_mutex_unlock(&class->lock);
+    return magazine->count > 0;
+}
+
+void *slab_alloc(size_t size) {
+    if(size > SLAB_MAX_CHUNK){
+        void *ptr = malloc(size);
+        if(ptr == NULL){
+            errno = ENOMEM;
+            return NULL;
+        }
+        __atomic_add_fetch(&footprint, size, __ATOMIC_RELAXED);
+        return ptr;
+    }
+    if(!magazines_registered){
+        register_thread();
+    }
+
+    uint32_t index = class_of_words[(size + 7) / 8];
+    slab_magazine_t *magazine = &magazines[index];
+    if(magazine->count == 0 && !refill_magazine(&classes[index], magazine)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return magazine->chunks[--magazine->count];
+}
+
+void slab_free(void *ptr, size_t size) {
+    if(ptr == NULL){
+        return;
+    }
+    if(size > SLAB_MAX_CHUNK){
+        free(ptr);
+        __atomic_sub_fetch(&footprint, size, __ATOMIC_RELAXED);
+        return;
+    }
+    //A CHUNK CAN BE FREED BY A THREAD THAT NEVER ALLOCATED ONE.
+    if(!magazines_registered){
+        register_thread();
+    }
+
+    uint32_t index = class_of_words[(size + 7) / 8];
+    slab_class_t *class = &classes[index];
+    slab_magazine_t *magazine = &magazines[index];
+    //A FULL MAGAZINE KEEPS HALF, SO A THREAD THAT ALTERNATES ALLOCATING AND FREEING DOES NOT TAKE THE LOCK EACH TIME.
+    if(magazine->count == class->magazine_cap){
+        flush_magazine(class, magazine, class->magazine_cap / 2);
+    }
+    magazine->chunks[magazine->count++] = ptr;
+}
+
+size_t slab_chunk_size(size_t size) {
+    if(size > SLAB_MAX_CHUNK){
+        return size;
+    }
+    pthread_once(&classes_once, init_classes);
+    return classes[class_of_words[(size + 7) / 8]].chunk_size;
+}
+
+size_t slab_footprint(void) {
+    return __atomic_load_n(&footprint, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,492 @@
+#include "uring.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * The low bits of user_data say which operation completed. Accepts carry the
+ * index of their listener in the other bits, zero-copy sends their uring_zc_t.
+ */
+#define OP_ACCEPT 0
+#define OP_READ 1
+#define OP_SEND 2
+#define OP_SEND_ZC 3
+#define OP_MASK 3
+
+typedef struct uring_conn_t {
+    conn_t *conn;
+    int slot;
+    bool zerocopy;
+    struct msghdr msg;
+    struct iovec iov[CONN_IOV_MAX];
+} uring_conn_t;
+
+/*
+ * A zero-copy send. The kernel reads the buffers until it posts a notification
+ * after the send itself completed, so the items stay pinned until then and
+ * the pieces from the send buffer, which is reused right away, are copied.
+ */
+typedef struct uring_zc_t {
+    uring_conn_t *uconn;
+    struct msghdr msg;
+    struct iovec iov[CONN_IOV_MAX];
+    item_t *items[CONN_IOV_MAX];
+    int count;
+    char copied[];
+} uring_zc_t;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Hands every queued SQE to the kernel and waits for at least wait_for completions.
+ */
+static int submit(uring_t *self, unsigned wait_for) {
+    __atomic_store_n(self->sq.tail, self->sq.sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = self->sq.sqe_tail - self->sq.submitted;
+    int ret;
+    do{
+        ret = io_uring_enter(self->ringfd, to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while(ret < 0 && errno == EINTR);
+    if(ret > 0){
+        self->sq.submitted += ret;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe(uring_t *self) {
+    //A FULL SUBMISSION QUEUE IS FLUSHED EARLY RATHER THAN DROPPING THE OPERATION.
+    while(self->sq.sqe_tail - __atomic_load_n(self->sq.head, __ATOMIC_ACQUIRE) >= *self->sq.ring_entries){
+        if(submit(self, 0) < 0){
+            return NULL;
+        }
+    }
+    unsigned index = self->sq.sqe_tail & *self->sq.ring_mask;
+    struct io_uring_sqe *sqe = &self->sq.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    self->sq.array[index] = index;
+    self->sq.sqe_tail++;
+    return sqe;
+}
+
+static void submit_accept(uring_t *self, int listener) {
+    struct io_uring_sqe *sqe = get_sqe(self);
+    if(sqe == NULL){
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = self->listenfds[listener];
+#ifdef IORING_ACCEPT_MULTISHOT
+    //ONE SQE KEEPS POSTING A COMPLETION PER ACCEPTED CONNECTION UNTIL THE KERNEL DROPS IT.
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+#endif
+    sqe->user_data = (unsigned long) listener << 2 | OP_ACCEPT;
+}
+
+static void close_conn(uring_t *self, uring_conn_t *uconn) {
+    if(uconn->slot >= 0){
+        self->free_slots[self->nfree++] = uconn->slot;
+    }
+    destroy_conn(uconn->conn);
+    free(uconn);
+}
+
+static void submit_read(uring_t *self, uring_conn_t *uconn) {
+    conn_t *conn = uconn->conn;
+    ssize_t room = conn_reserve(conn);
+    struct io_uring_sqe *sqe;
+    if(room <= 0 || (sqe = get_sqe(self)) == NULL){
+        close_conn(self, uconn);
+        return;
+    }
+    sqe->fd = conn->fd;
+    sqe->addr = (unsigned long) (conn->rbuf + conn->rend);
+    sqe->len = room;
+    if(uconn->slot >= 0 && conn->rbuf == conn->rbuf_home){
+        //THE KERNEL ALREADY HAS THIS BUFFER PINNED AND MAPPED, SO THE READ SKIPS THE PER-CALL PAGE LOOKUP.
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = uconn->slot;
+    }
+    else{
+        sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->user_data = (unsigned long) uconn | OP_READ;
+}
+
+#ifdef IORING_CQE_F_NOTIF
+static uring_zc_t *create_zc(uring_conn_t *uconn, int count, item_t **items, size_t copied) {
+    uring_zc_t *zc = malloc(sizeof(uring_zc_t) + copied);
+    if(zc == NULL){
+        return NULL;
+    }
+    zc->uconn = uconn;
+    zc->count = count;
+    char *cursor = zc->copied;
+    for(int i = 0; i < count; i++){
+        zc->items[i] = items[i];
+        zc->iov[i] = uconn->iov[i];
+        if(items[i] != NULL){
+            item_retain(items[i]);
+        }
+        else{
+            memcpy(cursor, uconn->iov[i].iov_base, uconn->iov[i].iov_len);
+            zc->iov[i].iov_base = cursor;
+            cursor += uconn->iov[i].iov_len;
+        }
+    }
+    memset(&zc->msg, 0, sizeof(zc->msg));
+    zc->msg.msg_iov = zc->iov;
+    zc->msg.msg_iovlen = count;
+    return zc;
+}
+
+static void destroy_zc(uring_zc_t *zc) {
+    for(int i = 0; i < zc->count; i++){
+        item_release(zc->items[i]);
+    }
+    free(zc);
+}
+#endif
+
+static void submit_send(uring_t *self, uring_conn_t *uconn) {
+    conn_t *conn = uconn->conn;
+    item_t *items[CONN_IOV_MAX];
+    int count = conn_iov(conn, uconn->iov, items, CONN_IOV_MAX);
+    struct io_uring_sqe *sqe = get_sqe(self);
+    if(sqe == NULL){
+        close_conn(self, uconn);
+        return;
+    }
+    sqe->fd = conn->fd;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+#ifdef IORING_CQE_F_NOTIF
+    size_t pinned = 0, copied = 0;
+    for(int i = 0; i < count; i++){
+        if(items[i] != NULL){
+            pinned += uconn->iov[i].iov_len;
+        }
+        else{
+            copied += uconn->iov[i].iov_len;
+        }
+    }
+    //BELOW THE THRESHOLD, PINNING PAGES AND WAITING FOR THE NOTIFICATION COSTS MORE THAN THE COPY SAVES.
+    uring_zc_t *zc;
+    if(uconn->zerocopy && pinned >= URING_ZEROCOPY_MIN && (zc = create_zc(uconn, count, items, copied)) != NULL){
+        sqe->opcode = IORING_OP_SENDMSG_ZC;
+        sqe->addr = (unsigned long) &zc->msg;
+        sqe->user_data = (unsigned long) zc | OP_SEND_ZC;
+        return;
+    }
+#endif
+    memset(&uconn->msg, 0, sizeof(uconn->msg));
+    uconn->msg.msg_iov = uconn->iov;
+    uconn->msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (unsigned long) &uconn->msg;
+    sqe->user_data = (unsigned long) uconn | OP_SEND;
+}
+
+/*
+ * Each connection has at most one read or send in flight. Once it completes,
+ * buffered requests are executed and the next operation is queued.
+ */
+static void advance(uring_t *self, uring_conn_t *uconn) {
+    conn_t *conn = uconn->conn;
+    conn_process(conn, self->map);
+    if(conn_pending(conn)){
+        submit_send(self, uconn);
+    }
+    else if(conn_done(conn)){
+        close_conn(self, uconn);
+    }
+    else{
+        submit_read(self, uconn);
+    }
+}
+
+static void on_accept(uring_t *self, struct io_uring_cqe *cqe) {
+    if(!(cqe->flags & IORING_CQE_F_MORE)){
+        submit_accept(self, cqe->user_data >> 2);
+    }
+    if(cqe->res < 0){
+        return;
+    }
+
+    uring_conn_t *uconn = malloc(sizeof(uring_conn_t));
+    if(uconn == NULL){
+        close(cqe->res);
+        return;
+    }
+    uconn->slot = self->nfree > 0 ? self->free_slots[--self->nfree] : -1;
+    uconn->zerocopy = self->zerocopy;
+    char *rbuf = uconn->slot >= 0 ? self->slots + (size_t) uconn->slot * CONN_RBUF_SIZE : NULL;
+    if((uconn->conn = create_conn(cqe->res, self->keepalive, rbuf)) == NULL){
+        if(uconn->slot >= 0){
+            self->free_slots[self->nfree++] = uconn->slot;
+        }
+        close(cqe->res);
+        free(uconn);
+        return;
+    }
+    debug("Accepted connection %d into slot %d", cqe->res, uconn->slot);
+    submit_read(self, uconn);
+}
+
+static void on_complete(uring_t *self, struct io_uring_cqe *cqe) {
+    int op = cqe->user_data & OP_MASK;
+    if(op == OP_ACCEPT){
+        on_accept(self, cqe);
+        return;
+    }
+
+    void *data = (void *) (unsigned long) (cqe->user_data & ~(unsigned long) OP_MASK);
+    uring_conn_t *uconn = data;
+#ifdef IORING_CQE_F_NOTIF
+    if(op == OP_SEND_ZC){
+        uring_zc_t *zc = data;
+        //THE SEND AND ITS NOTIFICATION COMPLETE SEPARATELY. WITHOUT F_MORE NO NOTIFICATION FOLLOWS.
+        if(cqe->flags & IORING_CQE_F_NOTIF){
+            destroy_zc(zc);
+            return;
+        }
+        uconn = zc->uconn;
+        if(!(cqe->flags & IORING_CQE_F_MORE)){
+            destroy_zc(zc);
+        }
+        if(cqe->res == -EOPNOTSUPP){
+            //NOT EVERY SOCKET SUPPORTS ZERO-COPY. SEND THE SAME OUTPUT AGAIN THE ORDINARY WAY.
+            uconn->zerocopy = false;
+            submit_send(self, uconn);
+            return;
+        }
+    }
+#endif
+
+    conn_t *conn = uconn->conn;
+    if(cqe->res < 0){
+        close_conn(self, uconn);
+        return;
+    }
+    if(op == OP_READ){
+        conn_received(conn, cqe->res);
+        advance(self, uconn);
+        return;
+    }
+
+    conn_sent(conn, cqe->res);
+    if(conn_pending(conn)){
+        submit_send(self, uconn);
+        return;
+    }
+    advance(self, uconn);
+}
+
+/*
+ * Unmaps whichever of the rings map_rings() mapped.
+ */
+static void unmap_rings(uring_t *self) {
+    if(self->sq.sqes != NULL && self->sq.sqes != MAP_FAILED){
+        munmap(self->sq.sqes, self->sqes_size);
+    }
+    if(self->cq_ring != NULL && self->cq_ring != MAP_FAILED && self->cq_ring != self->sq_ring){
+        munmap(self->cq_ring, self->cq_ring_size);
+    }
+    if(self->sq_ring != NULL && self->sq_ring != MAP_FAILED){
+        munmap(self->sq_ring, self->sq_ring_size);
+    }
+    self->sq.sqes = NULL;
+    self->sq_ring = self->cq_ring = NULL;
+}
+
+/*
+ * Maps the submission and completion rings and the submission queue entries,
+ * and points the queues' fields into them. Returns false, with nothing left
+ * mapped, if any of them can not be mapped.
+ */
+static bool map_rings(uring_t *self, struct io_uring_params *params) {
+    self->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    self->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if(params->features & IORING_FEAT_SINGLE_MMAP){
+        if(self->cq_ring_size > self->sq_ring_size){
+            self->sq_ring_size = self->cq_ring_size;
+        }
+        self->cq_ring_size = self->sq_ring_size;
+    }
+
+    self->sq_ring = mmap(NULL, self->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        self->ringfd, IORING_OFF_SQ_RING);
+    if(self->sq_ring == MAP_FAILED){
+        unmap_rings(self);
+        return false;
+    }
+    if(params->features & IORING_FEAT_SINGLE_MMAP){
+        self->cq_ring = self->sq_ring;
+    }
+    else{
+        self->cq_ring = mmap(NULL, self->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            self->ringfd, IORING_OFF_CQ_RING);
+        if(self->cq_ring == MAP_FAILED){
+            unmap_rings(self);
+            return false;
+        }
+    }
+    self->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    self->sq.sqes = mmap(NULL, self->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, self->ringfd, IORING_OFF_SQES);
+    if(self->sq.sqes == MAP_FAILED){
+        unmap_rings(self);
+        return false;
+    }
+
+    char *sq = self->sq_ring;
+    self->sq.head = (unsigned *) (sq + params->sq_off.head);
+    self->sq.tail = (unsigned *) (sq + params->sq_off.tail);
+    self->sq.ring_mask = (unsigned *) (sq + params->sq_off.ring_mask);
+    self->sq.ring_entries = (unsigned *) (sq + params->sq_off.ring_entries);
+    self->sq.array = (unsigned *) (sq + params->sq_off.array);
+    self->sq.sqe_tail = self->sq.submitted = *self->sq.tail;
+
+    char *cq = self->cq_ring;
+    self->cq.head = (unsigned *) (cq + params->cq_off.head);
+    self->cq.tail = (unsigned *) (cq + params->cq_off.tail);
+    self->cq.ring_mask = (unsigned *) (cq + params->cq_off.ring_mask);
+    self->cq.cqes = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+    return true;
+}
+
+/*
+ * Allocates the read buffers and registers them with the ring. If they can
+ * not be registered, they are not used.
+ */
+static void register_slots(uring_t *self) {
+    self->slots = mmap(NULL, (size_t) URING_SLOTS * CONN_RBUF_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    self->free_slots = malloc(URING_SLOTS * sizeof(int));
+    if(self->slots == MAP_FAILED || self->free_slots == NULL){
+        return;
+    }
+
+    struct iovec iovecs[URING_SLOTS];
+    for(int i = 0; i < URING_SLOTS; i++){
+        iovecs[i].iov_base = self->slots + (size_t) i * CONN_RBUF_SIZE;
+        iovecs[i].iov_len = CONN_RBUF_SIZE;
+    }
+    //PINNED MEMORY COUNTS AGAINST RLIMIT_MEMLOCK. WITHOUT IT, EVERY CONNECTION READS INTO THE HEAP.
+    if(io_uring_register(self->ringfd, IORING_REGISTER_BUFFERS, iovecs, URING_SLOTS) < 0){
+        return;
+    }
+    for(int i = URING_SLOTS - 1; i >= 0; i--){
+        self->free_slots[self->nfree++] = i;
+    }
+}
+
+#ifdef IORING_CQE_F_NOTIF
+/*
+ * Checks whether the kernel implements an io_uring operation.
+ */
+static bool supports(int ringfd, int opcode) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if(probe == NULL){
+        return false;
+    }
+    bool supported = io_uring_register(ringfd, IORING_REGISTER_PROBE, probe, 256) >= 0
+        && opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+#endif
+
+uring_t *create_uring(int listenfd, hashmap_t *map, bool keepalive, bool zerocopy) {
+    if(listenfd < 0 || map == NULL){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    uring_t *ring = calloc(1, sizeof(uring_t));
+    if(ring == NULL){
+        return NULL;
+    }
+    ring->listenfds[ring->nlisteners++] = listenfd;
+    ring->map = map;
+    ring->keepalive = keepalive;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if((ring->ringfd = io_uring_setup(URING_ENTRIES, &params)) < 0){
+        free(ring);
+        return NULL;
+    }
+    if(!map_rings(ring, &params)){
+        close(ring->ringfd);
+        free(ring);
+        return NULL;
+    }
+    register_slots(ring);
+#ifdef IORING_CQE_F_NOTIF
+    ring->zerocopy = zerocopy && supports(ring->ringfd, IORING_OP_SENDMSG_ZC);
+#endif
+    return ring;
+}
+
+void destroy_uring(uring_t *self) {
+    //CLOSING THE RING UNREGISTERS THE SLOTS, SO THEIR PAGES ARE NO LONGER PINNED WHEN THEY ARE UNMAPPED.
+    close(self->ringfd);
+    if(self->slots != NULL && self->slots != MAP_FAILED){
+        munmap(self->slots, (size_t) URING_SLOTS * CONN_RBUF_SIZE);
+    }
+    free(self->free_slots);
+    unmap_rings(self);
+    free(self);
+}
+
+bool uring_listen(uring_t *self, int listenfd) {
+    if(self->nlisteners == URING_MAX_LISTENERS){
+        errno = ENOSPC;
+        return false;
+    }
+    self->listenfds[self->nlisteners++] = listenfd;
+    return true;
+}
+
+void uring_run(uring_t *self) {
+    for(int i = 0; i < self->nlisteners; i++){
+        submit_accept(self, i);
+    }
+    while(1){
+        //EVERYTHING QUEUED WHILE HANDLING THE LAST BATCH OF COMPLETIONS GOES IN WITH THE SAME SYSCALL THAT WAITS.
+        if(submit(self, 1) < 0){
+            return;
+        }
+        unsigned head = *self->cq.head;
+        unsigned tail = __atomic_load_n(self->cq.tail, __ATOMIC_ACQUIRE);
+        while(head != tail){
+            struct io_uring_cqe cqe = self->cq.cqes[head & *self->cq.ring_mask];
+            head++;
+            //GIVE THE SLOT BACK FIRST. HANDLING THE COMPLETION MAY QUEUE ENOUGH WORK TO FLUSH THE RINGS.
+            __atomic_store_n(self->cq.head, head, __ATOMIC_RELEASE);
+            on_complete(self, &cqe);
+        }
+    }
+}
+
+void *uring_thread(void *vargp) {
+    uring_run(vargp);
+    return NULL;
+}
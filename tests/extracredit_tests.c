@@ -3,5 +3,212 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "extracredit.h"
+#include "utils.h"
+#define NUM_KEYS 4
+#define NUM_THREADS 8
+#define MEMORY_LIMIT (64 << 10)
+
+hashmap_t *global_map;
+
+/* Used in item destruction */
+void map_free_function(map_key_t key, map_val_t val) {
+    free(key.key_base);
+    free(val.val_base);
+}
+
+void map_init(void) {
+    global_map = create_map(NUM_KEYS, jenkins_one_at_a_time_hash, map_free_function);
+}
+
+void growable_map_init(void) {
+    global_map = create_growable_map(4, 0, 1, jenkins_one_at_a_time_hash, map_free_function);
+}
+
+void map_fini(void) {
+    invalidate_map(global_map);
+}
+
+/*
+ * Puts key index with a value of index, forcing it in if the map is full.
+ */
+static bool put_int(int index) {
+    int *key_ptr = malloc(sizeof(int));
+    int *val_ptr = malloc(sizeof(int));
+    *key_ptr = index;
+    *val_ptr = index;
+    return put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), true);
+}
+
+static bool has_int(int index) {
+    map_val_t val = get(global_map, MAP_KEY(&index, sizeof(int)));
+    return val.val_base != NULL && *(int *) val.val_base == index;
+}
+
+Test(ec_suite, 00_creation, .timeout = 2, .init = map_init, .fini = map_fini){
+    cr_assert_not_null(global_map, "Map returned was NULL");
+    cr_assert_geq(global_map->capacity, NUM_KEYS, "Map has %u buckets for %d entries", global_map->capacity, NUM_KEYS);
+    cr_assert_eq(global_map->capacity & (global_map->capacity - 1), 0, "Bucket count %u is not a power of two", global_map->capacity);
+    cr_assert_null(create_map(0, jenkins_one_at_a_time_hash, map_free_function), "Map with no capacity was created");
+}
+
+Test(ec_suite, 01_put_get_delete, .timeout = 2, .init = map_init, .fini = map_fini){
+    for(int index = 0; index < NUM_KEYS; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+    }
+    cr_assert_eq(global_map->size, NUM_KEYS, "Size is %u after %d insertions", global_map->size, NUM_KEYS);
+
+    // putting a key again replaces its value
+    int *key_ptr = malloc(sizeof(int));
+    int *val_ptr = malloc(sizeof(int));
+    *key_ptr = 1;
+    *val_ptr = 100;
+    cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), true), "Replacement failed");
+    int key = 1;
+    cr_assert_eq(*(int *) get(global_map, MAP_KEY(&key, sizeof(int))).val_base, 100, "Value was not replaced");
+    cr_assert_eq(global_map->size, NUM_KEYS, "Replacement changed the size to %u", global_map->size);
+
+    key = 2;
+    map_node_t node = delete(global_map, MAP_KEY(&key, sizeof(int)));
+    cr_assert_eq(*(int *) node.val.val_base, 2, "Deleted the wrong value");
+    free(node.val.val_base);
+    cr_assert(!has_int(2), "Key 2 was found after its deletion");
+    cr_assert_eq(global_map->size, NUM_KEYS - 1, "Size is %u after a deletion", global_map->size);
+
+    // a discarded entry is destroyed by the map
+    key = 3;
+    cr_assert(discard(global_map, MAP_KEY(&key, sizeof(int))), "Key 3 was not discarded");
+    cr_assert(!has_int(3), "Key 3 was found after it was discarded");
+    cr_assert(!discard(global_map, MAP_KEY(&key, sizeof(int))), "Key 3 was discarded twice");
+    cr_assert_eq(global_map->size, NUM_KEYS - 2, "Size is %u after a discard", global_map->size);
+
+    cr_assert(clear_map(global_map), "Clear failed");
+    cr_assert_eq(global_map->size, 0, "Size is %u after a clear", global_map->size);
+    cr_assert(!has_int(0), "Key 0 was found after a clear");
+}
+
+Test(ec_suite, 02_lru_eviction, .timeout = 2, .init = map_init, .fini = map_fini){
+    for(int index = 0; index < NUM_KEYS; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+    }
+    // key 0 is read, so key 1 is now the least recently used, then key 2
+    cr_assert(has_int(0), "Key 0 was not found");
+    cr_assert(put_int(NUM_KEYS), "Forced insertion failed");
+    cr_assert_eq(global_map->size, NUM_KEYS, "Size is %u after a forced insertion", global_map->size);
+#if defined(EC_LRU) && !defined(EC_TINYLFU)
+    cr_assert(has_int(0), "The most recently read key was evicted");
+    cr_assert(!has_int(1), "The least recently used key was not evicted");
+    cr_assert(put_int(NUM_KEYS + 1), "Forced insertion failed");
+    cr_assert(!has_int(2), "The next least recently used key was not evicted");
+    cr_assert(has_int(NUM_KEYS) && has_int(NUM_KEYS + 1), "A new key was evicted");
+#endif
+}
+
+static __thread int expected;
+
+/* Checks a value while the map still holds it. */
+static void check_value(map_val_t val) {
+    cr_assert_eq(*(int *) val.val_base, expected, "Key %d had value %d", expected, *(int *) val.val_base);
+}
+
+static void *read_hot_keys(void *arg) {
+    for(int round = 0; round < 20000; round++) {
+        expected = round % NUM_KEYS;
+        get_pinned(global_map, MAP_KEY(&expected, sizeof(int)), check_value);
+    }
+    return NULL;
+}
+
+Test(ec_suite, 03_concurrent_readers, .timeout = 5){
+    global_map = create_map(64, jenkins_one_at_a_time_hash, map_free_function);
+    for(int index = 0; index < NUM_KEYS; index++) {
+        put_int(index);
+    }
+
+    // readers move keys around the recency list while a writer evicts past them
+    pthread_t tids[NUM_THREADS];
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&tids[i], NULL, read_hot_keys, NULL);
+    }
+    for(int index = NUM_KEYS; index < 5000; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+    }
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    cr_assert_eq(global_map->size, 64, "Size is %u after filling the map", global_map->size);
+
+    // the recency lists hold exactly the entries of the map
+    uint32_t listed = 0, found = 0;
+    for(int segment = 0; segment < MAP_SEGMENTS; segment++) {
+        uint32_t in_segment = 0;
+        for(map_node_t *node = global_map->lists[segment].newest; node != NULL; node = node->older) {
+            cr_assert(node->older == NULL || node->older->newer == node, "The recency list is broken");
+            cr_assert_eq(node->segment, segment, "A node of segment %u is listed in segment %d", node->segment, segment);
+            in_segment++;
+        }
+        cr_assert_eq(in_segment, global_map->lists[segment].size, "Segment %d lists %u entries for %u", segment, in_segment, global_map->lists[segment].size);
+        listed += in_segment;
+    }
+    for(int index = 0; index < 5000; index++) {
+        found += has_int(index);
+    }
+    cr_assert_eq(listed, global_map->size, "%u entries are listed for %u in the map", listed, global_map->size);
+    cr_assert_eq(found, global_map->size, "%u entries are found for %u in the map", found, global_map->size);
+    invalidate_map(global_map);
+}
+
+Test(ec_suite, 04_memory_limit, .timeout = 2, .init = growable_map_init, .fini = map_fini){
+    cr_assert(set_max_memory(global_map, MEMORY_LIMIT, NULL), "Memory limit was not set");
+
+    for(int index = 0; index < 2000; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+        cr_assert_leq(global_map->bytes, MEMORY_LIMIT, "Took %lu bytes after insertion %d", (unsigned long) global_map->bytes, index);
+        cr_assert(has_int(index), "Key %d was not found after its insertion", index);
+    }
+    cr_assert_lt(global_map->size, 2000, "Nothing was evicted");
+    cr_assert_gt(global_map->capacity, 4, "Map never grew");
+#if defined(EC_LRU) && !defined(EC_TINYLFU)
+    // what was evicted is the oldest
+    cr_assert(has_int(1999 - global_map->size + 1) && !has_int(1999 - global_map->size), "Eviction did not follow recency");
+#endif
+}
+
+#ifdef EC_TINYLFU
+Test(ec_suite, 05_tinylfu_scan_resistance, .timeout = 2){
+    global_map = create_map(100, jenkins_one_at_a_time_hash, map_free_function);
+    // keys 0 to 49 are read often enough to be protected
+    for(int index = 0; index < 50; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+    }
+    for(int round = 0; round < 5; round++) {
+        for(int index = 0; index < 50; index++) {
+            cr_assert(has_int(index), "Key %d was not found", index);
+        }
+    }
+    // a scan of keys used once, five times what the map holds, must not push them out
+    for(int index = 1000; index < 1500; index++) {
+        cr_assert(put_int(index), "Insertion %d failed", index);
+    }
+    cr_assert_eq(global_map->size, 100, "Size is %u after the scan", global_map->size);
+    for(int index = 0; index < 50; index++) {
+        cr_assert(has_int(index), "Hot key %d was evicted by the scan", index);
+    }
+    invalidate_map(global_map);
+}
+#endif
+
+Test(ec_suite, 06_sharded_map_capacity, .timeout = 5){
+    // however many shards it is split into, a map holds at most as many entries as it was asked to
+    for(uint32_t num_shards = 1; num_shards <= MAP_MAX_SHARDS; num_shards *= 2) {
+        global_map = create_sharded_map(10, num_shards, jenkins_one_at_a_time_hash, map_free_function);
+        cr_assert_leq(global_map->num_shards, 10, "A map of 10 entries has %u shards", global_map->num_shards);
+        for(int index = 0; index < 1000; index++) {
+            put_int(index);
+        }
+        cr_assert_eq(global_map->size, 10, "%u shards held %u entries", num_shards, global_map->size);
+        invalidate_map(global_map);
+    }
+}
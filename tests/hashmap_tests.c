@@ -1,10 +1,13 @@
 #include <criterion/criterion.h>
 #include <criterion/logging.h>
 #include <unistd.h>
+#include <sched.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "hashmap.h"
+#include "hash.h"
 #include "utils.h"
 #include "debug.h"
 // #define NUM_THREADS 1500 //TEST 9 ONLY
@@ -759,4 +762,593 @@ Test(map_suite, 13_single_forceput, .timeout = 2, .init = map_init, .fini = map_
     put(global_map, key_2, val_2, true);
     map_val_t get_value_2 = get(global_map, key_2);
     cr_assert_eq(*(int *)get_value_2.val_base, 60, "Value is not expected. Is %d, expected %d", *(int *)get_value_2.val_base, 60);
-}
\ No newline at end of file
+}
+Test(map_suite, 14_multi_put_get_delete, .timeout = 2, .init = map_init, .fini = map_fini){
+    map_key_t keys[10];
+    map_val_t vals[10];
+    bool results[10];
+
+    for(int index = 0; index < 10; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index * 2;
+        keys[index] = MAP_KEY(key_ptr, sizeof(int));
+        vals[index] = MAP_VAL(val_ptr, sizeof(int));
+    }
+
+    size_t inserted = put_multi(global_map, keys, vals, 10, false, results);
+    cr_assert_eq(inserted, 10, "Inserted %d items. Expected %d", (int) inserted, 10);
+    cr_assert_eq(global_map->size, 10, "Had %d items in map. Expected %d", global_map->size, 10);
+
+    map_val_t got[10];
+    size_t found = get_multi(global_map, keys, got, 10);
+    cr_assert_eq(found, 10, "Found %d items. Expected %d", (int) found, 10);
+    for(int index = 0; index < 10; index++) {
+        cr_assert_eq(results[index], true, "Insertion %d failed", index);
+        cr_assert_eq(*(int *)got[index].val_base, index * 2, "Value is not expected. Is %d, expected %d", *(int *)got[index].val_base, index * 2);
+    }
+
+    size_t removed = delete_multi(global_map, keys, NULL, 5);
+    cr_assert_eq(removed, 5, "Removed %d items. Expected %d", (int) removed, 5);
+    cr_assert_eq(global_map->size, 5, "Had %d items in map. Expected %d", global_map->size, 5);
+
+    found = get_multi(global_map, keys, got, 10);
+    cr_assert_eq(found, 5, "Found %d items. Expected %d", (int) found, 5);
+    cr_assert_null(got[0].val_base, "Deleted key was found");
+}
+
+int pin_count;
+
+void count_pin(map_val_t val) {
+    pin_count++;
+}
+
+Test(map_suite, 15_get_pinned, .timeout = 2, .init = map_init, .fini = map_fini){
+    int *key_ptr = malloc(sizeof(int));
+    int *val_ptr = malloc(sizeof(int));
+    *key_ptr = 7;
+    *val_ptr = 70;
+    put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), false);
+
+    pin_count = 0;
+    int missing = 8;
+    map_val_t got = get_pinned(global_map, MAP_KEY(&missing, sizeof(int)), count_pin);
+    cr_assert_null(got.val_base, "Missing key was found");
+    cr_assert_eq(pin_count, 0, "Pinned %d values for a missing key. Expected %d", pin_count, 0);
+
+    int key = 7;
+    got = get_pinned(global_map, MAP_KEY(&key, sizeof(int)), count_pin);
+    cr_assert_eq(got.val_base, val_ptr, "Val base is not the stored value");
+    cr_assert_eq(pin_count, 1, "Pinned %d values. Expected %d", pin_count, 1);
+
+    map_key_t keys[2] = {MAP_KEY(&key, sizeof(int)), MAP_KEY(&missing, sizeof(int))};
+    map_val_t vals[2];
+    size_t found = get_multi_pinned(global_map, keys, vals, 2, count_pin);
+    cr_assert_eq(found, 1, "Found %d items. Expected %d", (int) found, 1);
+    cr_assert_eq(pin_count, 2, "Pinned %d values. Expected %d", pin_count, 2);
+}
+
+void sharded_map_init(void) {
+    global_map = create_sharded_map(64, 3, jenkins_hash, map_free_function);
+}
+
+Test(map_suite, 16_sharded_map, .timeout = 2, .init = sharded_map_init, .fini = map_fini){
+    map_key_t keys[40];
+    map_val_t vals[40];
+
+    cr_assert_eq(global_map->num_shards, 4, "Had %d shards. Expected %d", global_map->num_shards, 4);
+    for(int index = 0; index < 40; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index * 3;
+        keys[index] = MAP_KEY(key_ptr, sizeof(int));
+        vals[index] = MAP_VAL(val_ptr, sizeof(int));
+    }
+
+    cr_assert(put(global_map, keys[0], vals[0], false), "Insertion 0 failed");
+    size_t inserted = put_multi(global_map, keys + 1, vals + 1, 39, false, NULL);
+    cr_assert_eq(inserted, 39, "Inserted %d items. Expected %d", (int) inserted, 39);
+    cr_assert_eq(global_map->size, 40, "Had %d items in map. Expected %d", global_map->size, 40);
+
+    map_val_t got[40];
+    size_t found = get_multi(global_map, keys, got, 40);
+    cr_assert_eq(found, 40, "Found %d items. Expected %d", (int) found, 40);
+    for(int index = 0; index < 40; index++) {
+        cr_assert_eq(*(int *)got[index].val_base, index * 3, "Value is not expected. Is %d, expected %d", *(int *)got[index].val_base, index * 3);
+        cr_assert_eq(get(global_map, keys[index]).val_base, vals[index].val_base, "Val base is not the stored value");
+    }
+
+    map_node_t node = delete(global_map, keys[0]);
+    cr_assert_eq(node.val.val_base, vals[0].val_base, "Deleted the wrong value");
+    free(node.key.key_base);
+    free(node.val.val_base);
+    size_t removed = delete_multi(global_map, keys + 1, NULL, 19);
+    cr_assert_eq(removed, 19, "Removed %d items. Expected %d", (int) removed, 19);
+    cr_assert_eq(global_map->size, 20, "Had %d items in map. Expected %d", global_map->size, 20);
+
+    int key = 30;
+    cr_assert(clear_map(global_map), "Clear failed");
+    cr_assert_eq(global_map->size, 0, "Had %d items in map. Expected %d", global_map->size, 0);
+    cr_assert_null(get(global_map, MAP_KEY(&key, sizeof(int))).val_base, "Cleared key was found");
+}
+
+Test(map_suite, 17_robin_hood_churn, .timeout = 2, .init = map_init, .fini = map_fini){
+    int *key_ptrs[NUM_THREADS + 1];
+
+    for(int index = 0; index < NUM_THREADS; index++) {
+        key_ptrs[index] = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptrs[index] = index;
+        *val_ptr = index * 2;
+        cr_assert(put(global_map, MAP_KEY(key_ptrs[index], sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), false), "Insertion %d failed", index);
+    }
+
+    // churn: delete and reinsert every key many times over, which used to fill the map with tombstones
+    for(int round = 0; round < 50; round++) {
+        for(int index = round % 3; index < NUM_THREADS; index += 3) {
+            map_node_t node = delete(global_map, MAP_KEY(key_ptrs[index], sizeof(int)));
+            cr_assert_not_null(node.val.val_base, "Key %d was not found to delete", index);
+            put(global_map, node.key, node.val, false);
+        }
+    }
+    cr_assert_eq(global_map->size, NUM_THREADS, "Had %d items in map. Expected %d", global_map->size, NUM_THREADS);
+
+    // a forced put into the full map evicts the entry at the new key's hashed index, or the first one after it
+    key_ptrs[NUM_THREADS] = malloc(sizeof(int));
+    int *val_ptr = malloc(sizeof(int));
+    *key_ptrs[NUM_THREADS] = NUM_THREADS;
+    *val_ptr = NUM_THREADS * 2;
+    map_key_t new_key = MAP_KEY(key_ptrs[NUM_THREADS], sizeof(int));
+    uint32_t victim_index = get_index(global_map, new_key);
+    while(global_map->nodes[victim_index].key.key_base == NULL) {
+        victim_index = (victim_index + 1) % global_map->capacity;
+    }
+    int victim = *(int *)global_map->nodes[victim_index].key.key_base;
+    cr_assert(put(global_map, new_key, MAP_VAL(val_ptr, sizeof(int)), true), "Forced insertion failed");
+    cr_assert_eq(global_map->size, NUM_THREADS, "Had %d items in map. Expected %d", global_map->size, NUM_THREADS);
+
+    for(int index = 0; index <= NUM_THREADS; index++) {
+        int key = index;
+        map_val_t val = get(global_map, MAP_KEY(&key, sizeof(int)));
+        if(index == victim) {
+            cr_assert_null(val.val_base, "Evicted key %d was found", index);
+        }
+        else {
+            cr_assert_not_null(val.val_base, "Key %d was not found", index);
+            cr_assert_eq(*(int *)val.val_base, index * 2, "Value is not expected. Is %d, expected %d", *(int *)val.val_base, index * 2);
+        }
+    }
+
+    // every entry keeps its key's hash, and no tombstone is left behind
+    for(uint32_t index = 0; index < global_map->capacity; index++) {
+        map_node_t *node = &global_map->nodes[index];
+        cr_assert(!node->tombstone, "Node %u is a tombstone", index);
+        cr_assert_eq(node->hash, jenkins_hash(node->key), "Node %u has the wrong hash", index);
+    }
+}
+
+void growable_map_init(void) {
+    global_map = create_growable_map(4, 100, 1, jenkins_hash, map_free_function);
+}
+
+Test(map_suite, 18_growable_map, .timeout = 2, .init = growable_map_init, .fini = map_fini){
+    bool resized = false;
+
+    for(int index = 0; index < 100; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index * 2;
+        cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), false), "Insertion %d failed", index);
+        resized |= global_map->old_nodes != NULL;
+
+        // every key is found whichever probe array it is in
+        for(int prev = 0; prev <= index; prev++) {
+            int key = prev;
+            map_val_t val = get(global_map, MAP_KEY(&key, sizeof(int)));
+            cr_assert_not_null(val.val_base, "Key %d was not found after %d insertions", prev, index + 1);
+            cr_assert_eq(*(int *)val.val_base, prev * 2, "Value is not expected. Is %d, expected %d", *(int *)val.val_base, prev * 2);
+        }
+    }
+    cr_assert(resized, "Map never moved into a larger array");
+    // the probe array stops at the smallest power of two that holds the ceiling
+    cr_assert_eq(global_map->capacity, 128, "Had capacity %d. Expected %d", global_map->capacity, 128);
+    cr_assert_eq(global_map->max_capacity, 100, "Had max capacity %d. Expected %d", global_map->max_capacity, 100);
+    cr_assert_eq(global_map->size, 100, "Had %d items in map. Expected %d", global_map->size, 100);
+
+    // the ceiling is reached: a put fails unless forced, and a forced one evicts
+    int *key_ptr = malloc(sizeof(int));
+    int *val_ptr = malloc(sizeof(int));
+    *key_ptr = 100;
+    *val_ptr = 200;
+    cr_assert(!put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), false), "Insertion into a full map succeeded");
+    cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), true), "Forced insertion failed");
+    cr_assert_eq(global_map->size, 100, "Had %d items in map. Expected %d", global_map->size, 100);
+    cr_assert_null(global_map->old_nodes, "Map is still resizing");
+
+    for(int index = 0; index < 100; index += 2) {
+        int key = index;
+        map_node_t node = delete(global_map, MAP_KEY(&key, sizeof(int)));
+        if(node.val.val_base != NULL) {
+            free(node.val.val_base);
+        }
+    }
+    int key = 100;
+    cr_assert_eq(*(int *)get(global_map, MAP_KEY(&key, sizeof(int))).val_base, 200, "Forced key was not found");
+}
+
+Test(map_suite, 19_inline_and_long_keys, .timeout = 2, .init = map_init, .fini = map_fini){
+    // keys shorter than, as long as and longer than what a node holds inline; the long ones only differ past it
+    size_t lens[5] = {3, MAP_INLINE_KEY, MAP_INLINE_KEY + 8, MAP_INLINE_KEY + 8, MAP_INLINE_KEY + 8};
+    map_key_t keys[5];
+    for(int index = 0; index < 5; index++) {
+        char *key_ptr = malloc(lens[index]);
+        int *val_ptr = malloc(sizeof(int));
+        memset(key_ptr, 'k', lens[index]);
+        key_ptr[lens[index] - 1] = '0' + index;
+        *val_ptr = index;
+        keys[index] = MAP_KEY(key_ptr, lens[index]);
+        cr_assert(put(global_map, keys[index], MAP_VAL(val_ptr, sizeof(int)), false), "Insertion %d failed", index);
+    }
+
+    for(int index = 0; index < 5; index++) {
+        char copy[MAP_INLINE_KEY + 8];
+        memcpy(copy, keys[index].key_base, lens[index]);
+        map_val_t val = get(global_map, MAP_KEY(copy, lens[index]));
+        cr_assert_not_null(val.val_base, "Key %d was not found", index);
+        cr_assert_eq(*(int *)val.val_base, index, "Value is not expected. Is %d, expected %d", *(int *)val.val_base, index);
+    }
+
+    char other[MAP_INLINE_KEY + 8];
+    memset(other, 'k', sizeof(other));
+    other[sizeof(other) - 1] = '9';
+    cr_assert_null(get(global_map, MAP_KEY(other, sizeof(other))).val_base, "A key differing past the inline bytes was found");
+}
+
+Test(map_suite, 20_hash_functions, .timeout = 2){
+    cr_assert_eq(find_hash("jenkins"), jenkins_one_at_a_time_hash, "jenkins is not the default hash");
+    cr_assert_null(find_hash("md5"), "Found a hash that does not exist");
+
+    // every hash function can back a map, over keys of every length up to a few words
+    for(const hash_entry_t *entry = hash_functions; entry->name != NULL; entry++) {
+        cr_assert_eq(find_hash(entry->name), entry->function, "%s is not found by its name", entry->name);
+        global_map = create_map(128, entry->function, map_free_function);
+        for(int len = 1; len <= 100; len++) {
+            char *key_ptr = malloc(len);
+            int *val_ptr = malloc(sizeof(int));
+            memset(key_ptr, 'h', len);
+            *val_ptr = len;
+            cr_assert(put(global_map, MAP_KEY(key_ptr, len), MAP_VAL(val_ptr, sizeof(int)), false), "%s: insertion %d failed", entry->name, len);
+        }
+        for(int len = 1; len <= 100; len++) {
+            char key[100];
+            memset(key, 'h', len);
+            map_val_t val = get(global_map, MAP_KEY(key, len));
+            cr_assert_not_null(val.val_base, "%s: key of length %d was not found", entry->name, len);
+            cr_assert_eq(*(int *)val.val_base, len, "%s: value is not expected. Is %d, expected %d", entry->name, *(int *)val.val_base, len);
+        }
+        invalidate_map(global_map);
+    }
+}
+
+void memory_map_init(void) {
+    global_map = create_growable_map(4, 0, 1, jenkins_hash, map_free_function);
+}
+
+#define MEMORY_LIMIT (64 << 10)
+
+Test(map_suite, 21_memory_limit, .timeout = 2, .init = memory_map_init, .fini = map_fini){
+    cr_assert(set_max_memory(global_map, MEMORY_LIMIT, NULL), "Memory limit was not set");
+
+    // entries keep going in, and older ones are evicted to stay within the limit
+    for(int index = 0; index < 2000; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        size_t len = 1 + index % 256;
+        char *val_ptr = malloc(len);
+        *key_ptr = index;
+        memset(val_ptr, 'v', len);
+        cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, len), true), "Insertion %d failed", index);
+        cr_assert_leq(global_map->bytes, MEMORY_LIMIT, "Took %lu bytes after insertion %d", (unsigned long) global_map->bytes, index);
+        int key = index;
+        cr_assert_eq(get(global_map, MAP_KEY(&key, sizeof(int))).val_base, val_ptr, "Key %d was not found after its insertion", index);
+    }
+    cr_assert_lt(global_map->size, 2000, "Nothing was evicted");
+    cr_assert_gt(global_map->capacity, 4, "Map never grew");
+
+    // the probe arrays and every key and value in them are counted
+    uint64_t entries = 0;
+    for(uint32_t index = 0; index < global_map->capacity; index++) {
+        entries += global_map->nodes[index].key.key_len + global_map->nodes[index].val.val_len;
+    }
+    for(uint32_t index = 0; global_map->old_nodes != NULL && index < global_map->old_capacity; index++) {
+        entries += global_map->old_nodes[index].key.key_len + global_map->old_nodes[index].val.val_len;
+    }
+    cr_assert_geq(global_map->bytes, entries + global_map->capacity * sizeof(map_node_t), "Counted %lu bytes for %lu bytes of entries",
+        (unsigned long) global_map->bytes, (unsigned long) entries);
+
+    // a value that does not fit is only put if forced, and one that could never fit is refused
+    int *key_ptr = malloc(sizeof(int));
+    char *val_ptr = malloc(MEMORY_LIMIT);
+    *key_ptr = 0;
+    cr_assert(!put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, MEMORY_LIMIT / 4), false), "Unforced insertion over the limit succeeded");
+    cr_assert(!put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, MEMORY_LIMIT), true), "Insertion larger than the limit succeeded");
+    uint32_t size = global_map->size;
+    cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, MEMORY_LIMIT / 4), true), "Forced insertion failed");
+    cr_assert_lt(global_map->size, size, "Nothing was evicted for a large value");
+    cr_assert_leq(global_map->bytes, MEMORY_LIMIT, "Took %lu bytes after a large value", (unsigned long) global_map->bytes);
+
+    cr_assert(!set_max_memory(global_map, MEMORY_LIMIT * 2, NULL), "Memory limit was changed on a map with entries");
+}
+
+#define HOT_KEYS 16
+
+/*
+ * Fills a map of 256 entries with HOT_KEYS keys that are read before every
+ * later insertion, and many more that are never read.
+ *
+ * @return The number of hot keys still in the map.
+ */
+static int hot_keys_kept(map_evict_t eviction) {
+    global_map = create_map(256, jenkins_hash, map_free_function);
+    cr_assert(set_eviction(global_map, eviction), "Eviction policy %d was not set", eviction);
+    for(int index = 0; index < 2000; index++) {
+        for(int hot = 0; hot < HOT_KEYS && index > HOT_KEYS; hot++) {
+            get(global_map, MAP_KEY(&hot, sizeof(int)));
+        }
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index;
+        cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), true), "Insertion %d failed", index);
+    }
+    int kept = 0;
+    for(int hot = 0; hot < HOT_KEYS; hot++) {
+        kept += get(global_map, MAP_KEY(&hot, sizeof(int))).val_base != NULL;
+    }
+    cr_assert_eq(global_map->size, 256, "Size is %u after filling the map", global_map->size);
+    invalidate_map(global_map);
+    return kept;
+}
+
+Test(map_suite, 22_reference_bit_eviction, .timeout = 2){
+    // a key that is read is passed over while there are keys that are not
+    int kept = hot_keys_kept(MAP_EVICT_CLOCK);
+    cr_assert_eq(kept, HOT_KEYS, "CLOCK evicted %d hot keys", HOT_KEYS - kept);
+    // sampling only evicts a hot key if every key it samples is hot
+    kept = hot_keys_kept(MAP_EVICT_SAMPLE);
+    cr_assert_geq(kept, HOT_KEYS - 1, "Sampling evicted %d hot keys", HOT_KEYS - kept);
+
+    global_map = create_map(4, jenkins_hash, map_free_function);
+    cr_assert(!set_eviction(global_map, MAP_EVICT_SAMPLE + 1), "An unknown eviction policy was set");
+    invalidate_map(global_map);
+}
+
+int destroyed;
+
+void count_destroy(map_key_t key, map_val_t val) {
+    destroyed++;
+    map_free_function(key, val);
+}
+
+Test(map_suite, 23_discard, .timeout = 2){
+    global_map = create_sharded_map(16, 2, jenkins_hash, count_destroy);
+    destroyed = 0;
+    for(int index = 0; index < 10; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index;
+        cr_assert(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), false), "Insertion %d failed", index);
+    }
+
+    // the map destroys what it discards, so the keys passed in are the caller's own
+    int key = 0;
+    cr_assert(discard(global_map, MAP_KEY(&key, sizeof(int))), "Key 0 was not discarded");
+    cr_assert_null(get(global_map, MAP_KEY(&key, sizeof(int))).val_base, "Discarded key was found");
+    cr_assert(!discard(global_map, MAP_KEY(&key, sizeof(int))), "Key 0 was discarded twice");
+
+    int numbers[5] = {1, 2, 3, 4, 42};
+    map_key_t keys[5];
+    for(int index = 0; index < 5; index++) {
+        keys[index] = MAP_KEY(&numbers[index], sizeof(int));
+    }
+    size_t removed = discard_multi(global_map, keys, 5);
+    cr_assert_eq(removed, 4, "Discarded %d items. Expected %d", (int) removed, 4);
+    cr_assert_eq(global_map->size, 5, "Had %d items in map. Expected %d", global_map->size, 5);
+
+    // every entry, discarded or still in the map, is destroyed exactly once
+    invalidate_map(global_map);
+    cr_assert_eq(destroyed, 10, "Destroyed %d entries. Expected %d", destroyed, 10);
+}
+
+#define CHURN_KEYS 512
+#define CHURN_READERS 4
+#define CHURN_WRITERS 2
+#define CHURN_HOT_KEYS 4
+#define CHURN_MAGIC 0x5bd1e995
+
+/* A value that shows whether it was torn or already destroyed when it is read. */
+typedef struct churn_val_t {
+    int key;
+    int version;
+    int check;
+} churn_val_t;
+
+int churn_keys[CHURN_KEYS];
+
+void churn_free_function(map_key_t key, map_val_t val) {
+    //A READER THAT STILL SEES THE VALUE AFTER THIS FAILS ITS CHECK, OR ASAN REPORTS THE USE AFTER FREE.
+    memset(val.val_base, 0, sizeof(churn_val_t));
+    free(val.val_base);
+}
+
+static __thread int churn_expected;
+static __thread bool churn_writer;
+
+/*
+ * Writers hash keys while they hold the map. Yielding there keeps them in
+ * long enough for lock-free readers to give up and wait for the read lock.
+ */
+uint32_t churn_hash(map_key_t key) {
+    if(churn_writer){
+        sched_yield();
+    }
+    return jenkins_hash(key);
+}
+
+void churn_check(map_val_t val) {
+    // give writers the chance to replace or remove the value between the lookup and the check
+    sched_yield();
+    churn_val_t *churn = val.val_base;
+    cr_assert_eq(val.val_len, sizeof(churn_val_t), "Key %d had a value of %lu bytes", churn_expected, (unsigned long) val.val_len);
+    cr_assert_eq(churn->key, churn_expected, "Key %d had the value of key %d", churn_expected, churn->key);
+    cr_assert_eq(churn->check, churn->key ^ churn->version ^ CHURN_MAGIC, "Key %d had a torn or destroyed value", churn_expected);
+}
+
+static bool churn_put(int key, int version) {
+    churn_val_t *churn = malloc(sizeof(churn_val_t));
+    *churn = (churn_val_t) {.key = key, .version = version, .check = key ^ version ^ CHURN_MAGIC};
+    if(!put(global_map, MAP_KEY(&churn_keys[key], sizeof(int)), MAP_VAL(churn, sizeof(churn_val_t)), true)){
+        free(churn);
+        return false;
+    }
+    return true;
+}
+
+bool churn_done;
+
+void *churn_read(void *arg) {
+    // readers never stop before the writers are done, so a writer shut out by them runs into the timeout
+    for(int round = 0; !__atomic_load_n(&churn_done, __ATOMIC_ACQUIRE); round++) {
+        // half the lookups go to a few hot keys, so locked readers hold values that writers are replacing
+        churn_expected = round % 2 == 0 ? (round * 7) % CHURN_KEYS : round % CHURN_HOT_KEYS;
+        map_key_t key = MAP_KEY(&churn_keys[churn_expected], sizeof(int));
+        if(round % 4 < 2){
+            get_pinned(global_map, key, churn_check);
+        }
+        else{
+            map_val_t val;
+            get_multi_pinned(global_map, &key, &val, 1, churn_check);
+        }
+    }
+    return NULL;
+}
+
+void *churn_write(void *arg) {
+    unsigned int seed = (unsigned int) (uintptr_t) arg;
+    churn_writer = true;
+    for(int round = 0; round < 5000; round++) {
+        int key = rand_r(&seed) % (round % 2 == 0 ? CHURN_KEYS : CHURN_HOT_KEYS);
+        if(rand_r(&seed) % 4 == 0){
+            // the map does not own the key, so only the value comes back to free
+            map_node_t node = delete(global_map, MAP_KEY(&churn_keys[key], sizeof(int)));
+            free(node.val.val_base);
+        }
+        else{
+            // replaces the value, or inserts it, growing the map or evicting another key once it is full
+            cr_assert(churn_put(key, round), "Insertion of key %d failed", key);
+        }
+    }
+    return NULL;
+}
+
+Test(map_suite, 24_concurrent_readers_and_writers, .timeout = 10){
+    for(int key = 0; key < CHURN_KEYS; key++) {
+        churn_keys[key] = key;
+    }
+    // readers check every value they find while writers replace, delete, evict and grow
+    for(int num_shards = 1; num_shards <= 2; num_shards++) {
+        global_map = create_growable_map(4, CHURN_KEYS / 2, num_shards, churn_hash, churn_free_function);
+        churn_done = false;
+        pthread_t readers[CHURN_READERS], writers[CHURN_WRITERS];
+        for(int i = 0; i < CHURN_READERS; i++) {
+            pthread_create(&readers[i], NULL, churn_read, NULL);
+        }
+        for(int i = 0; i < CHURN_WRITERS; i++) {
+            pthread_create(&writers[i], NULL, churn_write, (void *) (uintptr_t) (i + 1));
+        }
+        for(int i = 0; i < CHURN_WRITERS; i++) {
+            pthread_join(writers[i], NULL);
+        }
+        __atomic_store_n(&churn_done, true, __ATOMIC_RELEASE);
+        for(int i = 0; i < CHURN_READERS; i++) {
+            pthread_join(readers[i], NULL);
+        }
+        cr_assert_gt(global_map->capacity, 4, "Map never grew");
+        cr_assert_leq(global_map->size, CHURN_KEYS / 2, "Size is %u in a map of at most %d", global_map->size, CHURN_KEYS / 2);
+        for(int key = 0; key < CHURN_KEYS; key++) {
+            churn_expected = key;
+            get_pinned(global_map, MAP_KEY(&churn_keys[key], sizeof(int)), churn_check);
+        }
+        invalidate_map(global_map);
+    }
+}
+
+/*
+ * Puts 1000 distinct keys into global_map, forced or not.
+ *
+ * @return The number of puts that succeeded.
+ */
+static int put_distinct_keys(bool force) {
+    int stored = 0;
+    for(int index = 0; index < 1000; index++) {
+        int *key_ptr = malloc(sizeof(int));
+        int *val_ptr = malloc(sizeof(int));
+        *key_ptr = index;
+        *val_ptr = index;
+        if(put(global_map, MAP_KEY(key_ptr, sizeof(int)), MAP_VAL(val_ptr, sizeof(int)), force)){
+            stored++;
+        }
+        else{
+            free(key_ptr);
+            free(val_ptr);
+        }
+    }
+    return stored;
+}
+
+Test(map_suite, 25_sharded_map_capacity, .timeout = 5){
+    // however many shards it is split into, a map holds at most as many entries as it was asked to
+    for(uint32_t num_shards = 1; num_shards <= MAP_MAX_SHARDS; num_shards *= 2) {
+        global_map = create_sharded_map(10, num_shards, jenkins_hash, map_free_function);
+        cr_assert_leq(global_map->num_shards, 10, "A map of 10 entries has %u shards", global_map->num_shards);
+        int stored = put_distinct_keys(false);
+        cr_assert_eq(stored, 10, "%u shards stored %d entries. Expected %d", num_shards, stored, 10);
+        put_distinct_keys(true);
+        cr_assert_eq(global_map->size, 10, "%u shards held %u entries after forced puts", num_shards, global_map->size);
+        invalidate_map(global_map);
+
+        global_map = create_growable_map(2, 10, num_shards, jenkins_hash, map_free_function);
+        stored = put_distinct_keys(false);
+        cr_assert_eq(stored, 10, "%u growable shards stored %d entries. Expected %d", num_shards, stored, 10);
+        invalidate_map(global_map);
+    }
+}
+
+Test(map_suite, 26_multi_on_invalid_map, .timeout = 2){
+    global_map = create_sharded_map(16, 4, jenkins_hash, map_free_function);
+    invalidate_map(global_map);
+
+    // a batch the map refuses still sets every result, value and node, so none is left from before
+    int numbers[4] = {0, 1, 2, 3};
+    map_key_t keys[4];
+    map_val_t vals[4];
+    map_node_t nodes[4];
+    bool results[4];
+    for(int index = 0; index < 4; index++) {
+        keys[index] = MAP_KEY(&numbers[index], sizeof(int));
+        vals[index] = MAP_VAL(&numbers[index], sizeof(int));
+        nodes[index] = MAP_NODE(keys[index], vals[index], false);
+        results[index] = true;
+    }
+    cr_assert_eq(put_multi(global_map, keys, vals, 4, true, results), 0, "Put into an invalid map");
+    cr_assert_eq(delete_multi(global_map, keys, nodes, 4), 0, "Deleted from an invalid map");
+    cr_assert_eq(get_multi(global_map, keys, vals, 4), 0, "Found keys in an invalid map");
+    for(int index = 0; index < 4; index++) {
+        cr_assert(!results[index], "Result %d was left true", index);
+        cr_assert_null(vals[index].val_base, "Value %d was left set", index);
+        cr_assert_null(nodes[index].val.val_base, "Node %d was left set", index);
+    }
+}
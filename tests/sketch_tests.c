@@ -0,0 +1,84 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sketch.h"
+#define NUM_KEYS 1000
+#define NUM_THREADS 4
+
+static sketch_t sketch;
+
+static void sketch_setup(void) {
+    cr_assert(sketch_init(&sketch, NUM_KEYS), "Sketch was not allocated");
+}
+
+static void sketch_teardown(void) {
+    sketch_free(&sketch);
+}
+
+/* Spreads small key numbers over 32 bits, as a key's hash would be. */
+static uint32_t hash_of(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    return key;
+}
+
+Test(sketch_suite, 00_counts, .timeout = 2, .init = sketch_setup, .fini = sketch_teardown){
+    // key k is counted k % 20 times
+    for(uint32_t key = 0; key < NUM_KEYS; key++) {
+        for(uint32_t i = 0; i < key % 20; i++) {
+            sketch_increment(&sketch, hash_of(key));
+        }
+    }
+    uint32_t exact = 0;
+    for(uint32_t key = 0; key < NUM_KEYS; key++) {
+        uint32_t count = key % 20 < SKETCH_MAX_COUNT ? key % 20 : SKETCH_MAX_COUNT;
+        uint32_t estimate = sketch_estimate(&sketch, hash_of(key));
+        cr_assert_geq(estimate, count, "Key %u was counted %u times and estimated at %u", key, count, estimate);
+        exact += estimate == count;
+    }
+    // an estimate is only off where the key collides with another in every row
+    cr_assert_gt(exact, NUM_KEYS * 3 / 4, "Only %u of %d estimates were exact", exact, NUM_KEYS);
+    cr_assert_eq(sketch_estimate(&sketch, hash_of(NUM_KEYS * 7)), 0, "A key never counted was estimated above 0");
+}
+
+Test(sketch_suite, 01_aging, .timeout = 2, .init = sketch_setup, .fini = sketch_teardown){
+    for(int i = 0; i < 12; i++) {
+        sketch_increment(&sketch, hash_of(0));
+    }
+    cr_assert(!sketch_age(&sketch), "Aged before sample_size increments");
+
+    // one-hit keys bring the sketch to its sample size, and the hot key is halved with the rest
+    for(uint32_t key = 1; sketch.additions < sketch.sample_size; key++) {
+        sketch_increment(&sketch, hash_of(key));
+    }
+    uint32_t before = sketch_estimate(&sketch, hash_of(0));
+    cr_assert(sketch_age(&sketch), "Did not age after sample_size increments");
+    cr_assert_eq(sketch_estimate(&sketch, hash_of(0)), before / 2, "Estimate went from %u to %u", before, sketch_estimate(&sketch, hash_of(0)));
+    cr_assert_eq(sketch.additions, sketch.sample_size / 2, "Additions were not halved");
+}
+
+static void *count_keys(void *arg) {
+    for(int round = 0; round < 10; round++) {
+        for(uint32_t key = 0; key < NUM_KEYS; key++) {
+            sketch_increment(&sketch, hash_of(key));
+        }
+    }
+    return NULL;
+}
+
+Test(sketch_suite, 02_concurrent_increments, .timeout = 5, .init = sketch_setup, .fini = sketch_teardown){
+    pthread_t tids[NUM_THREADS];
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&tids[i], NULL, count_keys, NULL);
+    }
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    // every key is counted up to the top, and no counter goes past it into the next
+    for(uint32_t key = 0; key < NUM_KEYS; key++) {
+        cr_assert_eq(sketch_estimate(&sketch, hash_of(key)), SKETCH_MAX_COUNT, "Key %u was estimated at %u", key, sketch_estimate(&sketch, hash_of(key)));
+    }
+}
@@ -0,0 +1,81 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "slab.h"
+#define NUM_CHUNKS 2000
+
+static void *chunks[NUM_CHUNKS];
+static size_t sizes[NUM_CHUNKS];
+
+/*
+ * Allocates NUM_CHUNKS chunks of sizes cycling from 1 byte up to past the
+ * largest class, each filled with its own index.
+ */
+static void *alloc_chunks(void *arg) {
+    for(int index = 0; index < NUM_CHUNKS; index++) {
+        sizes[index] = 1 + (size_t) index * 37 % (SLAB_MAX_CHUNK + 1000);
+        chunks[index] = slab_alloc(sizes[index]);
+        memset(chunks[index], index & 0xff, sizes[index]);
+    }
+    return NULL;
+}
+
+static void *free_chunks(void *arg) {
+    for(int index = 0; index < NUM_CHUNKS; index++) {
+        slab_free(chunks[index], sizes[index]);
+    }
+    return NULL;
+}
+
+Test(slab_suite, 00_size_classes, .timeout = 2){
+    size_t previous = 0;
+    for(size_t size = 1; size <= SLAB_MAX_CHUNK; size++) {
+        size_t chunk = slab_chunk_size(size);
+        cr_assert_geq(chunk, size, "A %zu byte allocation got a %zu byte chunk", size, chunk);
+        cr_assert_eq(chunk % 8, 0, "Chunk size %zu is not a multiple of 8", chunk);
+        cr_assert_geq(chunk, previous, "Chunk sizes shrank from %zu to %zu", previous, chunk);
+        if(size > SLAB_MIN_CHUNK) {
+            cr_assert_leq(chunk * 100, size * SLAB_GROWTH_PERCENT + 800, "A %zu byte allocation got a %zu byte chunk", size, chunk);
+        }
+        previous = chunk;
+    }
+    cr_assert_eq(slab_chunk_size(SLAB_MAX_CHUNK + 1), SLAB_MAX_CHUNK + 1, "Large allocations are not passed through");
+}
+
+Test(slab_suite, 01_chunks_do_not_overlap, .timeout = 2){
+    alloc_chunks(NULL);
+    for(int index = 0; index < NUM_CHUNKS; index++) {
+        cr_assert_eq((uintptr_t) chunks[index] % 8, 0, "Chunk %d is not 8 byte aligned", index);
+        uint8_t *bytes = chunks[index];
+        for(size_t i = 0; i < sizes[index]; i++) {
+            cr_assert_eq(bytes[i], index & 0xff, "Chunk %d was overwritten at byte %zu", index, i);
+        }
+    }
+    free_chunks(NULL);
+
+    // freed chunks are reused, so the same allocations again take no more memory
+    size_t footprint = slab_footprint();
+    alloc_chunks(NULL);
+    free_chunks(NULL);
+    cr_assert_eq(slab_footprint(), footprint, "Footprint grew from %zu to %zu", footprint, slab_footprint());
+}
+
+Test(slab_suite, 02_cross_thread_free, .timeout = 5){
+    pthread_t tid;
+    size_t footprint = 0;
+
+    // chunks freed by a thread that has exited are reused by the others
+    for(int round = 0; round < 20; round++) {
+        pthread_create(&tid, NULL, alloc_chunks, NULL);
+        pthread_join(tid, NULL);
+        pthread_create(&tid, NULL, free_chunks, NULL);
+        pthread_join(tid, NULL);
+        if(round == 0) {
+            footprint = slab_footprint();
+        }
+    }
+    cr_assert_eq(slab_footprint(), footprint, "Footprint grew from %zu to %zu", footprint, slab_footprint());
+}